@@ -9,10 +9,25 @@
 #define MAX_SERVER_NAME		128
 #define MAX_DEVICE_TOKEN	128
 #define MAX_DEVICE_ID		128
+#define OTA_HASH_STATE_SIZE	256
+#define OTA_VALIDATOR_SIZE	64
+
+/* OTA download progress, resumed with HTTP Range */
+typedef struct
+{
+	uint32_t len;		/* image length, 0 if nothing to resume */
+	uint32_t offset;	/* written to flash and hashed */
+	uint8_t id[16];		/* md5 of host, path and expected md5 */
+	char validator[OTA_VALIDATOR_SIZE];	/* strong ETag or Last-Modified
+						 * sent as If-Range, "" if none */
+	uint8_t hash_state[OTA_HASH_STATE_SIZE];
+} ota_progress_t;
 
 typedef struct
 {
 	char server[MAX_SERVER_NAME];
 	char device_token[MAX_DEVICE_TOKEN];
 	char device_id[MAX_DEVICE_ID];
+	ota_progress_t ota;
+	uint8_t ota_app;	/* app index booted by the last upgrade + 1, 0 if none */
 } app_dct_t;
@@ -214,6 +214,10 @@ int cmd_adc(int argc, char* argv[])
 	return ERR_CMD_OK;
 }
 
+/* created on first upgrade and kept, TLS needs the large stack */
+static wiced_worker_thread_t upgrade_thread;
+static wiced_bool_t upgrade_thread_ready;
+
 static wiced_result_t upgrade_worker(void * arg)
 {
 	ushort port;
@@ -222,26 +226,36 @@ static wiced_result_t upgrade_worker(void * arg)
 
 	port = atoi(argv[2]);
 
-	a_upgrade_try(WICED_FALSE, argv[1], port, argv[3], NULL, WICED_FALSE);
+	/* argv[4] is md5 or sha256 of the image, NULL if not given */
+	a_upgrade_try(WICED_FALSE, argv[1], port, argv[3], argv[4], WICED_FALSE);
 	wiced_rtos_set_semaphore(sem);
 	return WICED_SUCCESS;
 }
 
 int cmd_upgrade(int argc, char* argv[])
 {
-	wiced_worker_thread_t worker_thread;
 	wiced_semaphore_t sem;
+	char *args[5];
 
 	if (argc < 4)
 		return ERR_INSUFFICENT_ARGS;
 
-	argv[0] = (char*)&sem;
+	if (!upgrade_thread_ready) {
+		if (wiced_rtos_create_worker_thread(&upgrade_thread, WICED_DEFAULT_WORKER_PRIORITY,
+						    8192, 1) != WICED_SUCCESS)
+			return ERR_UNKNOWN;
+		upgrade_thread_ready = WICED_TRUE;
+	}
+
+	args[0] = (char*)&sem;
+	args[1] = argv[1];
+	args[2] = argv[2];
+	args[3] = argv[3];
+	args[4] = (argc > 4) ? argv[4] : NULL;
+
 	wiced_rtos_init_semaphore(&sem);
-	wiced_rtos_create_worker_thread(&worker_thread, WICED_DEFAULT_WORKER_PRIORITY, 8192, 1);
-	wiced_rtos_send_asynchronous_event(&worker_thread, upgrade_worker, argv);
+	wiced_rtos_send_asynchronous_event(&upgrade_thread, upgrade_worker, args);
 	wiced_rtos_get_semaphore(&sem, WICED_WAIT_FOREVER);
-
-	wiced_rtos_delete_worker_thread(&worker_thread);
 	wiced_rtos_deinit_semaphore(&sem);
 	return ERR_CMD_OK;
 }
@@ -31,4 +31,4 @@ int cmd_upgrade(int argc, char* argv[]);
  { "rssi", cmd_rssi, 0, NULL, NULL, NULL, "Get RSSI" }, \
  { "pwm", cmd_pwm, 2, NULL, NULL, "index level (freq)", "Set PWM" }, \
  { "adc", cmd_adc, 0, NULL, NULL, NULL, "Read all ADC" },\
- { "upgrade", cmd_upgrade, 3, NULL, NULL, NULL, "hostname port path", "Upgrade FW" },
+ { "upgrade", cmd_upgrade, 3, NULL, NULL, NULL, "hostname port path [md5|sha256]", "Upgrade FW" },
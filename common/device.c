@@ -11,8 +11,6 @@
 #include "app_dct.h"
 #include "maxim_ssi.h"
 
-#define UART_RX_BUFFER_SIZE 64
-
 static const wiced_i2c_device_t temp_i2c_device =
 {
 	.port          = WICED_I2C_1,
@@ -125,7 +125,7 @@ wiced_result_t a_eventloop_register_event(eventloop_t* el,
 wiced_result_t a_eventloop_deregister_event(eventloop_t* el,
 					    eventloop_event_node_t* node_remove)
 {
-	return remove_node_safe(&el->timer_list, &node_remove->node);
+	return remove_node_safe(&el->event_list, &node_remove->node);
 }
 
 wiced_result_t a_eventloop_set_flag(eventloop_t* el, uint32_t event)
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http_reader.h"
+
+void a_http_reader_init(a_http_reader_t *r, wiced_tcp_socket_t *socket,
+			char *line, uint16_t line_size, uint32_t timeout)
+{
+	memset(r, 0, sizeof(*r));
+	r->socket = socket;
+	r->timeout = timeout;
+	r->line = line;
+	r->line_size = line_size;
+	r->content_length = -1;
+	r->body = HTTP_BODY_DONE;
+}
+
+void a_http_reader_deinit(a_http_reader_t *r)
+{
+	if (r->packet) {
+		wiced_packet_delete(r->packet);
+		r->packet = NULL;
+	}
+}
+
+/* contiguous received bytes at the read position. returns length,
+ * 0 if connection is closed, A_HTTP_AGAIN or -1 on error */
+static int _data(a_http_reader_t *r, uint8_t **data)
+{
+	uint16_t frag, total;
+	wiced_result_t res;
+
+	for (;;) {
+		if (r->packet == NULL) {
+			res = wiced_tcp_receive(r->socket, &r->packet, r->timeout);
+			if (res != WICED_SUCCESS) {
+				r->packet = NULL;
+				if (res == WICED_TCPIP_SOCKET_CLOSED)
+					return 0;
+				return (res == WICED_TIMEOUT || res == WICED_TCPIP_TIMEOUT) ? A_HTTP_AGAIN : -1;
+			}
+			r->offset = 0;
+		}
+		if (wiced_packet_get_data(r->packet, r->offset, data, &frag, &total) == WICED_SUCCESS &&
+		    frag > 0 && total > 0)
+			return (int)MIN(frag, total);
+
+		wiced_packet_delete(r->packet);
+		r->packet = NULL;
+	}
+}
+
+/* next line without CRLF, too long line is truncated.
+ * returns 1 with line, or the _data() result */
+static int _line(a_http_reader_t *r, char **line)
+{
+	uint8_t *data, *e;
+	int n, c;
+
+	for (;;) {
+		if ((n = _data(r, &data)) <= 0)
+			return n;
+
+		e = memchr(data, '\n', (size_t)n);
+		c = e ? (int)(e - data) : n;
+		if (r->line_len < r->line_size - 1) {
+			n = MIN(c, r->line_size - 1 - r->line_len);
+			memcpy(r->line + r->line_len, data, (size_t)n);
+			r->line_len += n;
+		}
+		r->offset += c;
+		if (e) {
+			r->offset++;
+			break;
+		}
+	}
+	n = r->line_len;
+	if (n > 0 && r->line[n - 1] == '\r')
+		n--;
+	r->line[n] = '\0';
+	r->line_len = 0;
+	*line = r->line;
+	return 1;
+}
+
+static void _header(a_http_reader_t *r, char *name, a_http_header_fn fn, void *arg)
+{
+	char *v, *e;
+	unsigned long from, to, total;
+	size_t n;
+
+	if ((v = strchr(name, ':')) == NULL)
+		return;
+	*v++ = '\0';
+	while (*v == ' ' || *v == '\t')
+		v++;
+	for (e = v + strlen(v); e > v && (e[-1] == ' ' || e[-1] == '\t'); e--)
+		;
+	*e = '\0';
+
+	if (strcasecmp(name, "Content-Length") == 0) {
+		r->content_length = (int32_t)strtol(v, &e, 10);
+		if (e == v || *e || r->content_length < 0)
+			r->content_length = -1;
+	} else if (strcasecmp(name, "Transfer-Encoding") == 0) {
+		/* chunked is always the last coding */
+		n = strlen(v);
+		r->chunked = (n >= 7 && strcasecmp(v + n - 7, "chunked") == 0) ? WICED_TRUE : WICED_FALSE;
+	} else if (strcasecmp(name, "Connection") == 0) {
+		if (strcasecmp(v, "close") == 0)
+			r->keep_alive = WICED_FALSE;
+		else if (strcasecmp(v, "keep-alive") == 0)
+			r->keep_alive = WICED_TRUE;
+	} else if (strcasecmp(name, "Content-Range") == 0) {
+		if (sscanf(v, "bytes %lu-%lu/%lu", &from, &to, &total) == 3 && from <= to && to < total) {
+			r->range_from = (uint32_t)from;
+			r->range_total = (uint32_t)total;
+		}
+	}
+
+	if (fn)
+		(*fn)(arg, name, v);
+}
+
+static wiced_result_t _error(int n)
+{
+	return (n == A_HTTP_AGAIN) ? WICED_TIMEOUT : WICED_ERROR;
+}
+
+wiced_result_t a_http_read_response(a_http_reader_t *r, a_http_header_fn fn, void *arg)
+{
+	const uint8_t *data;
+	char *l;
+	int n;
+
+	/* rest of previous response on a kept-alive connection */
+	while ((n = a_http_next_body(r, &data, 0xFFFFFFFF)) > 0)
+		;
+	if (n < 0)
+		return _error(n);
+
+	do {
+		r->status = 0;
+		r->content_length = -1;
+		r->range_from = r->range_total = 0;
+		r->chunked = WICED_FALSE;
+
+		if ((n = _line(r, &l)) <= 0)
+			return _error(n);
+		if (strncmp(l, "HTTP/1.", 7) != 0 || l[7] < '0' || l[7] > '9' || l[8] != ' ')
+			return WICED_BADVALUE;
+		n = atoi(l + 9);
+		if (n < 100 || n > 999)
+			return WICED_BADVALUE;
+		r->status = n;
+		r->keep_alive = (l[7] != '0') ? WICED_TRUE : WICED_FALSE;
+
+		while ((n = _line(r, &l)) > 0 && *l)
+			_header(r, l, fn, arg);
+		if (n <= 0)
+			return _error(n);
+	} while (r->status < 200);
+
+	if (r->status == 204 || r->status == 304) {
+		r->body = HTTP_BODY_DONE;
+	} else if (r->chunked) {
+		r->body = HTTP_BODY_CHUNK_SIZE;
+	} else if (r->content_length >= 0) {
+		r->left = (uint32_t)r->content_length;
+		r->body = r->left ? HTTP_BODY_LENGTH : HTTP_BODY_DONE;
+	} else {
+		r->body = HTTP_BODY_CLOSE;
+		r->keep_alive = WICED_FALSE;
+	}
+	return WICED_SUCCESS;
+}
+
+/* steps over chunk framing until body data or end.
+ * returns 1 if data follows, 0 at the end, A_HTTP_AGAIN or -1 */
+static int _body_ready(a_http_reader_t *r)
+{
+	char *l, *e;
+	unsigned long n;
+	int res;
+
+	for (;;) {
+		if (r->body == HTTP_BODY_DONE)
+			return 0;
+		if (r->body == HTTP_BODY_LENGTH || r->body == HTTP_BODY_CHUNK_DATA ||
+		    r->body == HTTP_BODY_CLOSE)
+			return 1;
+
+		if ((res = _line(r, &l)) <= 0)
+			return (res == A_HTTP_AGAIN) ? res : -1;
+
+		if (r->body == HTTP_BODY_CHUNK_END) {
+			if (*l)
+				return -1;
+			r->body = HTTP_BODY_CHUNK_SIZE;
+		} else if (r->body == HTTP_BODY_CHUNK_SIZE) {
+			/* chunk extensions after size are ignored */
+			n = strtoul(l, &e, 16);
+			if (e == l || n > 0x7FFFFFFF)
+				return -1;
+			r->left = (uint32_t)n;
+			r->body = n ? HTTP_BODY_CHUNK_DATA : HTTP_BODY_TRAILER;
+		} else if (*l == '\0') {
+			/* end of trailer */
+			r->body = HTTP_BODY_DONE;
+		}
+	}
+}
+
+int a_http_next_body(a_http_reader_t *r, const uint8_t **data, uint32_t max)
+{
+	uint8_t *p;
+	int n;
+
+	if ((n = _body_ready(r)) <= 0)
+		return n;
+
+	if ((n = _data(r, &p)) <= 0) {
+		if (n == 0 && r->body == HTTP_BODY_CLOSE) {
+			r->body = HTTP_BODY_DONE;
+			return 0;
+		}
+		return (n == A_HTTP_AGAIN) ? n : -1;
+	}
+	if ((uint32_t)n > max)
+		n = (int)max;
+	if (r->body != HTTP_BODY_CLOSE) {
+		if ((uint32_t)n > r->left)
+			n = (int)r->left;
+		r->left -= (uint32_t)n;
+		if (r->left == 0)
+			r->body = (r->body == HTTP_BODY_LENGTH) ? HTTP_BODY_DONE : HTTP_BODY_CHUNK_END;
+	}
+	r->offset += (uint16_t)n;
+	*data = p;
+	return n;
+}
+
+int a_http_read_body(a_http_reader_t *r, void *dst, uint32_t len)
+{
+	const uint8_t *data;
+	int n;
+
+	if (len == 0)
+		return 0;
+	if ((n = a_http_next_body(r, &data, len)) > 0)
+		memcpy(dst, data, (size_t)n);
+	return n;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include "wiced.h"
+
+/* buffered HTTP/1.1 response reader.
+ *
+ * Response is taken from the socket one received packet at a time.
+ * Header lines are scanned once in the packet and copied to the line
+ * buffer given by caller, body is handed out from the packet.
+ */
+
+enum a_http_body {
+	HTTP_BODY_DONE,
+	HTTP_BODY_LENGTH,	/* Content-Length */
+	HTTP_BODY_CHUNK_SIZE,	/* chunked transfer-encoding */
+	HTTP_BODY_CHUNK_DATA,
+	HTTP_BODY_CHUNK_END,
+	HTTP_BODY_TRAILER,
+	HTTP_BODY_CLOSE,	/* until connection is closed */
+};
+
+/* body readers return it when nothing arrived within timeout */
+#define A_HTTP_AGAIN		(-2)
+
+/* called for every header line, name and value are trimmed */
+typedef void (*a_http_header_fn)(void *arg, const char *name, const char *value);
+
+typedef struct {
+	wiced_tcp_socket_t *socket;
+	uint32_t timeout;
+	wiced_packet_t *packet;	/* packet being read, NULL if none */
+	uint16_t offset;	/* read position in packet */
+	char *line;
+	uint16_t line_size;
+	uint16_t line_len;	/* partial line kept over timeout */
+
+	/* response */
+	int status;		/* 0 until status line is read */
+	int32_t content_length;	/* -1 if not given */
+	uint32_t range_from;	/* Content-Range, range_total is 0 if none */
+	uint32_t range_total;
+	wiced_bool_t chunked;
+	wiced_bool_t keep_alive;
+
+	uint8_t body;		/* enum a_http_body */
+	uint32_t left;		/* bytes left in body or chunk */
+} a_http_reader_t;
+
+void a_http_reader_init(a_http_reader_t *r, wiced_tcp_socket_t *socket,
+			char *line, uint16_t line_size, uint32_t timeout);
+void a_http_reader_deinit(a_http_reader_t *r);
+
+/* skips rest of previous body, then reads status line and headers.
+ * Interim 1xx responses are skipped, timeout in headers is an error */
+wiced_result_t a_http_read_response(a_http_reader_t *r, a_http_header_fn fn, void *arg);
+
+/* body readers return bytes, 0 at the end of body, A_HTTP_AGAIN or -1
+ * on error. Short timeout makes them poll, so one thread can serve
+ * several readers. Both return at most one packet, next_body points
+ * into the packet and the data is valid until the next call */
+int a_http_read_body(a_http_reader_t *r, void *dst, uint32_t len);
+int a_http_next_body(a_http_reader_t *r, const uint8_t **data, uint32_t max);
+
+static inline wiced_bool_t a_http_body_is_done(a_http_reader_t *r) {
+	return (r->body == HTTP_BODY_DONE) ? WICED_TRUE : WICED_FALSE;
+}
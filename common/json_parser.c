@@ -8,172 +8,820 @@
 #include <string.h>
 #include <stdlib.h>
 
-/* simple JSON parser only support 1-depth object structure
- * without memory alloction */
+/* streaming JSON parser with nested object/array support
+ * without memory alloction.
+ *
+ * Every value gets an entry in caller supplied table (like jsmn).
+ * Strings and primitives are copied into buf terminated by 'sep'.
+ *
+ * In-place mode (a_json_parse_inplace) does not write at all. Entries
+ * point into the source text and escapes are decoded on access.
+ */
 
 int32_t a_json_init(a_json_t *json, char *buf, size_t buf_len,
-		 int *entry, size_t entry_len, char sep)
+		    a_json_entry_t *entry, size_t entry_len, char sep)
 {
 	size_t i;
-	if(json == 0 || buf == 0 || buf_len == 0 || entry_len == 0) { return -1; }
+	if(json == 0 || buf == 0 || buf_len == 0 || entry == 0 || entry_len == 0) { return -1; }
 	memset(json, 0, sizeof(a_json_t));
 
-	for (i = 0; i < entry_len; i++)
-		entry[i] = -1;
+	/* parent index is 16bit */
+	if (entry_len > INT16_MAX)
+		entry_len = INT16_MAX;
+	/* offsets are int */
+	if (buf_len > INT32_MAX)
+		buf_len = INT32_MAX;
 
 	json->buf = buf;
 	json->buf_max = buf_len;
 	json->entry = entry;
 	json->entry_max = entry_len;
 	json->sep = sep;
+	json->cur = -1;
+	for (i = 0; i < A_JSON_HASH_SIZE; i++)
+		json->hash[i] = -1;
 	return 0;
 }
 
-bool a_json_append(a_json_t *json, char c)
+static int _hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else
+		return -1;
+}
+
+static uint32_t _hex4(const char *s)
+{
+	int i, d;
+	uint32_t u = 0;
+	for (i = 0; i < 4; i++) {
+		if ((d = _hex(s[i])) < 0)
+			return UINT32_MAX;
+		u = (u << 4) | (uint32_t)d;
+	}
+	return u;
+}
+
+static int _utf8(uint32_t u, char *out)
+{
+	if (u < 0x80) {
+		out[0] = (char)u;
+		return 1;
+	}
+	if (u < 0x800) {
+		out[0] = (char)(0xc0 | (u >> 6));
+		out[1] = (char)(0x80 | (u & 0x3f));
+		return 2;
+	}
+	if (u < 0x10000) {
+		out[0] = (char)(0xe0 | (u >> 12));
+		out[1] = (char)(0x80 | ((u >> 6) & 0x3f));
+		out[2] = (char)(0x80 | (u & 0x3f));
+		return 3;
+	}
+	out[0] = (char)(0xf0 | (u >> 18));
+	out[1] = (char)(0x80 | ((u >> 12) & 0x3f));
+	out[2] = (char)(0x80 | ((u >> 6) & 0x3f));
+	out[3] = (char)(0x80 | (u & 0x3f));
+	return 4;
+}
+
+/* decode one char of a raw (in-place) string into out[4],
+ * returns utf-8 length or -1 */
+static int _decode(const char **p, const char *end, char *out)
+{
+	const char *s = *p;
+	uint32_t u, l;
+
+	if (*s != '\\') {
+		*out = *s;
+		*p = s + 1;
+		return 1;
+	}
+	if (end - s < 2)
+		return -1;
+
+	switch (s[1]) {
+	case 'b': *out = '\b'; break;
+	case 'f': *out = '\f'; break;
+	case 'n': *out = '\n'; break;
+	case 'r': *out = '\r'; break;
+	case 't': *out = '\t'; break;
+	case 'u':
+		if (end - s < 6 || (u = _hex4(s + 2)) == UINT32_MAX)
+			return -1;
+		s += 6;
+		if (u >= 0xd800 && u <= 0xdbff) {
+			if (end - s < 6 || s[0] != '\\' || s[1] != 'u')
+				return -1;
+			l = _hex4(s + 2);
+			if (l < 0xdc00 || l > 0xdfff)
+				return -1;
+			u = 0x10000 + ((u - 0xd800) << 10) + (l - 0xdc00);
+			s += 6;
+		}
+		*p = s;
+		return _utf8(u, out);
+	default:
+		*out = s[1];
+		break;
+	}
+	*p = s + 2;
+	return 1;
+}
+
+/* compare raw string with str, returns <0, 0, >0 like memcmp */
+static int _raw_cmp(const char *raw, size_t raw_len, bool escaped, const char *str, size_t len)
+{
+	const char *end = raw + raw_len;
+	char c[4];
+	int i, n;
+
+	if (!escaped) {
+		n = memcmp(raw, str, raw_len < len ? raw_len : len);
+		if (n)
+			return n;
+		return (raw_len < len) ? -1 : (raw_len > len);
+	}
+
+	while (raw < end) {
+		if ((n = _decode(&raw, end, c)) < 0)
+			return -1;
+		for (i = 0; i < n; i++, str++, len--) {
+			if (len == 0)
+				return 1;
+			if (c[i] != *str)
+				return (uint8_t)c[i] - (uint8_t)*str;
+		}
+	}
+	return len ? -1 : 0;
+}
+
+/* FNV-1a of member name salted with parent index */
+static uint32_t _hash_init(int parent)
+{
+	return (2166136261U ^ (uint32_t)parent) * 16777619U;
+}
+
+static uint32_t _hash_update(uint32_t h, const char *name, size_t len)
+{
+	while (len--) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static uint32_t _key_hash(a_json_t *json, a_json_entry_t *e)
+{
+	const char *p = json->buf + e->key;
+	const char *end = p + e->key_len;
+	uint32_t h = _hash_init(e->parent);
+	char c[4];
+	int n;
+
+	if (!(e->flags & JSON_FLAG_KEY_ESCAPED))
+		return _hash_update(h, p, e->key_len);
+
+	while (p < end && (n = _decode(&p, end, c)) > 0)
+		h = _hash_update(h, c, (size_t)n);
+	return h;
+}
+
+static void _hash_insert(a_json_t *json, int index)
+{
+	a_json_entry_t *e = &json->entry[index];
+	uint32_t h;
+
+	/* keep load factor under 3/4, the rest falls back to linear scan */
+	if (json->hash_cnt >= A_JSON_HASH_SIZE * 3 / 4) {
+		json->hash_overflow = true;
+		return;
+	}
+
+	h = _key_hash(json, e);
+	while (json->hash[h & (A_JSON_HASH_SIZE - 1)] >= 0)
+		h++;
+	json->hash[h & (A_JSON_HASH_SIZE - 1)] = (int16_t)index;
+	json->hash_cnt++;
+}
+
+static bool _put(a_json_t *json, char c)
+{
+	if (json->inplace)
+		return true;
+	if (json->buf_pos >= (int)json->buf_max)
+		return false;
+	json->buf[json->buf_pos++] = c;
+	return true;
+}
+
+static bool _put_utf8(a_json_t *json, uint32_t u)
+{
+	char c[4];
+	int i, n = _utf8(u, c);
+
+	for (i = 0; i < n; i++) {
+		if (!_put(json, c[i]))
+			return false;
+	}
+	return true;
+}
+
+/* offset of string content opened by the current '"' */
+static int _str_start(a_json_t *json)
+{
+	return json->inplace ? json->buf_pos + 1 : json->buf_pos;
+}
+
+static a_json_entry_t * _new_entry(a_json_t *json, int key)
+{
+	a_json_entry_t *e;
+	if (json->entry_pos >= (int)json->entry_max) {
+		json->full = true;
+		return NULL;
+	}
+
+	e = &json->entry[json->entry_pos++];
+	e->type = JSON_TYPE_NULL;
+	e->flags = 0;
+	e->parent = (int16_t)json->cur;
+	e->size = 0;
+	e->key = key;
+	e->key_len = 0;
+	e->val = -1;
+	e->val_len = 0;
+	if (json->cur >= 0)
+		json->entry[json->cur].size++;
+	return e;
+}
+
+static bool _is_primitive_char(char c)
+{
+	return isalnum((int)c) || c == '-' || c == '+' || c == '.';
+}
+
+static bool _is_digit(char c)
+{
+	return (unsigned)(c - '0') < 10;
+}
+
+/* validate literal or number and cache its value in the entry.
+ * number is kept as num * 10^exp without locale or libm */
+static bool _convert(a_json_entry_t *e, const char *p, int len)
+{
+	const char *end = p + len;
+	bool neg = false, exp_neg = false;
+	uint64_t m = 0;
+	int exp = 0, x = 0;
+
+	if (len == 4 && memcmp(p, "true", 4) == 0) {
+		e->type = JSON_TYPE_BOOL;
+		e->num = 1;
+		return true;
+	}
+	if (len == 5 && memcmp(p, "false", 5) == 0) {
+		e->type = JSON_TYPE_BOOL;
+		e->num = 0;
+		return true;
+	}
+	if (len == 4 && memcmp(p, "null", 4) == 0) {
+		e->type = JSON_TYPE_NULL;
+		return true;
+	}
+
+	if (p < end && *p == '-') {
+		neg = true;
+		p++;
+	}
+	if (p == end || !_is_digit(*p))
+		return false;
+
+	/* no leading zero */
+	if (*p == '0' && ++p < end && _is_digit(*p))
+		return false;
+
+	/* keep 19 significant digits */
+	for (; p < end && _is_digit(*p); p++) {
+		if (m < UINT64_MAX / 10 - 1)
+			m = m * 10 + (uint64_t)(*p - '0');
+		else
+			exp++;
+	}
+	if (p < end && *p == '.') {
+		if (++p == end || !_is_digit(*p))
+			return false;
+		for (; p < end && _is_digit(*p); p++) {
+			if (m < UINT64_MAX / 10 - 1) {
+				m = m * 10 + (uint64_t)(*p - '0');
+				exp--;
+			}
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		if (++p < end && (*p == '+' || *p == '-'))
+			exp_neg = (*p++ == '-');
+		if (p == end || !_is_digit(*p))
+			return false;
+		for (; p < end && _is_digit(*p); p++) {
+			if (x < 10000)
+				x = x * 10 + (*p - '0');
+		}
+	}
+	if (p != end)
+		return false;
+
+	exp += exp_neg ? -x : x;
+	while (m > (uint64_t)INT64_MAX + neg) {
+		m /= 10;
+		exp++;
+	}
+	while (m != 0 && m % 10 == 0 && exp < 0) {
+		m /= 10;
+		exp++;
+	}
+	if (m == 0)
+		exp = 0;
+	if (exp > INT16_MAX) exp = INT16_MAX;
+	if (exp < INT16_MIN) exp = INT16_MIN;
+
+	e->type = JSON_TYPE_NUMBER;
+	if (m > INT64_MAX)
+		e->num = INT64_MIN;
+	else
+		e->num = neg ? -(int64_t)m : (int64_t)m;
+	e->exp = (int16_t)exp;
+	return true;
+}
+
+/* \uXXXX escape, surrogate pairs are combined to one code point */
+static bool _append_hex(a_json_t *json, char c)
 {
+	int d = _hex(c);
+	uint32_t u;
+
+	if (d < 0)
+		return false;
+	json->hex = (uint16_t)((json->hex << 4) | d);
+	if (++json->hex_pos <= 4)
+		return true;
+
+	json->hex_pos = 0;
+	u = json->hex;
+	if (json->surrogate) {
+		if (u < 0xdc00 || u > 0xdfff)
+			return false;
+		u = 0x10000 + (((uint32_t)json->surrogate - 0xd800) << 10) + (u - 0xdc00);
+		json->surrogate = 0;
+	} else if (u >= 0xd800 && u <= 0xdbff) {
+		json->surrogate = (uint16_t)u;
+		return true;
+	} else if (u >= 0xdc00 && u <= 0xdfff) {
+		return false;
+	}
+	return _put_utf8(json, u);
+}
+
+static bool _append_in_str(a_json_t *json, char c)
+{
+	a_json_entry_t *e = &json->entry[json->entry_pos - 1];
+
+	if (json->hex_pos)
+		return _append_hex(json, c);
+
+	if (json->escaped) {
+		json->escaped = false;
+		if (json->surrogate && c != 'u')
+			return false;
+		switch (c) {
+		case '\\': return _put(json, '\\');
+		case '/':  return _put(json, '/');
+		case '"':  return _put(json, '"');
+		case 'b':  return _put(json, '\b');
+		case 'f':  return _put(json, '\f');
+		case 'n':  return _put(json, '\n');
+		case 'r':  return _put(json, '\r');
+		case 't':  return _put(json, '\t');
+		case 'u':
+			json->hex = 0;
+			json->hex_pos = 1;
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	if (c == '\\') {
+		json->escaped = true;
+		/* in-place strings are decoded on access */
+		if (json->inplace)
+			e->flags |= (json->s == JSON_NAME_IN_STR) ?
+				JSON_FLAG_KEY_ESCAPED : JSON_FLAG_VAL_ESCAPED;
+		return true;
+	}
+	if (json->surrogate)
+		return false;
+
+	if (c != '"')
+		return _put(json, c);
+
+	if (json->s == JSON_NAME_IN_STR) {
+		/* zero length name */
+		if (json->buf_pos == e->key || json->buf_pos - e->key > UINT16_MAX)
+			return false;
+		e->key_len = (uint16_t)(json->buf_pos - e->key);
+		_hash_insert(json, json->entry_pos - 1);
+		json->s = JSON_NAME_END;
+	} else {
+		e->val_len = json->buf_pos - e->val;
+		json->s = JSON_VALUE_END;
+	}
+	return _put(json, json->sep);
+}
+
+static void _open(a_json_t *json, a_json_entry_t *e, char c)
+{
+	if (c == '{') {
+		e->type = JSON_TYPE_OBJECT;
+		json->s = JSON_NAME;
+	} else {
+		e->type = JSON_TYPE_ARRAY;
+		json->s = JSON_VALUE;
+	}
+	json->cur = (int)(e - json->entry);
+}
+
+/* returns true if the root is closed */
+static bool _close(a_json_t *json)
+{
+	json->cur = json->entry[json->cur].parent;
+	json->s = JSON_VALUE_END;
+	return json->cur < 0;
+}
+
+static bool _append(a_json_t *json, char c)
+{
+	a_json_entry_t *e;
+	uint8_t container;
+
 	if (json->s == JSON_BAD || json->s == JSON_GOOD)
 		return true;
 
 	if (json->s == JSON_NAME_IN_STR || json->s == JSON_VALUE_IN_STR) {
-		if (json->escaped) {
-			json->escaped = false;
-			switch (c) {
-			case '\\': json->buf[json->buf_pos++] = '\\'; break;
-			case '/':  json->buf[json->buf_pos++] = '/';  break;
-			case '\r': json->buf[json->buf_pos++] = '\r'; break;
-			case '\n': json->buf[json->buf_pos++] = '\n'; break;
-			case '\f': json->buf[json->buf_pos++] = '\f'; break;
-			case '\t': json->buf[json->buf_pos++] = '\t'; break;
-			case '"':  json->buf[json->buf_pos++] = '"';  break;
-			default:
-				goto _bad;
-			}
-		} else if (c == '\\') {
-			json->escaped = true;
-		} else if (c == '"') {
-			if (json->s == JSON_NAME_IN_STR &&
-			    json->buf_pos == json->entry[json->entry_pos-1]) {
-				/* zero length name */
+		if (!_append_in_str(json, c))
+			goto _bad;
+		return false;
+	}
+
+	if (json->s == JSON_VALUE_IN_VAL) {
+		if (_is_primitive_char(c)) {
+			if (!_put(json, c))
 				goto _bad;
-			} else {
-				json->buf[json->buf_pos++] = json->sep;
-				json->s++; /* JSON_XXXX_END */
-			}
-		} else {
-			json->buf[json->buf_pos++] = c;
+			return false;
 		}
-		goto _check_length;
+		e = &json->entry[json->entry_pos - 1];
+		e->val_len = json->buf_pos - e->val;
+		if (!_convert(e, json->buf + e->val, e->val_len))
+			goto _bad;
+		if (!_put(json, json->sep))
+			goto _bad;
+		json->s = JSON_VALUE_END;
 	}
 
-	if (isspace((int)c)) {
-	_space:
-		if (json->s == JSON_VALUE_IN_VAL) {
-			json->buf[json->buf_pos++] = json->sep;
-			json->s = JSON_VALUE_END;
-		}
- 	} else if (c == '{') {
-		if (json->s == JSON_INIT) {
-			json->s = JSON_NAME;
-		} else if (json->s == JSON_VALUE) {
-			json->entry[json->entry_pos++] = json->buf_pos;
-			json->buf[json->buf_pos++] = json->sep;
-			json->recur++;
-			json->s = JSON_NAME;
+	if (isspace((unsigned char)c))
+		return false;
+
+	if (json->s == JSON_INIT) {
+		if (c != '{' && c != '[')
+			goto _bad;
+		if ((e = _new_entry(json, -1)) == NULL)
+			goto _bad;
+		_open(json, e, c);
+		return false;
+	}
+
+	container = json->entry[json->cur].type;
+
+	switch (json->s) {
+	case JSON_NAME:
+		if (c == '"') {
+			if ((e = _new_entry(json, _str_start(json))) == NULL)
+				goto _bad;
+			json->s = JSON_NAME_IN_STR;
+		} else if (c == '}' && json->entry[json->cur].size == 0) {
+			if (_close(json))
+				goto _good;
 		} else {
 			goto _bad;
 		}
-	} else if (c == '}') {
-		if (json->recur > 0) {
-			json->recur--;
-			goto _space;
-		} else {
-			if (json->s == JSON_VALUE_IN_VAL) {
-				json->buf[json->buf_pos++] = json->sep;
-				goto _good;
-			} else if (json->s == JSON_VALUE_END) {
+		break;
+
+	case JSON_NAME_END:
+		if (c != ':')
+			goto _bad;
+		json->s = JSON_VALUE;
+		break;
+
+	case JSON_VALUE:
+		if (c == ']' && container == JSON_TYPE_ARRAY &&
+		    json->entry[json->cur].size == 0) {
+			if (_close(json))
 				goto _good;
-			} else {
+			break;
+		}
+
+		if (container == JSON_TYPE_ARRAY) {
+			if ((e = _new_entry(json, -1)) == NULL)
 				goto _bad;
-			}
+		} else {
+			e = &json->entry[json->entry_pos - 1];
 		}
-	} else if (c == ':') {
-		if (json->s == JSON_NAME_END)
-			json->s = JSON_VALUE;
-		else
-			goto _bad;
-	} else if (c == ',') {
-		if (json->s == JSON_VALUE_IN_VAL) {
-			json->buf[json->buf_pos++] = json->sep;
-			json->s = JSON_NAME;
-		} else if (json->s == JSON_VALUE_END) {
-			json->s = JSON_NAME;
+
+		if (c == '"') {
+			e->type = JSON_TYPE_STRING;
+			e->val = _str_start(json);
+			json->s = JSON_VALUE_IN_STR;
+		} else if (c == '{' || c == '[') {
+			_open(json, e, c);
+		} else if (_is_primitive_char(c)) {
+			e->val = json->buf_pos;
+			if (!_put(json, c))
+				goto _bad;
+			json->s = JSON_VALUE_IN_VAL;
 		} else {
 			goto _bad;
 		}
-	} else if (c == '"') {
-		if (json->s == JSON_NAME || json->s == JSON_VALUE) {
-			json->entry[json->entry_pos++] = json->buf_pos;
-			json->s++;
-		} else
+		break;
+
+	case JSON_VALUE_END:
+		if (c == ',') {
+			json->s = (container == JSON_TYPE_OBJECT) ? JSON_NAME : JSON_VALUE;
+		} else if ((c == '}' && container == JSON_TYPE_OBJECT) ||
+			   (c == ']' && container == JSON_TYPE_ARRAY)) {
+			if (_close(json))
+				goto _good;
+		} else {
 			goto _bad;
-	} else {
-		if (json->s == JSON_VALUE_IN_VAL) {
-			json->buf[json->buf_pos++] = c;
-		} else if (json->s == JSON_VALUE) {
-			json->entry[json->entry_pos++] = json->buf_pos;
-			json->buf[json->buf_pos++] = c;
-			json->s = JSON_VALUE_IN_VAL;
 		}
-	}
+		break;
 
-_check_length:
-	if (json->buf_pos < (int)json->buf_max && json->entry_pos <= (int)json->entry_max)
-		return false;
+	default:
+		goto _bad;
+	}
+	return false;
 
 _bad:
 	json->s = JSON_BAD;
 	return true;
 
 _good:
-	json->buf[json->buf_pos - 1] = '\0';
+	if (!json->inplace && json->buf_pos > 0 && json->buf[json->buf_pos - 1] == json->sep)
+		json->buf[json->buf_pos - 1] = '\0';
 	json->s = JSON_GOOD;
 	return true;
 }
 
+bool a_json_append(a_json_t *json, char c)
+{
+	bool r;
+
+	/* in-place mode buf_pos follows the input, never past its end */
+	if (json->inplace && (uint32_t)json->buf_pos >= json->buf_max) {
+		json->s = JSON_BAD;
+		return true;
+	}
+	r = _append(json, c);
+	if (json->inplace)
+		json->buf_pos++;
+	return r;
+}
+
 bool a_json_append_str(a_json_t *json, char *str)
 {
-	while (*str != '\0') {
-		if (a_json_append(json, *str++) == true)
-			return true;
+	return a_json_append_str_sized(json, str, strlen(str));
+}
+
+/* word-at-a-time (SWAR) test for a byte in a machine word */
+#define SWAR_ONES		((uintptr_t)-1 / 0xff)
+#define SWAR_HAS_ZERO(v)	(((v) - SWAR_ONES) & ~(v) & (SWAR_ONES * 0x80))
+#define SWAR_HAS_BYTE(v, b)	SWAR_HAS_ZERO((v) ^ (SWAR_ONES * (uint8_t)(b)))
+
+/* copy the run without '"' or '\\', returns copied length.
+ * dst never passes src, so buf may be the input itself.
+ * dst is NULL in in-place mode */
+static size_t _copy_str(char *dst, size_t room, const char *src, size_t len)
+{
+	size_t i = 0;
+	uintptr_t v;
+
+	if (len > room)
+		len = room;
+	while (i + sizeof(v) <= len) {
+		memcpy(&v, src + i, sizeof(v));
+		if (SWAR_HAS_BYTE(v, '"') || SWAR_HAS_BYTE(v, '\\'))
+			break;
+		if (dst)
+			memcpy(dst + i, &v, sizeof(v));
+		i += sizeof(v);
 	}
-	return false;
+	while (i < len && src[i] != '"' && src[i] != '\\') {
+		if (dst)
+			dst[i] = src[i];
+		i++;
+	}
+	return i;
 }
 
-bool a_json_append_str_sized(a_json_t *json, char *str, size_t len)
+static size_t _copy_primitive(char *dst, size_t room, const char *src, size_t len)
 {
 	size_t i;
-	for (i = 0; i < len; i++) {
+
+	if (len > room)
+		len = room;
+	for (i = 0; i < len && _is_primitive_char(src[i]); i++) {
+		if (dst)
+			dst[i] = src[i];
+	}
+	return i;
+}
+
+/* same result as feeding a_json_append() byte by byte, but copies
+ * plain string/primitive runs at once and skips blanks in bulk */
+bool a_json_append_str_sized(a_json_t *json, char *str, size_t len)
+{
+	size_t n;
+	char *dst;
+
+	while (len > 0) {
+		n = 0;
+		dst = json->inplace ? NULL : json->buf + json->buf_pos;
+		switch (json->s) {
+		case JSON_NAME_IN_STR:
+		case JSON_VALUE_IN_STR:
+			if (json->escaped || json->hex_pos || json->surrogate)
+				break;
+			n = _copy_str(dst, json->buf_max - (uint32_t)json->buf_pos, str, len);
+			json->buf_pos += (int)n;
+			break;
+		case JSON_VALUE_IN_VAL:
+			n = _copy_primitive(dst, json->buf_max - (uint32_t)json->buf_pos, str, len);
+			json->buf_pos += (int)n;
+			break;
+		case JSON_BAD:
+		case JSON_GOOD:
+			return true;
+		default:
+			while (n < len && isspace((unsigned char)str[n]))
+				n++;
+			if (json->inplace)
+				json->buf_pos += (int)n;
+			break;
+		}
+
+		if (n > 0) {
+			str += n;
+			len -= n;
+			continue;
+		}
+
+		/* structural char, escape or buffer full */
 		if (a_json_append(json, *str++) == true)
 			return true;
+		len--;
 	}
 	return false;
 }
 
-static char * _get_prop(char *buf, int *entry, int max, const char *prop)
+bool a_json_parse_inplace(a_json_t *json, const char *src, size_t len,
+			  a_json_entry_t *entry, size_t entry_len)
+{
+	/* src is never written in in-place mode */
+	if (a_json_init(json, (char*)src, len, entry, entry_len, '\0') < 0)
+		return false;
+	json->inplace = true;
+	a_json_append_str_sized(json, json->buf, len);
+	return a_json_is_good(json);
+}
+
+static bool _key_equal(a_json_t *json, int index, int parent, const char *name, size_t len)
+{
+	a_json_entry_t *e = &json->entry[index];
+	if (e->parent != parent)
+		return false;
+	if (!(e->flags & JSON_FLAG_KEY_ESCAPED))
+		return e->key_len == len && memcmp(json->buf + e->key, name, len) == 0;
+	return _raw_cmp(json->buf + e->key, e->key_len, true, name, len) == 0;
+}
+
+static int _find_key(a_json_t *json, int parent, const char *name, size_t len)
+{
+	int i, n;
+	uint32_t h = _hash_update(_hash_init(parent), name, len);
+
+	for (n = 0; n < A_JSON_HASH_SIZE; n++, h++) {
+		i = json->hash[h & (A_JSON_HASH_SIZE - 1)];
+		if (i < 0)
+			break;
+		if (_key_equal(json, i, parent, name, len))
+			return i;
+	}
+	if (!json->hash_overflow)
+		return -1;
+
+	/* descendants of parent are contiguous */
+	for (i = parent + 1; i < json->entry_pos; i++) {
+		if (json->entry[i].parent < parent)
+			break;
+		if (_key_equal(json, i, parent, name, len))
+			return i;
+	}
+	return -1;
+}
+
+static int _find_index(a_json_t *json, int parent, int index)
 {
 	int i;
-	const char *p;
-	for (i = 0; i < max || entry[i * 2] < 0; i++) {
-		p = buf + entry[i * 2];
-		if (strcmp(p, prop) == 0)
-			return buf + entry[i * 2 + 1];
+	a_json_entry_t *e;
+
+	if (index >= json->entry[parent].size)
+		return -1;
+
+	for (i = parent + 1; i < json->entry_pos; i++) {
+		e = &json->entry[i];
+		if (e->parent < parent)
+			break;
+		if (e->parent == parent && index-- == 0)
+			return i;
+	}
+	return -1;
+}
+
+int a_json_find(a_json_t *json, int from, const char *path)
+{
+	int i = from;
+	int index;
+	size_t len;
+
+	if (from < 0 || from >= json->entry_pos)
+		return -1;
+
+	while (*path != '\0') {
+		if (*path == '[') {
+			path++;
+			if (!isdigit((unsigned char)*path))
+				return -1;
+			for (index = 0; isdigit((unsigned char)*path); path++) {
+				index = index * 10 + (*path - '0');
+				if (index >= json->entry_pos)
+					return -1;
+			}
+			if (*path++ != ']' || json->entry[i].type != JSON_TYPE_ARRAY)
+				return -1;
+			i = _find_index(json, i, index);
+		} else {
+			if (*path == '.')
+				path++;
+			for (len = 0; path[len] != '\0' && path[len] != '.' && path[len] != '['; len++)
+				;
+			if (len == 0 || json->entry[i].type != JSON_TYPE_OBJECT)
+				return -1;
+			i = _find_key(json, i, path, len);
+			path += len;
+		}
+		if (i < 0)
+			return -1;
 	}
-	return NULL;
+	return i;
+}
+
+static const char * _value(a_json_t *json, int i, size_t *len, bool *escaped)
+{
+	a_json_entry_t *e;
+	if (i < 0 || json->entry[i].val < 0)
+		return NULL;
+	e = &json->entry[i];
+	*len = (size_t)e->val_len;
+	*escaped = (e->flags & JSON_FLAG_VAL_ESCAPED) ? true : false;
+	return json->buf + e->val;
 }
 
 const char * a_json_get_prop(a_json_t *json, const char *prop)
 {
-	return _get_prop(json->buf, json->entry, json->entry_max/2, prop);
+	int i;
+
+	/* source text is not terminated */
+	if (json->inplace)
+		return NULL;
+
+	i = a_json_find(json, 0, prop);
+	if (i < 0 || json->entry[i].val < 0)
+		return NULL;
+	return json->buf + json->entry[i].val;
 }
 
 const char * a_json_get_prop_safe(a_json_t *json, const char *prop, const char* def)
@@ -182,23 +830,175 @@ const char * a_json_get_prop_safe(a_json_t *json, const char *prop, const char*
 	return r ? r : def;
 }
 
+int a_json_get_prop_str(a_json_t *json, const char *prop, char *out, size_t size)
+{
+	const char *v, *end;
+	size_t len, n = 0;
+	bool escaped;
+	char c[4];
+	int i;
+
+	v = _value(json, a_json_find(json, 0, prop), &len, &escaped);
+	if (!v || size == 0)
+		return -1;
+
+	if (!escaped) {
+		if (len >= size)
+			return -1;
+		memcpy(out, v, len);
+		out[len] = '\0';
+		return (int)len;
+	}
+
+	for (end = v + len; v < end; n += (size_t)i) {
+		if ((i = _decode(&v, end, c)) < 0 || n + (size_t)i >= size)
+			return -1;
+		memcpy(out + n, c, (size_t)i);
+	}
+	out[n] = '\0';
+	return (int)n;
+}
+
 int a_json_comp_prop_val(a_json_t *json, const char * prop, const char *value)
 {
-	const char *v = a_json_get_prop(json, prop);
+	const char *v;
+	size_t len;
+	bool escaped;
+
+	v = _value(json, a_json_find(json, 0, prop), &len, &escaped);
 	if (!v)
 		return -1;
-	return strcmp(value, v);
+	return -_raw_cmp(v, len, escaped, value, strlen(value));
+}
+
+static a_json_err_t _entry(a_json_t *json, const char *prop, uint8_t type, a_json_entry_t **e)
+{
+	int i = a_json_find(json, 0, prop);
+	if (i < 0)
+		return JSON_ERR_NOT_FOUND;
+	*e = &json->entry[i];
+	return ((*e)->type == type) ? JSON_OK : JSON_ERR_TYPE;
+}
+
+/* m * 10^exp to int64 */
+static a_json_err_t _scale(int64_t m, int exp, int64_t *v)
+{
+	for (; exp < 0; exp++) {
+		if (m % 10)
+			return JSON_ERR_TYPE;
+		m /= 10;
+	}
+	for (; exp > 0 && m != 0; exp--) {
+		if (m > INT64_MAX / 10 || m < INT64_MIN / 10)
+			return JSON_ERR_RANGE;
+		m *= 10;
+	}
+	*v = m;
+	return JSON_OK;
 }
 
+a_json_err_t a_json_get_prop_int64(a_json_t *json, const char *prop, int64_t *v)
+{
+	a_json_entry_t *e;
+	a_json_err_t r = _entry(json, prop, JSON_TYPE_NUMBER, &e);
+	if (r != JSON_OK)
+		return r;
+	return _scale(e->num, e->exp, v);
+}
+
+a_json_err_t a_json_get_prop_fixed(a_json_t *json, const char *prop, int frac_digits, int32_t *v)
+{
+	a_json_entry_t *e;
+	int64_t m;
+	uint64_t mag, half;
+	int exp;
+	a_json_err_t r = _entry(json, prop, JSON_TYPE_NUMBER, &e);
+	if (r != JSON_OK)
+		return r;
+
+	m = e->num;
+	exp = e->exp + frac_digits;
+	if (exp < 0) {
+		/* round half away from zero, on the magnitude as INT64_MIN
+		 * has no positive counterpart */
+		if (exp < -19) {
+			m = 0;
+		} else {
+			mag = (m < 0) ? 0 - (uint64_t)m : (uint64_t)m;
+			for (half = 1; exp < -1; exp++)
+				half *= 10;
+			mag = (mag / half + 5) / 10;
+			m = (m < 0) ? -(int64_t)mag : (int64_t)mag;
+		}
+		exp = 0;
+	}
+	if (_scale(m, exp, &m) != JSON_OK || m > INT32_MAX || m < INT32_MIN)
+		return JSON_ERR_RANGE;
+	*v = (int32_t)m;
+	return JSON_OK;
+}
+
+a_json_err_t a_json_get_prop_double(a_json_t *json, const char *prop, double *v)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	a_json_entry_t *e;
+	double d;
+	int exp, n;
+	a_json_err_t r = _entry(json, prop, JSON_TYPE_NUMBER, &e);
+	if (r != JSON_OK)
+		return r;
+
+	d = (double)e->num;
+	for (exp = e->exp; exp != 0 && d != 0; exp -= (exp > 0) ? n : -n) {
+		n = (exp > 0) ? exp : -exp;
+		if (n > 22)
+			n = 22;
+		if (exp > 0)
+			d *= pow10[n];
+		else
+			d /= pow10[n];
+	}
+	*v = d;
+	return JSON_OK;
+}
+
+a_json_err_t a_json_get_prop_bool(a_json_t *json, const char *prop, bool *v)
+{
+	a_json_entry_t *e;
+	a_json_err_t r = _entry(json, prop, JSON_TYPE_BOOL, &e);
+	if (r != JSON_OK)
+		return r;
+	*v = e->num ? true : false;
+	return JSON_OK;
+}
+
+bool a_json_prop_is_null(a_json_t *json, const char *prop)
+{
+	a_json_entry_t *e;
+	return _entry(json, prop, JSON_TYPE_NULL, &e) == JSON_OK;
+}
+
+/* number, bool or numeric string clamped to [min, max], min if missing */
 int a_json_get_prop_int(a_json_t *json, const char *prop, int min, int max)
 {
-	int i;
-	const char *val = a_json_get_prop(json, prop);
-	if (!val)
+	int64_t v;
+	bool b;
+	char val[16];
+
+	if (a_json_get_prop_int64(json, prop, &v) == JSON_OK) {
+		/* done */
+	} else if (a_json_get_prop_bool(json, prop, &b) == JSON_OK) {
+		v = b ? 1 : 0;
+	} else if (a_json_get_prop_str(json, prop, val, sizeof(val)) >= 0) {
+		v = atoi(val);
+	} else {
 		return min;
+	}
 
-	i = atoi(val);
-	if (i <= min) return min;
-	if (i >= max) return max;
-	return i;
+	if (v <= min) return min;
+	if (v >= max) return max;
+	return (int)v;
 }
@@ -13,7 +13,15 @@
 
 #define N_ELEMENT(tbl)	(sizeof(tbl)/sizeof((tbl)[0]))
 #define EXT_PARM		4
-#define NJSON(n)		(((n)+EXT_PARM)*2)
+/* entries for an object of n members, one per value plus the object.
+ * Nested objects and arrays take one more each. An entry is 32 bytes,
+ * 4 times the int pair of the flat parser it replaced */
+#define NJSON(n)		((n)+1+EXT_PARM)
+
+/* open addressed member index, power of 2 */
+#ifndef A_JSON_HASH_SIZE
+#define A_JSON_HASH_SIZE	32
+#endif
 
 enum a_json_state {
 	JSON_INIT,
@@ -28,28 +36,77 @@ enum a_json_state {
 	JSON_GOOD,
 };
 
+typedef enum {
+	JSON_TYPE_OBJECT,
+	JSON_TYPE_ARRAY,
+	JSON_TYPE_STRING,
+	JSON_TYPE_NUMBER,
+	JSON_TYPE_BOOL,
+	JSON_TYPE_NULL,
+} a_json_type_t;
+
+typedef enum {
+	JSON_OK = 0,
+	JSON_ERR_NOT_FOUND = -1,
+	JSON_ERR_TYPE = -2,	/* other type, or not an integer */
+	JSON_ERR_RANGE = -3,
+} a_json_err_t;
+
+#define JSON_FLAG_KEY_ESCAPED	(1 << 0)	/* in-place key has escapes */
+#define JSON_FLAG_VAL_ESCAPED	(1 << 1)	/* in-place value has escapes */
+
+/* one entry per value in document order, children follow their parent */
+typedef struct {
+	uint8_t type;		/* a_json_type_t */
+	uint8_t flags;
+	int16_t parent;		/* index of enclosing object/array, -1 for root */
+	uint16_t size;		/* number of children of object/array */
+	uint16_t key_len;
+	int key;		/* offset of member name in buf, -1 if none */
+	int val;		/* offset of string/primitive in buf, -1 if none */
+	int val_len;
+	int16_t exp;		/* number is num * 10^exp */
+	int64_t num;		/* converted number or bool */
+} a_json_entry_t;
+
 typedef struct {
 	char *buf;
 	uint32_t buf_max;
-	int *entry;
+	a_json_entry_t *entry;
 	uint32_t entry_max;
 	char sep;
-	int recur;
+	bool inplace;		/* buf is the source text, never written */
+	int cur;		/* innermost open object/array */
 
 	int buf_pos;
 	int entry_pos;
 
 	enum a_json_state s;
 	bool escaped;
+	uint8_t hex_pos;	/* 1 + digits of \uXXXX consumed, 0 if none */
+	uint16_t hex;		/* \uXXXX being decoded */
+	uint16_t surrogate;	/* pending high surrogate */
+
+	bool full;		/* ran out of entries */
+
+	int16_t hash[A_JSON_HASH_SIZE];	/* (parent, name) -> entry, -1 if empty */
+	int hash_cnt;
+	bool hash_overflow;	/* some names are not indexed */
 } a_json_t;
 
-/* simple JSON parser only support 1-depth object structure */
+/* streaming JSON parser with nested object/array support
+ * without memory allocation */
 
-int32_t a_json_init(a_json_t *json, char *buf, size_t buf_len, int *entry, size_t entry_len, char sep);
+int32_t a_json_init(a_json_t *json, char *buf, size_t buf_len, a_json_entry_t *entry, size_t entry_len, char sep);
 bool a_json_append(a_json_t *json, char c);
 bool a_json_append_str(a_json_t *json, char *str);
 bool a_json_append_str_sized(a_json_t *json, char *str, size_t len);
 
+/* tokenize src where it lies, returns true if good.
+ * a_json_get_prop() is not available, use a_json_get_prop_str() */
+bool a_json_parse_inplace(a_json_t *json, const char *src, size_t len,
+			  a_json_entry_t *entry, size_t entry_len);
+
 static inline bool a_json_is_finished(a_json_t *json) {
 	return (json->s >= JSON_BAD) ? true : false;
 }
@@ -58,7 +115,20 @@ static inline bool a_json_is_good(a_json_t *json) {
 	return (json->s == JSON_GOOD) ? true : false;
 }
 
+/* path is relative to entry 'from' (0 is root), ex) "params.levels[2]" */
+int a_json_find(a_json_t *json, int from, const char *path);
+
 const char * a_json_get_prop(a_json_t *json, const char *prop);
 const char * a_json_get_prop_safe(a_json_t *json, const char *prop, const char* def);
+/* copy unescaped value with '\0', returns length or -1 */
+int a_json_get_prop_str(a_json_t *json, const char *prop, char *out, size_t size);
 int a_json_comp_prop_val(a_json_t *json, const char * prop, const char *value);
 int a_json_get_prop_int(a_json_t *json, const char *prop, int min, int max);
+
+/* typed accessors use the value converted while parsing */
+a_json_err_t a_json_get_prop_int64(a_json_t *json, const char *prop, int64_t *v);
+/* value * 10^frac_digits, rounded */
+a_json_err_t a_json_get_prop_fixed(a_json_t *json, const char *prop, int frac_digits, int32_t *v);
+a_json_err_t a_json_get_prop_double(a_json_t *json, const char *prop, double *v);
+a_json_err_t a_json_get_prop_bool(a_json_t *json, const char *prop, bool *v);
+bool a_json_prop_is_null(a_json_t *json, const char *prop);
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "json_rpc.h"
+#include <stdio.h>
+#include <string.h>
+
+/* table driven JSON RPC dispatcher.
+ *
+ * Method table is declared const by the application. Init searches a
+ * seed which maps every method name to its own slot, so dispatch needs
+ * one hash and one compare to find the method.
+ */
+
+#define MAX_SEED	1024
+
+static uint32_t _hash(uint32_t seed, const char *name, size_t len)
+{
+	uint32_t h = 2166136261U ^ seed;
+	while (len--) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+int32_t a_json_rpc_init(a_json_rpc_t *rpc, const a_json_rpc_method_t *methods, int n_methods)
+{
+	uint32_t seed;
+	uint32_t h;
+	int i;
+
+	if (n_methods > JSON_RPC_SLOTS)
+		return -1;
+
+	memset(rpc, 0, sizeof(*rpc));
+	rpc->methods = methods;
+	rpc->n_methods = n_methods;
+
+	for (seed = 0; seed < MAX_SEED; seed++) {
+		memset(rpc->slot, -1, sizeof(rpc->slot));
+		for (i = 0; i < n_methods; i++) {
+			h = _hash(seed, methods[i].name, strlen(methods[i].name)) & (JSON_RPC_SLOTS - 1);
+			if (rpc->slot[h] >= 0)
+				break;
+			rpc->slot[h] = (int8_t)i;
+		}
+		if (i == n_methods) {
+			rpc->seed = seed;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static bool _get_param(a_json_t *json, const a_json_rpc_param_t *p, int32_t *v)
+{
+	int64_t i;
+	bool b;
+
+	switch (p->type) {
+	case JSON_RPC_INT:
+		if (a_json_get_prop_int64(json, p->path, &i) != JSON_OK || i < p->min || i > p->max)
+			return false;
+		*v = (int32_t)i;
+		return true;
+	case JSON_RPC_BOOL:
+		if (a_json_get_prop_bool(json, p->path, &b) == JSON_OK) {
+			*v = b ? 1 : 0;
+			return true;
+		}
+		if (a_json_get_prop_int64(json, p->path, &i) != JSON_OK || (i != 0 && i != 1))
+			return false;
+		*v = (int32_t)i;
+		return true;
+	case JSON_RPC_FIXED:
+		return a_json_get_prop_fixed(json, p->path, p->frac, v) == JSON_OK &&
+			*v >= p->min && *v <= p->max;
+	default:
+		return false;
+	}
+}
+
+a_json_rpc_err_t a_json_rpc_dispatch(a_json_rpc_t *rpc, const char *msg, size_t len, void *arg)
+{
+	a_json_t json;
+	a_json_entry_t entry[JSON_RPC_MAX_ENTRY];
+	char name[JSON_RPC_MAX_NAME];
+	int32_t v[JSON_RPC_MAX_PARAMS];
+	const a_json_rpc_method_t *m;
+	int i, n;
+
+	if (!a_json_parse_inplace(&json, msg, len, entry, N_ELEMENT(entry)))
+		return json.full ? JSON_RPC_TOO_LARGE : JSON_RPC_PARSE_ERROR;
+
+	n = a_json_get_prop_str(&json, "method", name, sizeof(name));
+	if (n <= 0)
+		return JSON_RPC_INVALID_REQUEST;
+
+	i = rpc->slot[_hash(rpc->seed, name, (size_t)n) & (JSON_RPC_SLOTS - 1)];
+	if (i < 0 || strcmp(rpc->methods[i].name, name) != 0)
+		return JSON_RPC_METHOD_NOT_FOUND;
+
+	m = &rpc->methods[i];
+	if (m->n_params > JSON_RPC_MAX_PARAMS)
+		return JSON_RPC_INVALID_PARAMS;
+	for (i = 0; i < m->n_params; i++) {
+		if (!_get_param(&json, &m->params[i], &v[i]))
+			return JSON_RPC_INVALID_PARAMS;
+	}
+
+	(*m->fn)(arg, &json, v);
+	return JSON_RPC_OK;
+}
+
+const char * a_json_rpc_strerror(a_json_rpc_err_t err)
+{
+	const char *s;
+	switch (err) {
+	case JSON_RPC_OK:		s = "OK"; break;
+	case JSON_RPC_PARSE_ERROR:	s = "Parse error"; break;
+	case JSON_RPC_INVALID_REQUEST:	s = "Invalid Request"; break;
+	case JSON_RPC_METHOD_NOT_FOUND:	s = "Method not found"; break;
+	case JSON_RPC_INVALID_PARAMS:	s = "Invalid params"; break;
+	case JSON_RPC_TOO_LARGE:	s = "Request too large"; break;
+	default:			s = "Unknown"; break;
+	}
+	return s;
+}
+
+/* JSON-RPC 2.0 style error object */
+int a_json_rpc_format_error(char *buf, size_t size, a_json_rpc_err_t err)
+{
+	return snprintf(buf, size, "{\"error\":{\"code\":%d,\"message\":\"%s\"}}",
+			(int)err, a_json_rpc_strerror(err));
+}
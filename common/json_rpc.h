@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include "json_parser.h"
+
+#define JSON_RPC_SLOTS		16	/* perfect hash slots, power of 2 */
+#define JSON_RPC_MAX_PARAMS	4
+#ifndef JSON_RPC_MAX_ENTRY
+#define JSON_RPC_MAX_ENTRY	24	/* 32 bytes each, on the caller stack */
+#endif
+#define JSON_RPC_MAX_NAME	32
+
+typedef enum {
+	JSON_RPC_OK = 0,
+	JSON_RPC_PARSE_ERROR = -32700,
+	JSON_RPC_INVALID_REQUEST = -32600,
+	JSON_RPC_METHOD_NOT_FOUND = -32601,
+	JSON_RPC_INVALID_PARAMS = -32602,
+	JSON_RPC_TOO_LARGE = -32000,	/* more values than JSON_RPC_MAX_ENTRY */
+} a_json_rpc_err_t;
+
+typedef enum {
+	JSON_RPC_INT,		/* min <= v <= max */
+	JSON_RPC_BOOL,		/* true/false or 0/1 */
+	JSON_RPC_FIXED,		/* v * 10^frac, min <= v <= max */
+} a_json_rpc_type_t;
+
+typedef struct {
+	const char *path;	/* from message root, ex) "params.level" */
+	a_json_rpc_type_t type;
+	int32_t min;
+	int32_t max;
+	int frac;
+} a_json_rpc_param_t;
+
+/* v[] holds validated params in table order */
+typedef void (*a_json_rpc_fn)(void *arg, a_json_t *json, const int32_t *v);
+
+typedef struct {
+	const char *name;
+	a_json_rpc_fn fn;
+	const a_json_rpc_param_t *params;
+	int n_params;
+} a_json_rpc_method_t;
+
+typedef struct {
+	const a_json_rpc_method_t *methods;
+	int n_methods;
+	uint32_t seed;
+	int8_t slot[JSON_RPC_SLOTS];	/* method index, -1 if empty */
+} a_json_rpc_t;
+
+int32_t a_json_rpc_init(a_json_rpc_t *rpc, const a_json_rpc_method_t *methods, int n_methods);
+a_json_rpc_err_t a_json_rpc_dispatch(a_json_rpc_t *rpc, const char *msg, size_t len, void *arg);
+const char * a_json_rpc_strerror(a_json_rpc_err_t err);
+int a_json_rpc_format_error(char *buf, size_t size, a_json_rpc_err_t err);
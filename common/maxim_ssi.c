@@ -162,41 +162,158 @@ int ssi_clear_adrs(void)
  **********************************************************************/
 unsigned char * ssi_read_3bytes(int local_adrs)
 {
-	static unsigned char emd_response[6];
+	static unsigned char emd_response[3];
+
+	if(ssi_read_block(local_adrs, 1, emd_response) == 0)
+	{
+		return emd_response;
+	}
+
+	return NULL;
+}
+
+
+/**********************************************************************
+ * Function: ssi_read_block()
+ * Parameters: adrs - Word address of first register
+ *             cnt - number of registers, 1 to MAX_READ_REGS
+ *             data - buffer for cnt * 3 bytes
+ * Returns: 0 - success
+ *          -1 - failure, no reply, error reply or bad checksum
+ *
+ * Description: Reads cnt registers from adrs up in one request and one
+ *              reply packet.
+ **********************************************************************/
+int ssi_read_block(int local_adrs, int cnt, unsigned char *data)
+{
 	unsigned char byte_cnt = 0;
-	unsigned char payload[4];
+	unsigned char payload[5];
+	unsigned char reply[MAX_PACKET_LEN];
+	unsigned char sum;
+	int nbytes = cnt * 3;
+	int idx;
 	wiced_result_t r;
 	uint32_t size;
-  
-	//flush response buffer from last time
-	for(byte_cnt = 0; byte_cnt < 6; byte_cnt++)
+
+	if(cnt < 1 || cnt > MAX_READ_REGS)
 	{
-		emd_response[byte_cnt] = 0;
+		return(-1);
 	}
-  
-	//reset byte_cnt
-	byte_cnt = 0;
+
 	local_adrs *= 3;
-  
+
 	payload[byte_cnt++] = RW_ADRS;
 	//LSB of address
-	payload[byte_cnt++] = ((unsigned char) (0x00ff&local_adrs)); 
+	payload[byte_cnt++] = ((unsigned char) (0x00ff&local_adrs));
 	//MSB of address
 	payload[byte_cnt++] = ((unsigned char) (0x00ff&(local_adrs >> 8)));
-  
-	payload[byte_cnt++] = (READ_BYTES | 0x03);
-  
+
+	//short form carries the count for up to 15 bytes
+	if(nbytes < 0x10)
+	{
+		payload[byte_cnt++] = (READ_BYTES | nbytes);
+	}
+	else
+	{
+		payload[byte_cnt++] = READ_BYTES;
+		payload[byte_cnt++] = (unsigned char) nbytes;
+	}
+
 	ssi_send_packet(byte_cnt, payload);
- 
-	size = 6;
-	r = wiced_uart_receive_bytes(SENSOR_UART, emd_response, &size, 3000);
-	if (r == WICED_SUCCESS
-	    && emd_response[0] == ACK_DATA)
+
+	//single byte error replies have no byte count
+	size = 1;
+	r = wiced_uart_receive_bytes(SENSOR_UART, reply, &size, 3000);
+	if(r != WICED_SUCCESS || reply[0] != ACK_DATA)
+	{
+		return(-1);
+	}
+
+	size = nbytes + 2;
+	r = wiced_uart_receive_bytes(SENSOR_UART, &reply[1], &size, 3000);
+	if(r != WICED_SUCCESS || reply[1] != nbytes + 3)
 	{
-		return &emd_response[2];
+		return(-1);
 	}
 
-	return NULL;
+	sum = 0;
+	for(idx = 0; idx < nbytes + 3; idx++)
+	{
+		sum += reply[idx];
+	}
+	if(sum != 0)
+	{
+		return(-1);
+	}
+
+	memcpy(data, &reply[2], nbytes);
+	return 0;
+}
+
+
+/**********************************************************************
+ * Function: ssi_read_scatter()
+ * Parameters: adrs - Word addresses of registers, any order
+ *             cnt - number of registers, up to MAX_REG_ADRS + 1
+ *             data - buffer for cnt * 3 bytes, in the order of adrs
+ * Returns: 0 - success
+ *          -1 - failure
+ *
+ * Description: Sorts the addresses and reads them as runs of adjacent
+ *              registers, one ssi_read_block() per run.  Runs less
+ *              than SCATTER_GAP registers apart are read as one.
+ **********************************************************************/
+int ssi_read_scatter(const int *adrs, int cnt, unsigned char *data)
+{
+	unsigned char order[MAX_REG_ADRS + 1];
+	unsigned char block[MAX_READ_REGS * 3];
+	unsigned char tmp;
+	int first, last, start, end;
+	int i, j;
+
+	if(cnt < 1 || cnt > MAX_REG_ADRS + 1)
+	{
+		return(-1);
+	}
+
+	//insertion sort of indexes by address, cnt is small
+	for(i = 0; i < cnt; i++)
+	{
+		order[i] = (unsigned char) i;
+		for(j = i; j > 0 && adrs[order[j - 1]] > adrs[order[j]]; j--)
+		{
+			tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+	}
+
+	for(first = 0; first < cnt; first = last + 1)
+	{
+		//grow the run while it fits a packet and gaps stay small
+		start = adrs[order[first]];
+		for(last = first; last + 1 < cnt; last++)
+		{
+			end = adrs[order[last + 1]];
+			if(end - adrs[order[last]] > SCATTER_GAP || end - start >= MAX_READ_REGS)
+			{
+				break;
+			}
+		}
+		end = adrs[order[last]];
+
+		if(ssi_read_block(start, end - start + 1, block) != 0)
+		{
+			return(-1);
+		}
+
+		for(i = first; i <= last; i++)
+		{
+			memcpy(&data[order[i] * 3], &block[(adrs[order[i]] - start) * 3], 3);
+		}
+	}
+
+	return 0;
 }
 
 
@@ -22,6 +22,10 @@
 /******************** 78M6610_PSU ************************************/
 #define MAX_PACKET_LEN 255 
 #define MAX_REG_ADRS 0x7F  //max word address
+//registers in one reply packet, less header, byte count and checksum
+#define MAX_READ_REGS ((MAX_PACKET_LEN - 3) / 3)
+//unwanted registers read to join two runs rather than start a new packet
+#define SCATTER_GAP 4
 
 /******************** Master SSI commands ****************************/
 #define HEADER          0xAA
@@ -106,6 +110,37 @@ int ssi_clear_adrs(void);
 unsigned char * ssi_read_3bytes(int adrs);
 
 
+/**********************************************************************
+ * Function: ssi_read_block()
+ * Parameters: adrs - Word address of first register
+ *             cnt - number of registers, 1 to MAX_READ_REGS
+ *             data - buffer for cnt * 3 bytes, 3 bytes per register
+ *                    in the order of ssi_write_3bytes()
+ * Returns: 0 - success
+ *          -1 - failure, no reply, error reply or bad checksum
+ *
+ * Description: Reads cnt registers from adrs up in one request and one
+ *              reply packet.
+ **********************************************************************/
+int ssi_read_block(int adrs, int cnt, unsigned char *data);
+
+
+/**********************************************************************
+ * Function: ssi_read_scatter()
+ * Parameters: adrs - Word addresses of registers, any order
+ *             cnt - number of registers, up to MAX_REG_ADRS + 1
+ *             data - buffer for cnt * 3 bytes, filled in the order
+ *                    of adrs
+ * Returns: 0 - success
+ *          -1 - failure
+ *
+ * Description: Sorts the addresses and reads them as runs of adjacent
+ *              registers, one ssi_read_block() per run.  Runs less
+ *              than SCATTER_GAP registers apart are read as one.
+ **********************************************************************/
+int ssi_read_scatter(const int *adrs, int cnt, unsigned char *data);
+
+
 /**********************************************************************
  * Function: ssi_write_3bytes
  * Parameters: adrs - Word address of register, use defined register 
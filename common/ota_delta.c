@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "ota_delta.h"
+#include <string.h>
+
+/* patch is consumed as it arrives, RAM is bounded by a_delta_t.
+ * Output is written in target order, so it can go to flash directly. */
+
+static uint32_t _u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool a_delta_detect(const uint8_t *data, size_t len)
+{
+	return (len >= 4 && memcmp(data, A_DELTA_MAGIC, 4) == 0) ? true : false;
+}
+
+void a_delta_init(a_delta_t *d, a_delta_read_fn read, a_delta_write_fn write, void *arg)
+{
+	memset(d, 0, sizeof(*d));
+	d->read = read;
+	d->write = write;
+	d->arg = arg;
+	d->s = DELTA_HEADER;
+}
+
+static a_delta_err_t _header(a_delta_t *d)
+{
+	if (memcmp(d->hdr, A_DELTA_MAGIC, 4) != 0)
+		return DELTA_ERR_FORMAT;
+	d->source_len = _u32(d->hdr + 4);
+	d->target_len = _u32(d->hdr + 8);
+	memcpy(d->source_hash, d->hdr + 12, A_DELTA_HASH_SIZE);
+	d->s = d->target_len ? DELTA_CONTROL : DELTA_DONE;
+	return DELTA_OK;
+}
+
+static a_delta_err_t _control(a_delta_t *d)
+{
+	d->diff_left = _u32(d->hdr);
+	d->extra_left = _u32(d->hdr + 4);
+	d->seek = (int32_t)_u32(d->hdr + 8);
+
+	if (d->diff_left > d->target_len - d->out_pos ||
+	    d->extra_left > d->target_len - d->out_pos - d->diff_left)
+		return DELTA_ERR_FORMAT;
+	if (d->diff_left > d->source_len - d->src_pos)
+		return DELTA_ERR_SOURCE;
+	d->s = DELTA_DIFF;
+	return DELTA_OK;
+}
+
+/* move to next record after diff and extra bytes are done */
+static a_delta_err_t _next(a_delta_t *d)
+{
+	int64_t pos = (int64_t)d->src_pos + d->seek;
+
+	if (pos < 0 || pos > d->source_len)
+		return DELTA_ERR_SOURCE;
+	d->src_pos = (uint32_t)pos;
+	d->s = (d->out_pos == d->target_len) ? DELTA_DONE : DELTA_CONTROL;
+	return DELTA_OK;
+}
+
+/* decode diff bytes and add them to source, returns patch bytes used */
+static size_t _diff(a_delta_t *d, const uint8_t *patch, size_t len, a_delta_err_t *r)
+{
+	size_t used = 0;
+	uint32_t n = 0;
+	uint32_t max, i;
+	uint8_t c;
+
+	max = (d->diff_left < A_DELTA_BUF) ? d->diff_left : A_DELTA_BUF;
+	while (n < max) {
+		if (d->zeros) {
+			i = (d->zeros < max - n) ? d->zeros : max - n;
+			memset(d->buf + n, 0, i);
+			n += i;
+			d->zeros -= i;
+			continue;
+		}
+		if (used == len)
+			break;
+		c = patch[used++];
+		if (d->run) {
+			d->run = false;
+			d->zeros = (uint32_t)c + 1;
+		} else if (c == 0) {
+			d->run = true;
+		} else {
+			d->buf[n++] = c;
+		}
+	}
+	if (n == 0)
+		return used;
+
+	if ((*d->read)(d->arg, d->src_pos, d->src, n) != 0) {
+		*r = DELTA_ERR_SOURCE;
+		return used;
+	}
+	for (i = 0; i < n; i++)
+		d->src[i] = (uint8_t)(d->src[i] + d->buf[i]);
+	if ((*d->write)(d->arg, d->src, n) != 0) {
+		*r = DELTA_ERR_WRITE;
+		return used;
+	}
+	d->src_pos += n;
+	d->out_pos += n;
+	d->diff_left -= n;
+	return used;
+}
+
+a_delta_err_t a_delta_apply(a_delta_t *d, const uint8_t *patch, size_t len)
+{
+	a_delta_err_t r = DELTA_OK;
+	uint32_t n, size;
+
+	/* pending zeros are flushed without more input */
+	while ((len > 0 || (d->s == DELTA_DIFF && d->zeros)) && r == DELTA_OK) {
+		switch (d->s) {
+		case DELTA_HEADER:
+		case DELTA_CONTROL:
+			size = (d->s == DELTA_HEADER) ? A_DELTA_HEADER_SIZE : A_DELTA_CONTROL_SIZE;
+			n = size - d->hdr_pos;
+			if (n > len)
+				n = (uint32_t)len;
+			memcpy(d->hdr + d->hdr_pos, patch, n);
+			d->hdr_pos += n;
+			if (d->hdr_pos == size) {
+				d->hdr_pos = 0;
+				r = (d->s == DELTA_HEADER) ? _header(d) : _control(d);
+			}
+			break;
+		case DELTA_DIFF:
+			n = (uint32_t)_diff(d, patch, len, &r);
+			break;
+		case DELTA_EXTRA:
+			n = d->extra_left;
+			if (n > len)
+				n = (uint32_t)len;
+			if ((*d->write)(d->arg, patch, n) != 0) {
+				r = DELTA_ERR_WRITE;
+				break;
+			}
+			d->out_pos += n;
+			d->extra_left -= n;
+			break;
+		default:
+			/* trailing bytes or earlier error */
+			r = DELTA_ERR_FORMAT;
+			n = 0;
+			break;
+		}
+		patch += n;
+		len -= n;
+
+		if (r != DELTA_OK)
+			break;
+		/* records may have empty diff or extra part */
+		if (d->s == DELTA_DIFF && d->diff_left == 0) {
+			if (d->run || d->zeros) {
+				r = DELTA_ERR_FORMAT;
+				break;
+			}
+			d->s = DELTA_EXTRA;
+		}
+		if (d->s == DELTA_EXTRA && d->extra_left == 0)
+			r = _next(d);
+	}
+
+	if (r != DELTA_OK)
+		d->s = DELTA_BAD;
+	return r;
+}
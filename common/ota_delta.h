@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* streaming binary delta (bsdiff style, uncompressed)
+ *
+ * header  : "ADF1", source length, target length, sha256 of source
+ * records : diff length, extra length, seek, diff bytes, extra bytes
+ *
+ * All numbers are 32bit little endian, seek is signed.
+ * Diff bytes are added to source bytes at the source position,
+ * extra bytes are copied as they are, then source position moves
+ * by diff length + seek. Records follow until target length.
+ *
+ * Diff length counts decoded bytes. In diff bytes "0x00 n" stands
+ * for n + 1 zero bytes, so unchanged source costs little.
+ */
+
+#define A_DELTA_MAGIC		"ADF1"
+#define A_DELTA_HASH_SIZE	32
+#define A_DELTA_HEADER_SIZE	(12 + A_DELTA_HASH_SIZE)
+#define A_DELTA_CONTROL_SIZE	12
+#define A_DELTA_BUF		256	/* source bytes read at once */
+
+enum a_delta_state {
+	DELTA_HEADER,
+	DELTA_CONTROL,
+	DELTA_DIFF,
+	DELTA_EXTRA,
+	DELTA_DONE,
+	DELTA_BAD,
+};
+
+typedef enum {
+	DELTA_OK = 0,
+	DELTA_ERR_FORMAT = -1,
+	DELTA_ERR_SOURCE = -2,	/* out of source range or read fail */
+	DELTA_ERR_WRITE = -3,
+} a_delta_err_t;
+
+/* callbacks return 0 on success */
+typedef int (*a_delta_read_fn)(void *arg, uint32_t offset, uint8_t *buf, uint32_t len);
+typedef int (*a_delta_write_fn)(void *arg, const uint8_t *buf, uint32_t len);
+
+typedef struct {
+	a_delta_read_fn read;
+	a_delta_write_fn write;
+	void *arg;
+
+	enum a_delta_state s;
+	uint8_t hdr[A_DELTA_HEADER_SIZE];	/* header or control record */
+	int hdr_pos;
+
+	uint8_t source_hash[A_DELTA_HASH_SIZE];
+	uint32_t source_len;
+	uint32_t target_len;
+	uint32_t src_pos;
+	uint32_t out_pos;
+	uint32_t diff_left;
+	uint32_t extra_left;
+	int32_t seek;
+	bool run;		/* 0x00 seen, count follows */
+	uint32_t zeros;		/* zero diff bytes pending */
+
+	uint8_t buf[A_DELTA_BUF];
+	uint8_t src[A_DELTA_BUF];
+} a_delta_t;
+
+/* true if data starts with a delta header */
+bool a_delta_detect(const uint8_t *data, size_t len);
+
+void a_delta_init(a_delta_t *d, a_delta_read_fn read, a_delta_write_fn write, void *arg);
+/* feed patch bytes in any split */
+a_delta_err_t a_delta_apply(a_delta_t *d, const uint8_t *patch, size_t len);
+
+/* source_len and source_hash are valid, check them before any output */
+static inline bool a_delta_has_header(a_delta_t *d) {
+	return (d->s != DELTA_HEADER && d->s != DELTA_BAD) ? true : false;
+}
+
+static inline bool a_delta_is_finished(a_delta_t *d) {
+	return (d->s == DELTA_DONE) ? true : false;
+}
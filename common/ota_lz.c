@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "ota_lz.h"
+#include <string.h>
+
+/* output is collected in the window itself and written out when the
+ * window wraps or input runs out, so there is no other buffer */
+
+#define WINDOW_SIZE	(1 << A_LZ_WINDOW_BITS)
+
+bool a_lz_detect(const uint8_t *data, size_t len)
+{
+	return (len >= 4 && memcmp(data, A_LZ_MAGIC, 4) == 0) ? true : false;
+}
+
+void a_lz_init(a_lz_t *z, a_lz_write_fn write, void *arg)
+{
+	/* window starts as zeros, like heatshrink */
+	memset(z, 0, sizeof(*z));
+	z->write = write;
+	z->arg = arg;
+	z->s = LZ_HEADER;
+}
+
+static a_lz_err_t _header(a_lz_t *z)
+{
+	const uint8_t *h = z->hdr;
+
+	if (memcmp(h, A_LZ_MAGIC, 4) != 0)
+		return LZ_ERR_FORMAT;
+	z->window_bits = h[4];
+	z->count_bits = h[5];
+	z->image_len = (uint32_t)h[8] | ((uint32_t)h[9] << 8) |
+		((uint32_t)h[10] << 16) | ((uint32_t)h[11] << 24);
+	if (z->window_bits < 4 || z->window_bits > A_LZ_WINDOW_BITS ||
+	    z->count_bits < 3 || z->count_bits >= z->window_bits)
+		return LZ_ERR_FORMAT;
+	z->s = z->image_len ? LZ_TAG : LZ_DONE;
+	return LZ_OK;
+}
+
+static a_lz_err_t _flush(a_lz_t *z)
+{
+	uint16_t from = z->flushed;
+
+	if (z->pos == from)
+		return LZ_OK;
+	z->flushed = z->pos;
+	return (*z->write)(z->arg, z->window + from, (uint32_t)(z->pos - from)) == 0 ?
+		LZ_OK : LZ_ERR_WRITE;
+}
+
+static a_lz_err_t _out(a_lz_t *z, uint8_t c)
+{
+	z->window[z->pos++] = c;
+	z->out_pos++;
+	if (z->pos == WINDOW_SIZE) {
+		a_lz_err_t r = _flush(z);
+		z->pos = z->flushed = 0;
+		return r;
+	}
+	return LZ_OK;
+}
+
+/* back reference, distance is 1 based */
+static a_lz_err_t _copy(a_lz_t *z, uint32_t dist, uint32_t count)
+{
+	a_lz_err_t r = LZ_OK;
+	uint16_t from;
+
+	if (count > z->image_len - z->out_pos)
+		return LZ_ERR_FORMAT;
+	from = (uint16_t)((z->pos - dist) & (WINDOW_SIZE - 1));
+	while (count-- && r == LZ_OK) {
+		r = _out(z, z->window[from]);
+		from = (from + 1) & (WINDOW_SIZE - 1);
+	}
+	return r;
+}
+
+a_lz_err_t a_lz_apply(a_lz_t *z, const uint8_t *in, size_t len)
+{
+	a_lz_err_t r = LZ_OK;
+	uint32_t n, v;
+	int need;
+
+	while (r == LZ_OK) {
+		if (z->s == LZ_HEADER) {
+			if (len == 0)
+				break;
+			n = A_LZ_HEADER_SIZE - z->hdr_pos;
+			if (n > len)
+				n = (uint32_t)len;
+			memcpy(z->hdr + z->hdr_pos, in, n);
+			z->hdr_pos += n;
+			in += n;
+			len -= n;
+			if (z->hdr_pos == A_LZ_HEADER_SIZE)
+				r = _header(z);
+			continue;
+		}
+		if (z->s == LZ_DONE) {
+			/* only padding bits of the last byte may follow */
+			if (len > 0)
+				r = LZ_ERR_FORMAT;
+			break;
+		}
+		if (z->s == LZ_BAD) {
+			r = LZ_ERR_FORMAT;
+			break;
+		}
+
+		switch (z->s) {
+		case LZ_TAG:	need = 1; break;
+		case LZ_LITERAL:	need = 8; break;
+		case LZ_INDEX:	need = z->window_bits; break;
+		default:	need = z->count_bits; break;
+		}
+		while (z->nbits < need && len > 0) {
+			z->bits = (z->bits << 8) | *in++;
+			z->nbits += 8;
+			len--;
+		}
+		if (z->nbits < need)
+			break;
+		z->nbits -= need;
+		v = (z->bits >> z->nbits) & ((1U << need) - 1);
+
+		switch (z->s) {
+		case LZ_TAG:
+			z->s = v ? LZ_LITERAL : LZ_INDEX;
+			break;
+		case LZ_LITERAL:
+			r = _out(z, (uint8_t)v);
+			z->s = LZ_TAG;
+			break;
+		case LZ_INDEX:
+			z->index = (uint16_t)v;
+			z->s = LZ_COUNT;
+			break;
+		default:
+			r = _copy(z, (uint32_t)z->index + 1, v + 1);
+			z->s = LZ_TAG;
+			break;
+		}
+		if (z->out_pos == z->image_len && z->s == LZ_TAG)
+			z->s = LZ_DONE;
+	}
+
+	if (r == LZ_OK)
+		r = _flush(z);
+	if (r != LZ_OK)
+		z->s = LZ_BAD;
+	return r;
+}
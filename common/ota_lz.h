@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* streaming LZSS decoder for compressed images (heatshrink bitstream)
+ *
+ * header  : "AHS1", window bits, lookahead bits, 0, 0, image length
+ * stream  : 1 + 8bit literal, or
+ *           0 + (distance - 1) in window bits + (count - 1) in lookahead bits
+ *
+ * Bits are MSB first, image length is 32bit little endian.
+ * RAM is the window, so window bits are limited by A_LZ_WINDOW_BITS.
+ */
+
+#define A_LZ_MAGIC		"AHS1"
+#define A_LZ_HEADER_SIZE	12
+
+#ifndef A_LZ_WINDOW_BITS
+#define A_LZ_WINDOW_BITS	10
+#endif
+
+enum a_lz_state {
+	LZ_HEADER,
+	LZ_TAG,
+	LZ_LITERAL,
+	LZ_INDEX,
+	LZ_COUNT,
+	LZ_DONE,
+	LZ_BAD,
+};
+
+typedef enum {
+	LZ_OK = 0,
+	LZ_ERR_FORMAT = -1,
+	LZ_ERR_WRITE = -2,
+} a_lz_err_t;
+
+/* returns 0 on success */
+typedef int (*a_lz_write_fn)(void *arg, const uint8_t *buf, uint32_t len);
+
+typedef struct {
+	a_lz_write_fn write;
+	void *arg;
+
+	enum a_lz_state s;
+	uint8_t hdr[A_LZ_HEADER_SIZE];
+	int hdr_pos;
+	uint8_t window_bits;
+	uint8_t count_bits;
+	uint32_t image_len;
+	uint32_t out_pos;
+
+	uint32_t bits;		/* input bits not consumed yet */
+	int nbits;
+	uint16_t index;
+
+	uint16_t pos;		/* window write position */
+	uint16_t flushed;	/* window bytes before this are written */
+	uint8_t window[1 << A_LZ_WINDOW_BITS];
+} a_lz_t;
+
+/* true if data starts with a compressed image header */
+bool a_lz_detect(const uint8_t *data, size_t len);
+
+void a_lz_init(a_lz_t *z, a_lz_write_fn write, void *arg);
+/* feed compressed bytes in any split */
+a_lz_err_t a_lz_apply(a_lz_t *z, const uint8_t *in, size_t len);
+
+static inline bool a_lz_is_finished(a_lz_t *z) {
+	return (z->s == LZ_DONE) ? true : false;
+}
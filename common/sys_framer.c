@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+
+#include "maxim_ssi.h"
+#include "sys_framer.h"
+
+#define SLIP_END	0xC0
+#define SLIP_ESC	0xDB
+#define SLIP_ESC_END	0xDC
+#define SLIP_ESC_ESC	0xDD
+
+void a_sys_framer_reset(sys_framer_t *f)
+{
+	f->len = 0;
+	f->need = 0;
+	f->hdr = 0;
+	f->state = 0;
+	f->drop = WICED_FALSE;
+}
+
+static void frame_out(sys_framer_t *f, const uint8_t *frame, uint32_t len)
+{
+	f->frames++;
+	(*f->fn)(f->arg, frame, len);
+}
+
+static void frame_drop(sys_framer_t *f)
+{
+	if (!f->drop)
+		f->errors++;
+	f->drop = WICED_TRUE;
+}
+
+static void append(sys_framer_t *f, const uint8_t *data, uint32_t len)
+{
+	if (f->drop)
+		return;
+	if (f->len + len > f->size) {
+		frame_drop(f);
+		return;
+	}
+	memcpy(f->buf + f->len, data, len);
+	f->len += len;
+}
+
+static void line_out(sys_framer_t *f, const uint8_t *frame, uint32_t len)
+{
+	if (f->opt == '\n' && len > 0 && frame[len - 1] == '\r')
+		len--;
+	if (len > 0)
+		frame_out(f, frame, len);
+}
+
+static void line_feed(sys_framer_t *f, const uint8_t *data, uint32_t len)
+{
+	const uint8_t *e;
+	uint32_t n;
+
+	while (len > 0) {
+		e = memchr(data, f->opt, len);
+		n = e ? (uint32_t)(e - data) : len;
+		if (e && f->len == 0 && !f->drop && n <= f->size) {
+			line_out(f, data, n);
+		} else {
+			append(f, data, n);
+			if (e) {
+				if (!f->drop)
+					line_out(f, f->buf, f->len);
+				a_sys_framer_reset(f);
+			}
+		}
+		if (e == NULL)
+			break;
+		data += n + 1;
+		len -= n + 1;
+	}
+}
+
+static void length_feed(sys_framer_t *f, const uint8_t *data, uint32_t len)
+{
+	uint32_t n;
+
+	while (len > 0) {
+		if (f->hdr < f->opt) {
+			f->need = (f->need << 8) | *data++;
+			len--;
+			if (++f->hdr < f->opt)
+				continue;
+			if (f->need > f->size)
+				frame_drop(f);
+			else if (f->need == 0)
+				frame_out(f, data, 0);
+		} else if (f->len == 0 && len >= f->need && !f->drop) {
+			frame_out(f, data, f->need);
+			data += f->need;
+			len -= f->need;
+			f->len = f->need;
+		} else {
+			n = MIN(len, f->need - f->len);
+			if (!f->drop)
+				memcpy(f->buf + f->len, data, n);
+			f->len += n;
+			data += n;
+			len -= n;
+			if (f->len == f->need && !f->drop)
+				frame_out(f, f->buf, f->len);
+		}
+		if (f->hdr == f->opt && f->len == f->need)
+			a_sys_framer_reset(f);
+	}
+}
+
+static void slip_feed(sys_framer_t *f, const uint8_t *data, uint32_t len)
+{
+	uint8_t c;
+
+	for (; len > 0; data++, len--) {
+		c = *data;
+		if (c == SLIP_END) {
+			if (f->state)
+				frame_drop(f);
+			if (!f->drop && f->len > 0)
+				frame_out(f, f->buf, f->len);
+			a_sys_framer_reset(f);
+		} else if (f->state) {
+			f->state = 0;
+			if (c == SLIP_ESC_END)
+				c = SLIP_END;
+			else if (c == SLIP_ESC_ESC)
+				c = SLIP_ESC;
+			else
+				frame_drop(f);
+			append(f, &c, 1);
+		} else if (c == SLIP_ESC) {
+			f->state = 1;
+		} else {
+			append(f, &c, 1);
+		}
+	}
+}
+
+/* state is the code of the current block, need the bytes left in it */
+static void cobs_feed(sys_framer_t *f, const uint8_t *data, uint32_t len)
+{
+	static const uint8_t zero;
+	uint8_t c;
+
+	for (; len > 0; data++, len--) {
+		c = *data;
+		if (c == 0) {
+			/* zero after the last block is implied, not data */
+			if (f->need)
+				frame_drop(f);
+			if (!f->drop && f->state)
+				frame_out(f, f->buf, f->len);
+			a_sys_framer_reset(f);
+		} else if (f->need == 0) {
+			if (f->state && f->state < 0xFF)
+				append(f, &zero, 1);
+			f->state = c;
+			f->need = c - 1U;
+		} else {
+			append(f, &c, 1);
+			f->need--;
+		}
+	}
+}
+
+static wiced_bool_t ssi_single(uint8_t c)
+{
+	return (c == ACK_NO_DATA || c == NACK || c == BAD_CMD ||
+		c == CHK_SUM_BAD || c == BUFF_OVRFLW) ? WICED_TRUE : WICED_FALSE;
+}
+
+static wiced_bool_t ssi_sum_ok(const uint8_t *p, uint32_t len)
+{
+	uint8_t sum = 0;
+
+	while (len--)
+		sum += *p++;
+	return sum == 0 ? WICED_TRUE : WICED_FALSE;
+}
+
+static void ssi_packet(sys_framer_t *f, const uint8_t *p, uint32_t len)
+{
+	if (ssi_sum_ok(p, len))
+		frame_out(f, p, len);
+	else
+		f->errors++;
+}
+
+/* packet is header, byte count of whole packet, payload, checksum */
+static void ssi_feed(sys_framer_t *f, const uint8_t *data, uint32_t len)
+{
+	uint32_t n;
+
+	while (len > 0) {
+		if (f->len == 0) {
+			if (ssi_single(*data)) {
+				frame_out(f, data, 1);
+				data++;
+				len--;
+				continue;
+			}
+			if (*data != ACK_DATA && *data != AUTO_REPORT) {
+				/* out of sync */
+				f->errors++;
+				data++;
+				len--;
+				continue;
+			}
+			if (len >= 2 && data[1] >= 3 && len >= data[1] && data[1] <= f->size) {
+				n = data[1];
+				ssi_packet(f, data, n);
+				data += n;
+				len -= n;
+				continue;
+			}
+			f->buf[f->len++] = *data++;
+			len--;
+			continue;
+		}
+		if (f->len == 1) {
+			f->need = *data;
+			if (f->need < 3 || f->need > f->size) {
+				f->errors++;
+				a_sys_framer_reset(f);
+				continue;
+			}
+			f->buf[f->len++] = *data++;
+			len--;
+			continue;
+		}
+		n = MIN(len, f->need - f->len);
+		memcpy(f->buf + f->len, data, n);
+		f->len += n;
+		data += n;
+		len -= n;
+		if (f->len == f->need) {
+			ssi_packet(f, f->buf, f->len);
+			a_sys_framer_reset(f);
+		}
+	}
+}
+
+static void framer_init(sys_framer_t *f, sys_framer_feed_fn feed, uint8_t *buf, uint32_t size,
+			uint8_t opt, sys_frame_fn fn, void *arg)
+{
+	memset(f, 0, sizeof(*f));
+	f->feed = feed;
+	f->buf = buf;
+	f->size = size;
+	f->opt = opt;
+	f->fn = fn;
+	f->arg = arg;
+}
+
+void a_sys_framer_line_init(sys_framer_t *f, uint8_t *buf, uint32_t size, uint8_t delim,
+			    sys_frame_fn fn, void *arg)
+{
+	framer_init(f, line_feed, buf, size, delim, fn, arg);
+}
+
+void a_sys_framer_length_init(sys_framer_t *f, uint8_t *buf, uint32_t size, uint8_t len_size,
+			      sys_frame_fn fn, void *arg)
+{
+	framer_init(f, length_feed, buf, size, (uint8_t)MIN(MAX(len_size, 1), 4), fn, arg);
+}
+
+void a_sys_framer_slip_init(sys_framer_t *f, uint8_t *buf, uint32_t size,
+			    sys_frame_fn fn, void *arg)
+{
+	framer_init(f, slip_feed, buf, size, 0, fn, arg);
+}
+
+void a_sys_framer_cobs_init(sys_framer_t *f, uint8_t *buf, uint32_t size,
+			    sys_frame_fn fn, void *arg)
+{
+	framer_init(f, cobs_feed, buf, size, 0, fn, arg);
+}
+
+void a_sys_framer_ssi_init(sys_framer_t *f, uint8_t *buf, uint32_t size,
+			   sys_frame_fn fn, void *arg)
+{
+	framer_init(f, ssi_feed, buf, MIN(size, MAX_PACKET_LEN), 0, fn, arg);
+}
+
+void a_sys_framer_uart_fn(void *arg, const char *buf, uint32_t size)
+{
+	a_sys_framer_feed((sys_framer_t*)arg, (const uint8_t*)buf, size);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+/* frame points into the receive span or into the framer buffer, valid
+ * only during the call */
+typedef void (*sys_frame_fn)(void *arg, const uint8_t *frame, uint32_t len);
+
+struct sys_framer;
+typedef void (*sys_framer_feed_fn)(struct sys_framer *f, const uint8_t *data, uint32_t len);
+
+/* incremental decoder from a byte stream to frames. A frame that fits
+ * in one span is passed without copy, others are gathered in buf */
+typedef struct sys_framer {
+	sys_framer_feed_fn feed;
+	sys_frame_fn fn;
+	void *arg;
+
+	uint8_t *buf;
+	uint32_t size;		/* longest frame */
+	uint32_t len;		/* frame bytes seen */
+	uint32_t need;		/* frame length once known */
+	uint32_t hdr;		/* header bytes seen */
+	uint8_t opt;		/* delimiter or length size */
+	uint8_t state;		/* slip escape, cobs code */
+	wiced_bool_t drop;	/* too long or broken, skip to next frame */
+
+	uint32_t frames;
+	uint32_t errors;	/* frames dropped */
+} sys_framer_t;
+
+/* delimited by delim, empty ones skipped. With '\n', '\r' before it is
+ * dropped too */
+void a_sys_framer_line_init(sys_framer_t *f, uint8_t *buf, uint32_t size, uint8_t delim,
+			    sys_frame_fn fn, void *arg);
+/* big endian length of len_size bytes, 1 to 4, then payload */
+void a_sys_framer_length_init(sys_framer_t *f, uint8_t *buf, uint32_t size, uint8_t len_size,
+			      sys_frame_fn fn, void *arg);
+/* RFC 1055 */
+void a_sys_framer_slip_init(sys_framer_t *f, uint8_t *buf, uint32_t size,
+			    sys_frame_fn fn, void *arg);
+/* consistent overhead byte stuffing, 0x00 terminated */
+void a_sys_framer_cobs_init(sys_framer_t *f, uint8_t *buf, uint32_t size,
+			    sys_frame_fn fn, void *arg);
+/* maxim ssi replies, 0xAA and 0xAE packets with checksum checked and
+ * single byte replies. Frames are whole packets */
+void a_sys_framer_ssi_init(sys_framer_t *f, uint8_t *buf, uint32_t size,
+			   sys_frame_fn fn, void *arg);
+void a_sys_framer_reset(sys_framer_t *f);
+
+static inline void a_sys_framer_feed(sys_framer_t *f, const uint8_t *data, uint32_t len)
+{
+	(*f->feed)(f, data, len);
+}
+
+/* sys_uart_callback_fn with the framer as arg */
+void a_sys_framer_uart_fn(void *arg, const char *buf, uint32_t size);
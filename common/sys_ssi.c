@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+
+#include "eventloop.h"
+#include "sys_ssi.h"
+
+static void next(sys_ssi_t *s);
+
+static wiced_result_t send_packet(sys_ssi_t *s, const uint8_t *payload, uint8_t n)
+{
+	uint8_t packet[MAX_PACKET_LEN];
+
+	if (n > MAX_PACKET_LEN - 3)
+		return WICED_BADARG;
+	packet[0] = HEADER;
+	packet[1] = n + 3;
+	memcpy(&packet[2], payload, n);
+	packet[n + 2] = ssi_get_checksum(n + 3, packet);
+	/* reply comes within a few ms */
+	a_sys_uart_rx_wake(&s->uart);
+	return wiced_uart_transmit_bytes(s->uart.uart, packet, n + 3);
+}
+
+static wiced_result_t send_select(sys_ssi_t *s, unsigned char ssid)
+{
+	uint8_t payload[2];
+
+	if (ssid > 0x0F) {
+		payload[0] = SELECT_TRGT;
+		payload[1] = ssid;
+		return send_packet(s, payload, 2);
+	}
+	/* short form for low addresses */
+	payload[0] = ssid | 0xC0;
+	return send_packet(s, payload, 1);
+}
+
+static uint8_t set_adrs(uint8_t *p, int adrs)
+{
+	adrs *= 3;
+	p[0] = RW_ADRS;
+	p[1] = adrs & 0xFF;
+	p[2] = (adrs >> 8) & 0xFF;
+	return 3;
+}
+
+static void complete(sys_ssi_t *s, wiced_result_t result)
+{
+	sys_ssi_xfer_t *x = s->cur;
+
+	a_eventloop_deregister_timer(s->uart.evt, &s->timer_node);
+	s->cur = NULL;
+	x->busy = WICED_FALSE;
+	if (x->done_fn)
+		(*x->done_fn)(x->arg, x, result);
+	next(s);
+}
+
+static void timeout(void *arg)
+{
+	sys_ssi_t *s = arg;
+
+	/* a late reply would be taken for the next one, start over */
+	s->timeouts++;
+	s->selected = 0;
+	a_sys_framer_reset(&s->framer);
+	complete(s, WICED_TIMEOUT);
+}
+
+static void start(sys_ssi_t *s)
+{
+	sys_ssi_xfer_t *x = s->cur;
+	wiced_result_t result;
+
+	s->selecting = x->ssid && x->ssid != s->selected;
+	if (s->selecting) {
+		s->selected = 0;
+		s->batch = 0;
+		result = send_select(s, x->ssid);
+	} else {
+		s->batch++;
+		result = send_packet(s, x->req, x->req_len);
+	}
+
+	if (result != WICED_SUCCESS) {
+		complete(s, result);
+		return;
+	}
+	a_eventloop_register_timer(s->uart.evt, &s->timer_node, timeout, SYS_SSI_TIMEOUT_MS, s);
+}
+
+/* first one for the selected device while the batch lasts, else oldest */
+static void next(sys_ssi_t *s)
+{
+	sys_ssi_xfer_t *x, *pick;
+
+	if (s->cur)
+		return;
+	if (linked_list_get_front_node(&s->queue, (linked_list_node_t**)&pick) != WICED_SUCCESS)
+		return;
+
+	if (s->selected && s->batch < SYS_SSI_BATCH) {
+		for (x = pick; x; x = (sys_ssi_xfer_t*)x->node.next) {
+			if (x->ssid == 0 || x->ssid == s->selected) {
+				pick = x;
+				break;
+			}
+		}
+	}
+
+	linked_list_remove_node(&s->queue, &pick->node);
+	s->cur = pick;
+	start(s);
+}
+
+static void reply(sys_ssi_t *s, const uint8_t *frame, uint32_t len)
+{
+	sys_ssi_xfer_t *x = s->cur;
+
+	if (x == NULL) {
+		s->errors++;
+		return;
+	}
+
+	if (s->selecting) {
+		if (frame[0] != ACK_NO_DATA) {
+			s->errors++;
+			complete(s, WICED_ERROR);
+			return;
+		}
+		a_eventloop_deregister_timer(s->uart.evt, &s->timer_node);
+		s->selected = x->ssid;
+		start(s);
+		return;
+	}
+
+	if (frame[0] == ACK_DATA) {
+		x->len = MIN(len - 3, x->size);
+		memcpy(x->data, &frame[2], x->len);
+		complete(s, len - 3 > x->size ? WICED_ERROR : WICED_SUCCESS);
+	} else if (frame[0] == ACK_NO_DATA) {
+		complete(s, WICED_SUCCESS);
+	} else {
+		s->errors++;
+		complete(s, WICED_ERROR);
+	}
+}
+
+static void report(sys_ssi_t *s, const uint8_t *frame, uint32_t len)
+{
+	sys_ssi_sample_t *sample;
+	const uint8_t *p = &frame[2];
+	uint32_t t = s->tail;
+	int i;
+
+	s->reports++;
+	if (t - __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) == SYS_SSI_SAMPLES) {
+		s->dropped++;
+		return;
+	}
+
+	sample = &s->sample[t & (SYS_SSI_SAMPLES - 1)];
+	wiced_time_get_time(&sample->time);
+	sample->n = MIN((len - 3) / 3, SYS_SSI_REPORT_REGS);
+	for (i = 0; i < sample->n; i++, p += 3)
+		sample->value[i] = p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16);
+	__atomic_store_n(&s->tail, t + 1, __ATOMIC_RELEASE);
+	s->queued = WICED_TRUE;
+}
+
+static void frame_fn(void *arg, const uint8_t *frame, uint32_t len)
+{
+	sys_ssi_t *s = arg;
+
+	if (frame[0] == AUTO_REPORT)
+		report(s, frame, len);
+	else
+		reply(s, frame, len);
+}
+
+static void rx_fn(void *arg, const char *buf, uint32_t size)
+{
+	sys_ssi_t *s = arg;
+
+	s->queued = WICED_FALSE;
+	a_sys_framer_feed(&s->framer, (const uint8_t*)buf, size);
+	if (s->queued && s->sample_fn)
+		(*s->sample_fn)(s->arg);
+}
+
+wiced_result_t a_sys_ssi_init(sys_ssi_t *s, eventloop_t *e, uint32_t event_flag, wiced_uart_t uart,
+			      int baud_rate, uint8_t *rx_data, uint32_t rx_size)
+{
+	wiced_result_t result;
+
+	memset(s, 0, sizeof(*s));
+	linked_list_init(&s->queue);
+	a_sys_framer_ssi_init(&s->framer, s->frame, sizeof(s->frame), frame_fn, s);
+
+	result = a_sys_uart_init(&s->uart, uart, baud_rate, rx_data, rx_size, WICED_FALSE);
+	if (result != WICED_SUCCESS)
+		return result;
+	return a_sys_uart_register_event(&s->uart, e, event_flag, rx_fn, s);
+}
+
+wiced_result_t a_sys_ssi_submit(sys_ssi_t *s, sys_ssi_xfer_t *x)
+{
+	if (x->busy)
+		return WICED_ERROR;
+	x->busy = WICED_TRUE;
+	x->len = 0;
+	linked_list_insert_node_at_rear(&s->queue, &x->node);
+	next(s);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t a_sys_ssi_read(sys_ssi_t *s, sys_ssi_xfer_t *x, unsigned char ssid, int adrs, int cnt,
+			      uint8_t *data, sys_ssi_done_fn done_fn, void *arg)
+{
+	uint8_t n;
+
+	if (cnt < 1 || cnt > MAX_READ_REGS || x->busy)
+		return WICED_BADARG;
+
+	n = set_adrs(x->req, adrs);
+	/* short form carries the count for up to 15 bytes */
+	if (cnt * 3 < 0x10) {
+		x->req[n++] = READ_BYTES | (cnt * 3);
+	} else {
+		x->req[n++] = READ_BYTES;
+		x->req[n++] = cnt * 3;
+	}
+	x->req_len = n;
+	x->ssid = ssid;
+	x->data = data;
+	x->size = cnt * 3;
+	x->done_fn = done_fn;
+	x->arg = arg;
+	return a_sys_ssi_submit(s, x);
+}
+
+wiced_result_t a_sys_ssi_write(sys_ssi_t *s, sys_ssi_xfer_t *x, unsigned char ssid, int adrs, uint32_t value,
+			       sys_ssi_done_fn done_fn, void *arg)
+{
+	uint8_t n;
+
+	if (x->busy)
+		return WICED_BADARG;
+
+	n = set_adrs(x->req, adrs);
+	x->req[n++] = WRITE_BYTES | 3;
+	x->req[n++] = value & 0xFF;
+	x->req[n++] = (value >> 8) & 0xFF;
+	x->req[n++] = (value >> 16) & 0xFF;
+	x->req_len = n;
+	x->ssid = ssid;
+	x->data = NULL;
+	x->size = 0;
+	x->done_fn = done_fn;
+	x->arg = arg;
+	return a_sys_ssi_submit(s, x);
+}
+
+wiced_result_t a_sys_ssi_stream_start(sys_ssi_t *s, unsigned char ssid, int ctrl_adrs, uint32_t ctrl_value,
+				      sys_ssi_sample_fn fn, void *arg)
+{
+	s->sample_fn = fn;
+	s->arg = arg;
+	s->stream_ssid = ssid;
+	return a_sys_ssi_write(s, &s->ctrl, ssid, ctrl_adrs, ctrl_value, NULL, NULL);
+}
+
+wiced_result_t a_sys_ssi_stream_stop(sys_ssi_t *s, int ctrl_adrs, uint32_t ctrl_value)
+{
+	s->sample_fn = NULL;
+	return a_sys_ssi_write(s, &s->ctrl, s->stream_ssid, ctrl_adrs, ctrl_value, NULL, NULL);
+}
+
+wiced_bool_t a_sys_ssi_sample_get(sys_ssi_t *s, sys_ssi_sample_t *sample)
+{
+	uint32_t h = s->head;
+
+	if (h == __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE))
+		return WICED_FALSE;
+	*sample = s->sample[h & (SYS_SSI_SAMPLES - 1)];
+	__atomic_store_n(&s->head, h + 1, __ATOMIC_RELEASE);
+	return WICED_TRUE;
+}
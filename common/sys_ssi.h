@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include "maxim_ssi.h"
+#include "sys_uart.h"
+#include "sys_framer.h"
+
+#ifndef SYS_SSI_REPORT_REGS
+#define SYS_SSI_REPORT_REGS	8
+#endif
+#ifndef SYS_SSI_SAMPLES
+#define SYS_SSI_SAMPLES		16	/* power of 2 */
+#endif
+#define SYS_SSI_TIMEOUT_MS	500	/* 255 byte reply takes 266 ms at 9600 */
+#define SYS_SSI_BATCH		8	/* transactions in a row for one device */
+
+struct sys_ssi_xfer;
+typedef void (*sys_ssi_done_fn)(void *arg, struct sys_ssi_xfer *x, wiced_result_t result);
+
+/* one request packet and its reply. Owned by the queue from submit until
+ * done_fn, which may submit it again. ssid 0 goes to the selected device */
+typedef struct sys_ssi_xfer {
+	linked_list_node_t node;
+	unsigned char ssid;
+	uint8_t req[MAX_PACKET_LEN - 3];	/* payload of request */
+	uint8_t req_len;
+
+	uint8_t *data;		/* payload of reply */
+	uint32_t size;
+	uint32_t len;
+
+	sys_ssi_done_fn done_fn;	/* may be NULL */
+	void *arg;
+	wiced_bool_t busy;
+} sys_ssi_xfer_t;
+
+/* one auto report, registers in the order the EMD sends them */
+typedef struct {
+	wiced_time_t time;		/* when it was parsed */
+	uint8_t n;
+	uint32_t value[SYS_SSI_REPORT_REGS];	/* 24 bit */
+} sys_ssi_sample_t;
+
+/* on eventloop, once per received batch with new samples */
+typedef void (*sys_ssi_sample_fn)(void *arg);
+
+/* maxim ssi link on a sys_uart. Transactions run one at a time from a
+ * queue on eventloop. Auto reports are parsed as they arrive and queued
+ * for one consumer, on any thread */
+typedef struct {
+	sys_uart_t uart;
+	sys_framer_t framer;
+	uint8_t frame[MAX_PACKET_LEN];
+
+	linked_list_t queue;
+	sys_ssi_xfer_t *cur;
+	wiced_bool_t selecting;	/* select sent for cur */
+	unsigned char selected;	/* 0 if not known */
+	int batch;		/* run for selected since select */
+	eventloop_timer_node_t timer_node;
+
+	sys_ssi_xfer_t ctrl;	/* stream start and stop */
+	unsigned char stream_ssid;
+
+	sys_ssi_sample_fn sample_fn;
+	void *arg;
+	wiced_bool_t queued;	/* sample queued in this batch */
+
+	uint32_t head;		/* consumer */
+	uint32_t tail;		/* eventloop */
+	sys_ssi_sample_t sample[SYS_SSI_SAMPLES];
+
+	uint32_t reports;
+	uint32_t dropped;	/* reports lost to a full queue */
+	uint32_t errors;	/* error and stray replies from EMD */
+	uint32_t timeouts;
+} sys_ssi_t;
+
+wiced_result_t a_sys_ssi_init(sys_ssi_t *s, eventloop_t *e, uint32_t event_flag, wiced_uart_t uart,
+			      int baud_rate, uint8_t *rx_data, uint32_t rx_size);
+/* from eventloop, fails if x is busy. Device is selected only when it
+ * changes, and queued transactions for the selected one go first, up to
+ * SYS_SSI_BATCH in a row */
+wiced_result_t a_sys_ssi_submit(sys_ssi_t *s, sys_ssi_xfer_t *x);
+/* cnt registers from adrs into data, cnt * 3 bytes */
+wiced_result_t a_sys_ssi_read(sys_ssi_t *s, sys_ssi_xfer_t *x, unsigned char ssid, int adrs, int cnt,
+			      uint8_t *data, sys_ssi_done_fn done_fn, void *arg);
+wiced_result_t a_sys_ssi_write(sys_ssi_t *s, sys_ssi_xfer_t *x, unsigned char ssid, int adrs, uint32_t value,
+			       sys_ssi_done_fn done_fn, void *arg);
+
+/* ssid 0 to skip selection. Which register and value turn auto report
+ * on, and which registers a report carries, depend on the EMD firmware */
+wiced_result_t a_sys_ssi_stream_start(sys_ssi_t *s, unsigned char ssid, int ctrl_adrs, uint32_t ctrl_value,
+				      sys_ssi_sample_fn fn, void *arg);
+wiced_result_t a_sys_ssi_stream_stop(sys_ssi_t *s, int ctrl_adrs, uint32_t ctrl_value);
+/* oldest queued sample, false if none */
+wiced_bool_t a_sys_ssi_sample_get(sys_ssi_t *s, sys_ssi_sample_t *sample);
@@ -10,7 +10,8 @@
 #include "eventloop.h"
 #include "sys_uart.h"
 
-wiced_result_t a_sys_uart_init(sys_uart_t* s, wiced_uart_t uart, int baud_rate)
+wiced_result_t a_sys_uart_init(sys_uart_t* s, wiced_uart_t uart, int baud_rate,
+			       uint8_t *rx_data, uint32_t rx_size, wiced_bool_t flow_control)
 {
 	memset(s, 0, sizeof(*s));
 	s->uart = uart;
@@ -18,55 +19,123 @@ wiced_result_t a_sys_uart_init(sys_uart_t* s, wiced_uart_t uart, int baud_rate)
 	s->uart_config.data_width = DATA_WIDTH_8BIT;
 	s->uart_config.parity = NO_PARITY;
 	s->uart_config.stop_bits = STOP_BITS_1;
-	s->uart_config.flow_control = FLOW_CONTROL_DISABLED;
+	s->uart_config.flow_control = flow_control ? FLOW_CONTROL_CTS_RTS : FLOW_CONTROL_DISABLED;
 
-	ring_buffer_init(&s->rx_buffer, s->rx_data, UART_RX_BUFFER_SIZE);
+	s->rx_threshold = rx_size / 2;
+	/* first bytes after idle may wait for an idle tick, and eventloop
+	 * should have a few fast ticks to drain before it fills */
+	if ((uint32_t)baud_rate / 10 * (UART_RX_IDLE_MS + UART_RX_TICK_MS * 4) / 1000 > s->rx_threshold &&
+	    !flow_control)
+		wiced_log_msg(WLF_DEF, WICED_LOG_WARNING, "UART ring of %lu is small for %d baud\n",
+			      (unsigned long)rx_size, baud_rate);
+
+	ring_buffer_init(&s->rx_buffer, rx_data, rx_size);
 	return wiced_uart_init(uart, &s->uart_config, &s->rx_buffer);
 }
 
-static wiced_result_t recv_worker(void *arg)
+/* uart driver fills the ring from its rx interrupt without a hook for
+ * us, so an rtos timer watches the ring and wakes the eventloop only on
+ * threshold or when the line went idle for a tick. A fast tick with
+ * nothing to see for a while also wakes it, to switch to the idle tick.
+ * Timers are switched on eventloop only. */
+static void rx_tick(void *arg)
 {
 	sys_uart_t *s = arg;
-	uint32_t size;
-	wiced_result_t result;
+	uint32_t used = ring_buffer_used_space(&s->rx_buffer);
+	int fast = __atomic_load_n(&s->rx_fast, __ATOMIC_SEQ_CST);
+	int wake;
 
-	while (1) {
-		size = 1;
-		result = wiced_uart_receive_bytes(s->uart, &s->last_data, &size, WICED_WAIT_FOREVER);
-		if (result == WICED_SUCCESS)
-			break;
+	if (used > s->rx_high_water)
+		s->rx_high_water = used;
+	if (ring_buffer_free_space(&s->rx_buffer) == 0)
+		s->rx_overruns++;
+
+	if (used) {
+		s->rx_idle = 0;
+		/* after the idle tick, switch to fast at once */
+		wake = (used >= s->rx_threshold || used == s->rx_last || !fast);
+	} else {
+		wake = (fast && ++s->rx_idle == UART_RX_IDLE_TICKS);
 	}
-	a_eventloop_set_flag(s->evt, s->flag);
-	return WICED_SUCCESS;
+	if (wake && !__atomic_exchange_n(&s->rx_pending, 1, __ATOMIC_SEQ_CST))
+		a_eventloop_set_flag(s->evt, s->flag);
+	s->rx_last = used;
+}
+
+static void rx_speed(sys_uart_t *s, wiced_bool_t fast)
+{
+	if (fast == __atomic_load_n(&s->rx_fast, __ATOMIC_SEQ_CST))
+		return;
+	__atomic_store_n(&s->rx_fast, fast, __ATOMIC_SEQ_CST);
+	if (fast) {
+		/* idle tick writes only 0 to it, no race */
+		s->rx_idle = 0;
+		wiced_rtos_stop_timer(&s->rx_idle_timer);
+		wiced_rtos_start_timer(&s->rx_timer);
+	} else {
+		wiced_rtos_stop_timer(&s->rx_timer);
+		wiced_rtos_start_timer(&s->rx_idle_timer);
+	}
+}
+
+void a_sys_uart_rx_wake(sys_uart_t* s)
+{
+	rx_speed(s, WICED_TRUE);
 }
 
 static void recv_callback(void *arg)
 {
 	sys_uart_t *s = arg;
-	char buf[UART_RX_BUFFER_SIZE];
-	wiced_result_t result;
-	int pos = 1;
+	uint32_t left, n;
+	uint8_t *data;
 
-	buf[0] = s->last_data;
-	do {
-		uint32_t size = 1;
-		result = wiced_uart_receive_bytes(s->uart, &buf[pos++], &size, WICED_NO_WAIT);
-	} while (result == WICED_SUCCESS);
+	/* bytes coming in from now on raise the flag again */
+	__atomic_store_n(&s->rx_pending, 0, __ATOMIC_SEQ_CST);
 
-	(*s->fn)(s->arg, buf, (uint32_t)(pos-1));
-	wiced_rtos_send_asynchronous_event(&s->worker, recv_worker, s);
+	/* what is there now, in two spans if it wraps */
+	left = ring_buffer_used_space(&s->rx_buffer);
+	if (left > 0)
+		rx_speed(s, WICED_TRUE);
+	else if (s->rx_idle >= UART_RX_IDLE_TICKS)
+		rx_speed(s, WICED_FALSE);
+	while (left > 0) {
+		ring_buffer_get_data(&s->rx_buffer, &data, &n);
+		n = MIN(n, left);
+		if (n == 0)
+			break;
+		(*s->fn)(s->arg, (const char*)data, n);
+		ring_buffer_consume(&s->rx_buffer, n);
+		left -= n;
+	}
 }
 
 wiced_result_t a_sys_uart_register_event(sys_uart_t* s, eventloop_t *e, uint32_t event_flag,
 					 sys_uart_callback_fn fn, void* arg)
 {
+	wiced_result_t result;
+
 	s->evt = e;
 	s->fn = fn;
 	s->arg = arg;
 	s->flag = event_flag;
 
+	result = wiced_rtos_init_timer(&s->rx_timer, UART_RX_TICK_MS, rx_tick, s);
+	if (result != WICED_SUCCESS)
+		return result;
+	result = wiced_rtos_init_timer(&s->rx_idle_timer, UART_RX_IDLE_MS, rx_tick, s);
+	if (result != WICED_SUCCESS)
+		goto _deinit_rx_timer;
+
+	/* nothing left registered on failure */
 	a_eventloop_register_event(s->evt, &s->evt_node, recv_callback, s->flag, s);
-	wiced_rtos_create_worker_thread(&s->worker, WICED_DEFAULT_WORKER_PRIORITY, 1024, 1);
-	wiced_rtos_send_asynchronous_event(&s->worker, recv_worker, s);
-	return WICED_SUCCESS;
+	s->rx_fast = WICED_TRUE;
+	result = wiced_rtos_start_timer(&s->rx_timer);
+	if (result == WICED_SUCCESS)
+		return result;
+
+	a_eventloop_deregister_event(s->evt, &s->evt_node);
+	wiced_rtos_deinit_timer(&s->rx_idle_timer);
+_deinit_rx_timer:
+	wiced_rtos_deinit_timer(&s->rx_timer);
+	return result;
 }
@@ -6,19 +6,35 @@
  */
 #pragma once
 
-#define UART_RX_BUFFER_SIZE 64
+#define UART_RX_TICK_MS		2	/* also idle line timeout */
+/* ring is watched at UART_RX_TICK_MS while bytes come, after
+ * UART_RX_IDLE_TICKS empty ticks at UART_RX_IDLE_MS until they do */
+#ifndef UART_RX_IDLE_MS
+#define UART_RX_IDLE_MS		50
+#endif
+#define UART_RX_IDLE_TICKS	25
 
+/* buf points into the rx ring and is consumed when it returns */
 typedef void (*sys_uart_callback_fn)(void *arg, const char* buf, uint32_t size);
 
 typedef struct {
 	wiced_uart_t uart;
 	uint32_t flag;
 	wiced_ring_buffer_t rx_buffer;
-	uint8_t rx_data[UART_RX_BUFFER_SIZE];
+	uint32_t rx_threshold;	/* half of the ring */
 	wiced_uart_config_t uart_config;
-	char last_data;
 
-	wiced_worker_thread_t worker;
+	wiced_timer_t rx_timer;
+	wiced_timer_t rx_idle_timer;
+	int rx_fast;		/* rx_timer runs, set on eventloop only */
+	int rx_idle;		/* empty ticks in a row */
+	uint32_t rx_last;	/* ring used space at last tick */
+	int rx_pending;		/* flag set, not handled yet */
+
+	uint32_t rx_high_water;	/* most bytes seen waiting in the ring */
+	uint32_t rx_overruns;	/* ticks the ring was full, without flow
+				 * control bytes may have been lost */
+
 	eventloop_t *evt;
 	eventloop_event_node_t evt_node;
 
@@ -27,6 +43,12 @@ typedef struct {
 } sys_uart_t;
 
 
-wiced_result_t a_sys_uart_init(sys_uart_t* s, wiced_uart_t uart, int baud_rate);
+/* rx_data of rx_size bytes is the rx ring, it holds rx_size - 1. With
+ * flow_control, RTS/CTS holds the sender off while the ring is full */
+wiced_result_t a_sys_uart_init(sys_uart_t* s, wiced_uart_t uart, int baud_rate,
+			       uint8_t *rx_data, uint32_t rx_size, wiced_bool_t flow_control);
 wiced_result_t a_sys_uart_register_event(sys_uart_t* s, eventloop_t *e, uint32_t event_flag,
 					 sys_uart_callback_fn fn, void* arg);
+/* from eventloop, after sending a request. Ring is watched at the fast
+ * tick so the reply is not held up by the idle tick */
+void a_sys_uart_rx_wake(sys_uart_t* s);
@@ -4,70 +4,522 @@
  * This software may be modified and distributed under the terms
  * of the MIT license.  See the LICENSE file for details.
  */
+#include <stdlib.h>
+
 #include "wiced.h"
 #include "wiced_log.h"
 
 #include "eventloop.h"
 #include "sys_worker.h"
 
-static wiced_result_t sensor_process(void *arg)
+#define SYS_WORKER_RETRY_MS	100
+
+/* deque slots are read by stealers that may lose the race, so they are
+ * copied word by word */
+static void job_load(sys_job_t *dst, sys_job_t *src)
 {
-	sys_worker_t *s = arg;
-	(*s->worker_fn)(s->arg);
-	a_eventloop_set_flag(s->evt, s->event_flag);
+	dst->fn = __atomic_load_n(&src->fn, __ATOMIC_RELAXED);
+	dst->done_fn = __atomic_load_n(&src->done_fn, __ATOMIC_RELAXED);
+	dst->arg = __atomic_load_n(&src->arg, __ATOMIC_RELAXED);
+}
+
+static void job_store(sys_job_t *dst, const sys_job_t *src)
+{
+	__atomic_store_n(&dst->fn, src->fn, __ATOMIC_RELAXED);
+	__atomic_store_n(&dst->done_fn, src->done_fn, __ATOMIC_RELAXED);
+	__atomic_store_n(&dst->arg, src->arg, __ATOMIC_RELAXED);
+}
+
+/* fixed size Chase-Lev deque, as in "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (Le et al., 2013) */
+static wiced_bool_t deque_push(sys_deque_t *q, uint32_t mask, const sys_job_t *job)
+{
+	uint32_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+	uint32_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+
+	if (b - t > mask)
+		return WICED_FALSE;
+	job_store(&q->job[b & mask], job);
+	__atomic_store_n(&q->bottom, b + 1, __ATOMIC_SEQ_CST);
+	return WICED_TRUE;
+}
+
+static wiced_bool_t deque_take(sys_deque_t *q, uint32_t mask, sys_job_t *job)
+{
+	uint32_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+	uint32_t t;
+	wiced_bool_t ok = WICED_TRUE;
+
+	__atomic_store_n(&q->bottom, b, __ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&q->top, __ATOMIC_SEQ_CST);
+	if ((int32_t)(b - t) < 0) {
+		__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+		return WICED_FALSE;
+	}
+	job_load(job, &q->job[b & mask]);
+	if (b == t) {
+		/* last one, stealers may take it first */
+		ok = __atomic_compare_exchange_n(&q->top, &t, t + 1, 0,
+						 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) ? WICED_TRUE : WICED_FALSE;
+		__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return ok;
+}
+
+/* returns 1 with a job, 0 if empty or -1 if lost to another thread */
+static int deque_steal(sys_deque_t *q, uint32_t mask, sys_job_t *job)
+{
+	uint32_t t = __atomic_load_n(&q->top, __ATOMIC_SEQ_CST);
+	uint32_t b = __atomic_load_n(&q->bottom, __ATOMIC_SEQ_CST);
+
+	if ((int32_t)(b - t) <= 0)
+		return 0;
+	job_load(job, &q->job[t & mask]);
+	if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return -1;
+	return 1;
+}
+
+/* own deque first, then eventloop submissions, then the other threads */
+static wiced_bool_t pool_find(sys_pool_t *p, sys_pool_thread_t *self, sys_job_t *job)
+{
+	int i, res, lost;
+	int id = (int)(self - p->thread);
+
+	if (deque_take(&self->deque, p->mask, job))
+		return WICED_TRUE;
+	do {
+		lost = 0;
+		if ((res = deque_steal(&p->submit, p->mask, job)) > 0)
+			return WICED_TRUE;
+		lost |= res;
+		for (i = 1; i < p->n_threads; i++) {
+			if ((res = deque_steal(&p->thread[(id + i) % p->n_threads].deque, p->mask, job)) > 0)
+				return WICED_TRUE;
+			lost |= res;
+		}
+	} while (lost);
+	return WICED_FALSE;
+}
+
+/* ring to eventloop has one writer, a flag is set only when eventloop
+ * may have drained it already */
+static void pool_done(sys_pool_t *p, sys_pool_thread_t *self, const sys_job_t *job)
+{
+	sys_ring_t *r = &self->done;
+	uint32_t h = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+	/* waits only if eventloop is behind */
+	while (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > p->mask) {
+		a_eventloop_set_flag(p->evt, p->event_flag);
+		wiced_rtos_delay_milliseconds(1);
+	}
+	r->job[h & p->mask] = *job;
+	__atomic_store_n(&r->head, h + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == h)
+		a_eventloop_set_flag(p->evt, p->event_flag);
+}
+
+static void pool_thread(wiced_thread_arg_t arg)
+{
+	sys_pool_thread_t *self = (sys_pool_thread_t*)arg;
+	sys_pool_t *p = self->pool;
+	sys_job_t job;
+
+	for (;;) {
+		if (!pool_find(p, self, &job)) {
+			/* idle is counted before looking again, so a submit
+			 * either finds it or its job is found here */
+			__atomic_add_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+			if (!pool_find(p, self, &job)) {
+				if (!__atomic_load_n(&p->stop, __ATOMIC_SEQ_CST))
+					wiced_rtos_get_semaphore(&p->wake, WICED_WAIT_FOREVER);
+				__atomic_sub_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+				if (__atomic_load_n(&p->stop, __ATOMIC_SEQ_CST))
+					break;
+				continue;
+			}
+			__atomic_sub_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+		}
+		(*job.fn)(job.arg);
+		if (job.done_fn)
+			pool_done(p, self, &job);
+	}
+}
+
+static void pool_event(void *arg)
+{
+	sys_pool_t *p = arg;
+	sys_ring_t *r;
+	sys_job_t job;
+	uint32_t t;
+	int i;
+
+	for (i = 0; i < p->n_threads; i++) {
+		r = &p->thread[i].done;
+		t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		while (t != __atomic_load_n(&r->head, __ATOMIC_SEQ_CST)) {
+			job = r->job[t & p->mask];
+			__atomic_store_n(&r->tail, ++t, __ATOMIC_SEQ_CST);
+			(*job.done_fn)(job.arg);
+		}
+	}
+}
+
+wiced_result_t a_sys_pool_submit(sys_pool_t *p, sys_worker_fn fn, sys_worker_fn done_fn, void *arg)
+{
+	sys_deque_t *q = &p->submit;
+	sys_job_t job;
+	int i;
+
+	if (fn == NULL)
+		return WICED_BADARG;
+
+	job.fn = fn;
+	job.done_fn = done_fn;
+	job.arg = arg;
+	for (i = 0; i < p->n_threads; i++) {
+		if (wiced_rtos_is_current_thread(&p->thread[i].thread) == WICED_SUCCESS) {
+			q = &p->thread[i].deque;
+			break;
+		}
+	}
+	/* a push from another thread would race the eventloop on its deque */
+	if (i == p->n_threads && tx_thread_identify() != p->owner)
+		return WICED_ERROR;
+	if (!deque_push(q, p->mask, &job))
+		return WICED_ERROR;
+	if (__atomic_load_n(&p->idle, __ATOMIC_SEQ_CST) > 0)
+		wiced_rtos_set_semaphore(&p->wake);
 	return WICED_SUCCESS;
 }
 
-static void timer_callback(void *arg)
+/* threads stop after queued jobs and wait for stuck ones, completions
+ * not run yet are dropped */
+static void pool_stop(sys_pool_t *p, int n_started)
+{
+	int i;
+
+	__atomic_store_n(&p->stop, 1, __ATOMIC_SEQ_CST);
+	for (i = 0; i < n_started; i++)
+		wiced_rtos_set_semaphore(&p->wake);
+	for (i = 0; i < n_started; i++) {
+		wiced_rtos_thread_join(&p->thread[i].thread);
+		wiced_rtos_delete_thread(&p->thread[i].thread);
+	}
+
+	a_eventloop_deregister_timer(p->evt, &p->watchdog);
+	a_eventloop_deregister_event(p->evt, &p->event_node);
+	wiced_rtos_deinit_semaphore(&p->wake);
+	free(p->mem);
+	p->mem = NULL;
+	p->n_threads = 0;
+}
+
+wiced_result_t a_sys_pool_deinit(sys_pool_t *p)
+{
+	pool_stop(p, p->n_threads);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t a_sys_pool_init(sys_pool_t *p, eventloop_t *e, uint32_t event_flag,
+			       int n_threads, uint32_t stack_size, int queue_size)
+{
+	wiced_result_t res;
+	uint32_t size;
+	int i;
+
+	if (n_threads < 1 || n_threads > SYS_POOL_MAX_THREADS || queue_size < 1)
+		return WICED_BADARG;
+
+	memset(p, 0, sizeof(*p));
+	p->evt = e;
+	p->event_flag = event_flag;
+	p->owner = tx_thread_identify();
+	linked_list_init(&p->tasks);
+
+	for (size = 1; size < (uint32_t)queue_size; size <<= 1)
+		;
+	p->mask = size - 1;
+	/* eventloop deque, then a deque and a ring for each thread */
+	p->mem = malloc(sizeof(sys_job_t) * size * (1 + 2 * n_threads));
+	if (p->mem == NULL)
+		return WICED_OUT_OF_HEAP_SPACE;
+	p->submit.job = p->mem;
+	for (i = 0; i < n_threads; i++) {
+		p->thread[i].pool = p;
+		p->thread[i].deque.job = p->mem + size * (1 + 2 * i);
+		p->thread[i].done.job = p->mem + size * (2 + 2 * i);
+	}
+	p->n_threads = n_threads;
+
+	res = wiced_rtos_init_semaphore(&p->wake);
+	if (res != WICED_SUCCESS) {
+		free(p->mem);
+		p->mem = NULL;
+		return res;
+	}
+	a_eventloop_register_event(p->evt, &p->event_node, pool_event, p->event_flag, p);
+
+	for (i = 0; i < n_threads; i++) {
+		res = wiced_rtos_create_thread(&p->thread[i].thread, WICED_DEFAULT_WORKER_PRIORITY,
+					       "sys_pool", pool_thread, stack_size, &p->thread[i]);
+		if (res != WICED_SUCCESS) {
+			pool_stop(p, i);
+			return res;
+		}
+	}
+	return WICED_SUCCESS;
+}
+
+static void task_watch(void *arg);
+
+static void task_unwatch(sys_task_t *t)
+{
+	sys_pool_t *p = t->pool;
+
+	if (!t->watched)
+		return;
+	linked_list_remove_node(&p->tasks, &t->node);
+	t->watched = WICED_FALSE;
+	if (p->tasks.count == 0)
+		a_eventloop_deregister_timer(p->evt, &p->watchdog);
+}
+
+static void task_report(sys_task_t *t, sys_job_status_t status)
+{
+	task_unwatch(t);
+	t->reported = WICED_TRUE;
+	(*t->done_fn)(t->arg, status);
+}
+
+static void task_run(void *arg)
+{
+	sys_task_t *t = arg;
+
+	/* cancelled or overdue before it started */
+	if (!__atomic_load_n(&t->cancel, __ATOMIC_SEQ_CST))
+		(*t->fn)(t->arg);
+}
+
+static void task_done(void *arg)
+{
+	sys_task_t *t = arg;
+
+	t->busy = WICED_FALSE;
+	if (t->reported) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_DEBUG0, "Late task %p returned\n", t);
+		return;
+	}
+	task_report(t, SYS_JOB_OK);
+}
+
+/* eventloop timer while any task has a deadline */
+static void task_watch(void *arg)
+{
+	sys_pool_t *p = arg;
+	sys_task_t *t;
+	wiced_time_t now;
+
+	wiced_time_get_time(&now);
+_recheck:
+	linked_list_get_front_node(&p->tasks, (linked_list_node_t**)&t);
+	while (t) {
+		if ((int)(t->deadline - now) <= 0) {
+			p->overdue++;
+			wiced_log_msg(WLF_DEF, WICED_LOG_WARNING, "Task %p overdue\n", t);
+			__atomic_store_n(&t->cancel, 1, __ATOMIC_SEQ_CST);
+			task_report(t, SYS_JOB_TIMEOUT);
+			goto _recheck;
+		}
+		t = (sys_task_t*)t->node.next;
+	}
+}
+
+wiced_result_t a_sys_task_submit(sys_pool_t *p, sys_task_t *t, sys_worker_fn fn,
+				 sys_task_done_fn done_fn, void *arg, uint32_t timeout_ms)
+{
+	wiced_result_t res;
+	wiced_time_t now;
+
+	if (t->busy)
+		return WICED_ERROR;
+
+	t->pool = p;
+	t->fn = fn;
+	t->done_fn = done_fn;
+	t->arg = arg;
+	t->cancel = 0;
+	t->reported = WICED_FALSE;
+	res = a_sys_pool_submit(p, task_run, task_done, t);
+	if (res != WICED_SUCCESS)
+		return res;
+	t->busy = WICED_TRUE;
+
+	if (timeout_ms) {
+		wiced_time_get_time(&now);
+		t->deadline = now + timeout_ms;
+		if (p->tasks.count == 0)
+			a_eventloop_register_timer(p->evt, &p->watchdog, task_watch, SYS_POOL_WATCHDOG_MS, p);
+		linked_list_insert_node_at_front(&p->tasks, &t->node);
+		t->watched = WICED_TRUE;
+	}
+	return WICED_SUCCESS;
+}
+
+/* done_fn runs now, fn still holds its thread until it returns */
+void a_sys_task_cancel(sys_task_t *t)
+{
+	if (!t->busy || t->reported)
+		return;
+	__atomic_store_n(&t->cancel, 1, __ATOMIC_SEQ_CST);
+	task_report(t, SYS_JOB_CANCELLED);
+}
+
+wiced_bool_t a_sys_task_cancelled(sys_task_t *t)
+{
+	return __atomic_load_n(&t->cancel, __ATOMIC_SEQ_CST) ? WICED_TRUE : WICED_FALSE;
+}
+
+static void timer_callback(void *arg);
+static void worker_done(void *arg, sys_job_status_t status);
+
+static void worker_arm(sys_worker_t *s, int ms)
+{
+	a_eventloop_deregister_timer(s->pool->evt, &s->timer_node);
+	a_eventloop_register_timer(s->pool->evt, &s->timer_node, timer_callback, (uint32_t)ms, s);
+}
+
+static void worker_run(void *arg)
 {
 	sys_worker_t *s = arg;
-	a_eventloop_deregister_timer(s->evt, &s->timer_node);
-	if (wiced_rtos_send_asynchronous_event(s->worker_thread, sensor_process, s) != WICED_SUCCESS) {
-		a_eventloop_register_timer(s->evt, &s->timer_node, timer_callback, s->interval_ms, s);
+	int queued = SYS_WORKER_QUEUED;
+
+	/* eventloop may have given up on it already */
+	__atomic_compare_exchange_n(&s->state, &queued, SYS_WORKER_RUNNING, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	(*s->worker_fn)(s->arg);
+}
+
+/* submits a run, or arms the timer for when min_interval_ms allows it */
+static void worker_start(sys_worker_t *s)
+{
+	wiced_time_t now;
+	int wait;
+
+	wiced_time_get_time(&now);
+	wait = (int)(s->next_start - now);
+	if (wait > 0) {
+		/* keep the timer if it comes earlier */
+		if (!a_eventloop_get_timer_fn(s->pool->evt, &s->timer_node) ||
+		    (int)(s->timer_node.next_timeout - now) > wait)
+			worker_arm(s, wait);
+		return;
+	}
+
+	if (a_sys_task_busy(&s->task)) {
+		/* previous run is stuck, report instead of queueing behind it */
+		wiced_log_msg(WLF_DEF, WICED_LOG_WARNING, "Worker %p still stuck\n", s);
+		s->next_start = now + s->min_interval_ms;
+		worker_arm(s, s->interval_ms);
+		(*s->finish_fn)(s->arg, SYS_JOB_TIMEOUT);
+		return;
+	}
+
+	/* state is set first, the job may start before submit returns */
+	__atomic_store_n(&s->state, SYS_WORKER_QUEUED, __ATOMIC_SEQ_CST);
+	if (a_sys_task_submit(s->pool, &s->task, worker_run, worker_done, s, s->timeout_ms) != WICED_SUCCESS) {
+		__atomic_store_n(&s->state, SYS_WORKER_IDLE, __ATOMIC_SEQ_CST);
+		worker_arm(s, MIN(s->interval_ms, SYS_WORKER_RETRY_MS));
+		return;
 	}
+	a_eventloop_deregister_timer(s->pool->evt, &s->timer_node);
+	s->next_start = now + s->min_interval_ms;
 }
 
-static void event_callback(void *arg)
+static void worker_done(void *arg, sys_job_status_t status)
 {
 	sys_worker_t *s = arg;
-	(s->finish_fn)(s->arg);
-	a_eventloop_register_timer(s->evt, &s->timer_node, timer_callback, s->interval_ms, s);
+	wiced_bool_t rerun;
+
+	rerun = (__atomic_load_n(&s->state, __ATOMIC_SEQ_CST) == SYS_WORKER_RERUN) ? WICED_TRUE : WICED_FALSE;
+	__atomic_store_n(&s->state, SYS_WORKER_IDLE, __ATOMIC_SEQ_CST);
+	worker_arm(s, s->interval_ms);
+
+	(*s->finish_fn)(s->arg, status);
+
+	/* finish_fn may have triggered it already */
+	if (rerun && __atomic_load_n(&s->state, __ATOMIC_SEQ_CST) == SYS_WORKER_IDLE)
+		worker_start(s);
+}
+
+static void timer_callback(void *arg)
+{
+	sys_worker_t *s = arg;
+	a_eventloop_deregister_timer(s->pool->evt, &s->timer_node);
+	worker_start(s);
 }
 
 wiced_result_t a_sys_worker_trigger(sys_worker_t *s)
 {
-	if (a_eventloop_get_timer_fn(s->evt, &s->timer_node)) {
-		timer_callback(s);
+	/* never initialized, ex) its pool failed to start */
+	if (s->pool == NULL)
+		return WICED_ERROR;
+
+	switch (__atomic_load_n(&s->state, __ATOMIC_SEQ_CST)) {
+	case SYS_WORKER_IDLE:
+		worker_start(s);
+		break;
+	case SYS_WORKER_RUNNING:
+		/* it may have read its input already, one more run follows */
+		__atomic_store_n(&s->state, SYS_WORKER_RERUN, __ATOMIC_SEQ_CST);
+		break;
+	default:
+		/* queued run has not started, or a rerun is pending */
+		break;
 	}
 	return WICED_SUCCESS;
 }
 
 wiced_result_t a_sys_worker_change_inteval(sys_worker_t *s, int interval_ms)
 {
+	wiced_time_t now;
+
 	s->interval_ms = interval_ms;
-	if (a_eventloop_get_timer_fn(s->evt, &s->timer_node)) {
-		a_eventloop_deregister_timer(s->evt, &s->timer_node);
-		a_eventloop_register_timer(s->evt, &s->timer_node, timer_callback, s->interval_ms, s);
-	}
+	wiced_time_get_time(&now);
+	/* a pending trigger stays if it is due earlier */
+	if (a_eventloop_get_timer_fn(s->pool->evt, &s->timer_node) &&
+	    (int)(s->timer_node.next_timeout - now) > interval_ms)
+		worker_arm(s, s->interval_ms);
 	return WICED_SUCCESS;
 }
 
-wiced_result_t a_sys_worker_init(sys_worker_t *s, wiced_worker_thread_t* worker_thread,
-				 eventloop_t *e, uint32_t event_flag, int interval_ms,
-				 sys_worker_fn worker_fn, sys_worker_fn finish_fn, void *arg)
+wiced_result_t a_sys_worker_set_min_interval(sys_worker_t *s, int min_interval_ms)
+{
+	s->next_start += min_interval_ms - s->min_interval_ms;
+	s->min_interval_ms = min_interval_ms;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t a_sys_worker_set_timeout(sys_worker_t *s, uint32_t timeout_ms)
+{
+	s->timeout_ms = timeout_ms;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t a_sys_worker_init(sys_worker_t *s, sys_pool_t *pool, int interval_ms,
+				 sys_worker_fn worker_fn, sys_task_done_fn finish_fn, void *arg)
 {
 	memset(s, 0, sizeof(*s));
-	s->worker_thread = worker_thread;
-	s->evt = e;
-	s->event_flag = event_flag;
+	s->pool = pool;
 	s->interval_ms = interval_ms;
 	s->worker_fn = worker_fn;
 	s->finish_fn = finish_fn;
 	s->arg = arg;
+	s->state = SYS_WORKER_IDLE;
+	wiced_time_get_time(&s->next_start);
+
+	a_eventloop_register_timer(s->pool->evt, &s->timer_node, timer_callback, s->interval_ms, s);
 
-	a_eventloop_register_timer(s->evt, &s->timer_node, timer_callback, s->interval_ms, s);
-	a_eventloop_register_event(s->evt, &s->event_node, event_callback, s->event_flag, s);
-	
 	return WICED_SUCCESS;
 }
-
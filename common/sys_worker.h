@@ -6,24 +6,144 @@
  */
 #pragma once
 
+#ifndef SYS_POOL_MAX_THREADS
+#define SYS_POOL_MAX_THREADS	4
+#endif
+#define SYS_POOL_WATCHDOG_MS	100
+
 typedef void (*sys_worker_fn)(void *arg);
 
 typedef struct {
-	eventloop_t *evt;
+	sys_worker_fn fn;	/* runs on a pool thread */
+	sys_worker_fn done_fn;	/* runs on eventloop after fn, may be NULL */
+	void *arg;
+} sys_job_t;
+
+/* Chase-Lev deque, owner pushes and takes at bottom, others steal at top */
+typedef struct {
+	uint32_t top;
+	uint32_t bottom;
+	sys_job_t *job;
+} sys_deque_t;
+
+/* finished jobs of one thread for the eventloop */
+typedef struct {
+	uint32_t head;
+	uint32_t tail;
+	sys_job_t *job;
+} sys_ring_t;
 
+struct sys_pool;
+
+typedef struct {
+	struct sys_pool *pool;
+	wiced_thread_t thread;
+	sys_deque_t deque;	/* jobs submitted by its own jobs */
+	sys_ring_t done;
+} sys_pool_thread_t;
+
+/* worker threads with a deque each, idle ones steal from the others.
+ * Completions are passed back and run by the eventloop on one event flag */
+typedef struct sys_pool {
+	eventloop_t *evt;
 	uint32_t event_flag;
+
+	uint32_t mask;		/* deque and ring size - 1 */
+	sys_deque_t submit;	/* jobs from eventloop, owned by it */
+	TX_THREAD *owner;	/* eventloop thread, the one that called init */
+	sys_job_t *mem;
+	wiced_semaphore_t wake;
+	int idle;
+	int stop;
+
+	sys_pool_thread_t thread[SYS_POOL_MAX_THREADS];
+	int n_threads;
+
+	eventloop_event_node_t event_node;
+	linked_list_t tasks;		/* tasks with deadline */
+	eventloop_timer_node_t watchdog;
+	uint32_t overdue;		/* tasks timed out so far */
+} sys_pool_t;
+
+/* call init on the eventloop thread */
+wiced_result_t a_sys_pool_init(sys_pool_t *p, eventloop_t *e, uint32_t event_flag,
+			       int n_threads, uint32_t stack_size, int queue_size);
+wiced_result_t a_sys_pool_deinit(sys_pool_t *p);
+/* from eventloop or from a job of the pool. never blocks, fails if the
+ * deque is full or on any other thread */
+wiced_result_t a_sys_pool_submit(sys_pool_t *p, sys_worker_fn fn, sys_worker_fn done_fn, void *arg);
+
+typedef enum {
+	SYS_JOB_OK,
+	SYS_JOB_TIMEOUT,	/* deadline passed, fn may still run */
+	SYS_JOB_CANCELLED,
+} sys_job_status_t;
+
+typedef void (*sys_task_done_fn)(void *arg, sys_job_status_t status);
+
+/* pool job with deadline and cancel request, owned by caller and zeroed
+ * before first use. done_fn runs once on eventloop, when fn returns, at
+ * the deadline or on cancel, whichever is first */
+typedef struct {
+	linked_list_node_t node;
+	sys_pool_t *pool;
+	sys_worker_fn fn;
+	sys_task_done_fn done_fn;
+	void *arg;
+
+	wiced_time_t deadline;
+	int cancel;		/* polled by fn, set by eventloop */
+	wiced_bool_t busy;	/* fn not returned yet, can not be reused */
+	wiced_bool_t reported;	/* done_fn called */
+	wiced_bool_t watched;	/* on pool watchdog list */
+} sys_task_t;
+
+/* from eventloop, timeout_ms 0 for no deadline */
+wiced_result_t a_sys_task_submit(sys_pool_t *p, sys_task_t *t, sys_worker_fn fn,
+				 sys_task_done_fn done_fn, void *arg, uint32_t timeout_ms);
+void a_sys_task_cancel(sys_task_t *t);
+/* from fn, true if it should return early */
+wiced_bool_t a_sys_task_cancelled(sys_task_t *t);
+static inline wiced_bool_t a_sys_task_busy(sys_task_t *t)
+{
+	return t->busy;
+}
+
+typedef enum {
+	SYS_WORKER_IDLE,	/* waits for timer or trigger */
+	SYS_WORKER_QUEUED,	/* submitted, not started */
+	SYS_WORKER_RUNNING,	/* worker_fn running or finish_fn pending */
+	SYS_WORKER_RERUN,	/* triggered while running, runs once more */
+} sys_worker_state_t;
+
+/* periodic job on a pool, finish_fn runs on eventloop. Triggers while
+ * queued or running are coalesced into at most one more run. With a
+ * timeout, finish_fn gets SYS_JOB_TIMEOUT for a stuck run and for each
+ * start skipped while it is stuck */
+typedef struct {
+	sys_pool_t *pool;
+
 	int interval_ms;
+	int min_interval_ms;	/* least time between starts */
+	uint32_t timeout_ms;	/* 0 for none */
 	sys_worker_fn worker_fn;
-	sys_worker_fn finish_fn;
+	sys_task_done_fn finish_fn;
 	void *arg;
 
+	int state;		/* sys_worker_state_t, pool thread sets RUNNING */
+	wiced_time_t next_start;
 	eventloop_timer_node_t timer_node;
-	eventloop_event_node_t event_node;
-	wiced_worker_thread_t *worker_thread;
+	sys_task_t task;
 } sys_worker_t;
 
+/* runs now, or after min_interval_ms from the last start */
 wiced_result_t a_sys_worker_trigger(sys_worker_t *s);
-wiced_result_t a_sys_worker_init(sys_worker_t *s, wiced_worker_thread_t* worker_thread,
-				 eventloop_t *e, uint32_t event_flag, int interval_ms,
-				 sys_worker_fn worker_fn, sys_worker_fn finish_fn, void *arg);
+wiced_result_t a_sys_worker_init(sys_worker_t *s, sys_pool_t *pool, int interval_ms,
+				 sys_worker_fn worker_fn, sys_task_done_fn finish_fn, void *arg);
 wiced_result_t a_sys_worker_change_inteval(sys_worker_t *s, int interval_ms);
+wiced_result_t a_sys_worker_set_min_interval(sys_worker_t *s, int min_interval_ms);
+wiced_result_t a_sys_worker_set_timeout(sys_worker_t *s, uint32_t timeout_ms);
+static inline wiced_bool_t a_sys_worker_cancelled(sys_worker_t *s)
+{
+	return a_sys_task_cancelled(&s->task);
+}
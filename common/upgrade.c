@@ -9,6 +9,9 @@
 
 #include "app_dct.h"
 #include "upgrade.h"
+#include "ota_delta.h"
+#include "ota_lz.h"
+#include "http_reader.h"
 #include "network.h"
 
 #include "http_stream.h"
@@ -18,39 +21,62 @@
 #include "waf_platform.h"
 
 #define MD5_LENGTH	16
+#define SHA256_LENGTH	32
+#define MAX_DIGEST	SHA256_LENGTH
 
 #define NET_TIMEOUT	60000
 
 #define MAX_FIRMWARE_IMAGE_SIZE 500 * 1024
 
-static const char ref[] = "HTTP/1.";
-static const char cl[] = "Content-Length:";
+/* receive/flash write unit, multiple of sflash sector size */
+#ifndef OTA_CHUNK_SIZE
+#define OTA_CHUNK_SIZE		(4096)
+#endif
+/* 2 for double, 3 for triple buffering */
+#ifndef OTA_N_CHUNK
+#define OTA_N_CHUNK		2
+#endif
+#define OTA_WRITER_STACK	2048
+#define OTA_SECTOR_SIZE		4096
+#define OTA_NO_SECTOR		0xFFFFFFFF
 
-static int _read_line(wiced_tcp_stream_t *stream, char *buf, int max)
-{
-	int i;
-	char c;
+/* progress is saved to DCT at this interval, multiple of OTA_CHUNK_SIZE */
+#ifndef OTA_PROGRESS_INTERVAL
+#define OTA_PROGRESS_INTERVAL	(64 * 1024)
+#endif
+/* app booted before any upgrade. Upgrades go to the app not running,
+ * so the running one stays intact as source of delta images */
+#ifndef OTA_FACTORY_APP_INDEX
+#define OTA_FACTORY_APP_INDEX	DCT_APP0_INDEX
+#endif
+/* concurrent range requests of plain image, 1 for single stream.
+ * each range holds a connection and OTA_N_CHUNK chunks */
+#ifndef OTA_RANGES
+#define OTA_RANGES		1
+#endif
+#define OTA_MAX_RANGES		4
+#define OTA_RANGE_MIN		(64 * 1024)
+#define OTA_RANGE_LINE		256
+#define OTA_MAX_RETRY		3
+#define OTA_RETRY_DELAY		5000
 
-	for (i = 0; i < max - 1;) {
-		if (wiced_tcp_stream_read(stream, &c, 1, NET_TIMEOUT) != WICED_SUCCESS)
-			return -1;
-
-		if (c == '\r') 
-			/* do nothing */;
-		else if (c == '\n')
-			break;
-		else
-			buf[i++] = c;
-	}
+/* image hash, chosen by length of the expected digest */
+typedef struct {
+	int len;		/* MD5_LENGTH, SHA256_LENGTH or 0 if none */
+	union {
+		md5_context md5;
+		sha2_context sha256;
+	} ctx;
+} ota_hash_t;
 
-	while (c != '\n') {
-		if (wiced_tcp_stream_read(stream, &c, 1, NET_TIMEOUT) != WICED_SUCCESS)
-			return -1;
-	};
+wiced_static_assert(ota_hash_state, sizeof(ota_hash_t) <= OTA_HASH_STATE_SIZE);
+/* head of the body holds either header */
+wiced_static_assert(ota_head, A_DELTA_HEADER_SIZE >= A_LZ_HEADER_SIZE);
+/* writes stay sector aligned, checkpoints fall on chunk ends */
+wiced_static_assert(ota_chunk, OTA_CHUNK_SIZE % OTA_SECTOR_SIZE == 0);
+wiced_static_assert(ota_progress, OTA_PROGRESS_INTERVAL % OTA_CHUNK_SIZE == 0);
 
-	buf[i] = '\0';
-	return i;
-}
+static int ota_ranges = OTA_RANGES;
 
 static void dump_bytes(const uint8_t* bptr, uint32_t len)
 {
@@ -72,101 +98,781 @@ static void dump_bytes(const uint8_t* bptr, uint32_t len)
     printf("\n");
 }
 
-static ota_result_t _get_write_fw(int index, int max, wiced_bool_t use_https, const char* host, uint16_t port,
-				  const char* path, const uint8_t* md5)
+static void _hash_starts(ota_hash_t *h, int len)
+{
+	h->len = len;
+	if (len == SHA256_LENGTH)
+		sha2_starts(&h->ctx.sha256, 0);
+	else if (len == MD5_LENGTH)
+		md5_starts(&h->ctx.md5);
+}
+
+static void _hash_update(ota_hash_t *h, const uint8_t *data, uint32_t len)
+{
+	if (h->len == SHA256_LENGTH)
+		sha2_update(&h->ctx.sha256, (const unsigned char*)data, len);
+	else if (h->len == MD5_LENGTH)
+		md5_update(&h->ctx.md5, (unsigned char*)data, (int32_t)len);
+}
+
+static void _hash_finish(ota_hash_t *h, uint8_t *digest)
+{
+	if (h->len == SHA256_LENGTH)
+		sha2_finish(&h->ctx.sha256, digest);
+	else if (h->len == MD5_LENGTH)
+		md5_finish(&h->ctx.md5, digest);
+}
+
+static void _progress_id(const char *host, const char *path, const uint8_t *digest,
+			 int digest_len, uint8_t *id)
+{
+	md5_context ctx;
+
+	md5_starts(&ctx);
+	md5_update(&ctx, (unsigned char*)host, strlen(host) + 1);
+	md5_update(&ctx, (unsigned char*)path, strlen(path) + 1);
+	if (digest)
+		md5_update(&ctx, (unsigned char*)digest, digest_len);
+	md5_finish(&ctx, id);
+}
+
+static void _progress_load(ota_progress_t *p)
+{
+	wiced_dct_read_with_copy(p, DCT_APP_SECTION, OFFSETOF(app_dct_t, ota), sizeof(*p));
+}
+
+static void _progress_save(const ota_progress_t *p)
+{
+	wiced_dct_write(p, DCT_APP_SECTION, OFFSETOF(app_dct_t, ota), sizeof(*p));
+}
+
+static void _progress_clear(void)
+{
+	ota_progress_t p;
+
+	memset(&p, 0, sizeof(p));
+	_progress_save(&p);
+}
+
+static uint8_t _booted_app(void)
+{
+	uint8_t app = 0;
+
+	wiced_dct_read_with_copy(&app, DCT_APP_SECTION, OFFSETOF(app_dct_t, ota_app), sizeof(app));
+	return app ? (uint8_t)(app - 1) : OTA_FACTORY_APP_INDEX;
+}
+
+static void _booted_app_save(uint8_t index)
+{
+	uint8_t app = (uint8_t)(index + 1);
+
+	wiced_dct_write(&app, DCT_APP_SECTION, OFFSETOF(app_dct_t, ota_app), sizeof(app));
+}
+
+static wiced_bool_t _sector_blank(wiced_app_t *app, uint32_t offset)
+{
+	uint32_t w[64];
+	uint32_t pos;
+	unsigned int i;
+
+	for (pos = 0; pos < OTA_SECTOR_SIZE; pos += sizeof(w)) {
+		if (wiced_framework_app_read_chunk(app, offset + pos, (uint8_t*)w, sizeof(w)) != WICED_SUCCESS)
+			return WICED_FALSE;
+		for (i = 0; i < sizeof(w) / sizeof(w[0]); i++) {
+			if (w[i] != 0xFFFFFFFF)
+				return WICED_FALSE;
+		}
+	}
+	return WICED_TRUE;
+}
+
+/* compare flash with what was just written */
+static wiced_bool_t _verify(wiced_app_t *app, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+	uint8_t b[256];
+	uint32_t n;
+
+	for (; len > 0; offset += n, data += n, len -= n) {
+		n = MIN(len, sizeof(b));
+		if (wiced_framework_app_read_chunk(app, offset, b, n) != WICED_SUCCESS ||
+		    memcmp(b, data, n) != 0)
+			return WICED_FALSE;
+	}
+	return WICED_TRUE;
+}
+
+/* continue hash over flash already verified by the writer */
+static wiced_result_t _hash_flash(wiced_app_t *app, uint32_t offset, uint32_t len, ota_hash_t *h)
+{
+	uint8_t b[256];
+	uint32_t n;
+
+	for (; len > 0; offset += n, len -= n) {
+		n = MIN(len, sizeof(b));
+		if (wiced_framework_app_read_chunk(app, offset, b, n) != WICED_SUCCESS)
+			return WICED_ERROR;
+		_hash_update(h, b, n);
+	}
+	return WICED_SUCCESS;
+}
+
+/* write_chunk erases a sector when the write enters one other than
+ * app->last_erased_sector, so flash is erased sector by sector just
+ * ahead of the write pointer. A blank next sector is marked as erased
+ * to skip it. Its number follows the previous erase, so the first
+ * sector and a jump between fragments are always erased. */
+static wiced_result_t _write_sectors(wiced_app_t *app, const uint8_t *data, uint32_t len)
+{
+	uint32_t n;
+	wiced_result_t r;
+
+	for (; len > 0; data += n, len -= n) {
+		n = MIN(len, OTA_SECTOR_SIZE - app->offset % OTA_SECTOR_SIZE);
+		if (app->offset % OTA_SECTOR_SIZE == 0 && app->last_erased_sector != OTA_NO_SECTOR &&
+		    _sector_blank(app, app->offset))
+			app->last_erased_sector++;
+
+		r = wiced_framework_app_write_chunk(app, data, n);
+		if (r != WICED_SUCCESS)
+			return r;
+	}
+	return WICED_SUCCESS;
+}
+
+typedef struct ota_pipe ota_pipe_t;
+
+typedef struct {
+	ota_pipe_t *pipe;
+	uint8_t *data;
+	uint32_t len;
+} ota_chunk_t;
+
+/* received chunks are written to flash by a worker thread,
+ * so network receive and flash programming overlap */
+struct ota_pipe {
+	wiced_app_t *app;
+	wiced_app_t *source;		/* delta source, NULL if none */
+	ota_progress_t *progress;
+	wiced_bool_t resumable;		/* save progress while writing */
+	ota_hash_t *hash;		/* hash of written data */
+	wiced_worker_thread_t *writer;	/* own or shared with range pipes */
+	wiced_worker_thread_t thread;
+	wiced_semaphore_t free;		/* chunks not queued to writer */
+	wiced_result_t result;
+	wiced_bool_t mismatch;		/* flash differs from written data */
+	wiced_mutex_t flash;		/* writer and delta source reads */
+	ota_chunk_t chunk[OTA_N_CHUNK];
+	ota_chunk_t *cur;		/* being filled, NULL if none */
+	int next;
+};
+
+/* each chunk is read back right after write, and hashed after
+ * that, so saved hash state always matches flash */
+static wiced_result_t _pipe_write(void *arg)
+{
+	ota_chunk_t *c = arg;
+	ota_pipe_t *p = c->pipe;
+	ota_progress_t *pr = p->progress;
+
+	wiced_rtos_lock_mutex(&p->flash);
+	if (p->result == WICED_SUCCESS)
+		p->result = _write_sectors(p->app, c->data, c->len);
+	if (p->result == WICED_SUCCESS && !_verify(p->app, pr->offset, c->data, c->len)) {
+		p->mismatch = WICED_TRUE;
+		p->result = WICED_ERROR;
+	}
+	wiced_rtos_unlock_mutex(&p->flash);
+	if (p->result == WICED_SUCCESS) {
+		_hash_update(p->hash, c->data, c->len);
+		pr->offset += c->len;
+		if (p->resumable && pr->offset % OTA_PROGRESS_INTERVAL == 0 && pr->offset < pr->len) {
+			memcpy(pr->hash_state, p->hash, sizeof(*p->hash));
+			_progress_save(pr);
+		}
+	}
+	wiced_rtos_set_semaphore(&p->free);
+	return WICED_SUCCESS;
+}
+
+/* writer is the thread of another pipe, or NULL to create one.
+ * Own thread queues chunks of all range pipes sharing it, so flash
+ * is accessed from one thread only */
+static wiced_result_t _pipe_init(ota_pipe_t *p, wiced_app_t *app, ota_progress_t *progress,
+				 ota_hash_t *hash, wiced_worker_thread_t *writer)
 {
 	int i;
-	int len;
-	uint8_t calc_md5[MD5_LENGTH+1];
-	uint8_t verify_md5[MD5_LENGTH+1];
-	md5_context md5_ctx;
+	uint8_t *data;
 
-	uint32_t count  = 0;
-	wiced_ip_address_t host_ip;
+	memset(p, 0, sizeof(*p));
+	data = malloc(OTA_CHUNK_SIZE * OTA_N_CHUNK);
+	if (data == NULL)
+		return WICED_OUT_OF_HEAP_SPACE;
+
+	p->writer = writer;
+	if (writer == NULL) {
+		if (wiced_rtos_create_worker_thread(&p->thread, WICED_DEFAULT_WORKER_PRIORITY, OTA_WRITER_STACK,
+						    OTA_N_CHUNK * OTA_MAX_RANGES) != WICED_SUCCESS) {
+			free(data);
+			return WICED_ERROR;
+		}
+		p->writer = &p->thread;
+	}
+
+	p->app = app;
+	p->progress = progress;
+	p->resumable = WICED_TRUE;
+	p->hash = hash;
+	wiced_rtos_init_mutex(&p->flash);
+	wiced_rtos_init_semaphore(&p->free);
+	for (i = 0; i < OTA_N_CHUNK; i++) {
+		p->chunk[i].pipe = p;
+		p->chunk[i].data = data + i * OTA_CHUNK_SIZE;
+		wiced_rtos_set_semaphore(&p->free);
+	}
+	return WICED_SUCCESS;
+}
+
+/* room in the chunk being filled, NULL if writer failed */
+static uint8_t * _pipe_room(ota_pipe_t *p, uint32_t *room)
+{
+	ota_chunk_t *c = p->cur;
+
+	if (c == NULL) {
+		/* chunks are written in order, next one is freed first */
+		wiced_rtos_get_semaphore(&p->free, WICED_WAIT_FOREVER);
+		c = p->cur = &p->chunk[p->next];
+		p->next = (p->next + 1) % OTA_N_CHUNK;
+		c->len = 0;
+	}
+	if (p->result != WICED_SUCCESS)
+		return NULL;
+	*room = OTA_CHUNK_SIZE - c->len;
+	return c->data + c->len;
+}
+
+static void _pipe_submit(ota_pipe_t *p)
+{
+	ota_chunk_t *c = p->cur;
+
+	p->cur = NULL;
+	if (wiced_rtos_send_asynchronous_event(p->writer, _pipe_write, c) != WICED_SUCCESS) {
+		p->result = WICED_ERROR;
+		wiced_rtos_set_semaphore(&p->free);
+	}
+}
+
+/* n bytes are filled at _pipe_room() */
+static void _pipe_commit(ota_pipe_t *p, uint32_t n)
+{
+	p->cur->len += n;
+	if (p->cur->len == OTA_CHUNK_SIZE)
+		_pipe_submit(p);
+}
+
+static wiced_result_t _pipe_put(ota_pipe_t *p, const uint8_t *data, uint32_t len)
+{
+	uint8_t *dst;
+	uint32_t n;
+
+	for (; len > 0; data += n, len -= n) {
+		if ((dst = _pipe_room(p, &n)) == NULL)
+			return p->result;
+		n = MIN(n, len);
+		memcpy(dst, data, n);
+		_pipe_commit(p, n);
+	}
+	return WICED_SUCCESS;
+}
+
+/* wait until queued chunks are written, returns write result.
+ * partially filled chunk is written only if flush */
+static wiced_result_t _pipe_deinit(ota_pipe_t *p, wiced_bool_t flush)
+{
+	int i;
+
+	if (p->cur) {
+		if (flush && p->cur->len > 0 && p->result == WICED_SUCCESS) {
+			_pipe_submit(p);
+		} else {
+			p->cur = NULL;
+			wiced_rtos_set_semaphore(&p->free);
+		}
+	}
+	for (i = 0; i < OTA_N_CHUNK; i++)
+		wiced_rtos_get_semaphore(&p->free, WICED_WAIT_FOREVER);
+	if (p->writer == &p->thread)
+		wiced_rtos_delete_worker_thread(&p->thread);
+	wiced_rtos_deinit_semaphore(&p->free);
+	wiced_rtos_deinit_mutex(&p->flash);
+	free(p->chunk[0].data);
+	return p->result;
+}
+
+/* source is read on the receiving thread while the writer programs
+ * the same sflash, so both hold the pipe flash lock */
+static int _delta_read(void *arg, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+	ota_pipe_t *p = arg;
+	wiced_result_t r;
+
+	wiced_rtos_lock_mutex(&p->flash);
+	r = wiced_framework_app_read_chunk(p->source, offset, buf, len);
+	wiced_rtos_unlock_mutex(&p->flash);
+	return r == WICED_SUCCESS ? 0 : -1;
+}
+
+/* delta must be made from the image in the source app */
+static wiced_bool_t _delta_source_ok(uint8_t index, a_delta_t *d)
+{
 	wiced_app_t app;
-	char *buf = NULL;
+	ota_hash_t h;
+	uint8_t calc[SHA256_LENGTH];
+	uint32_t size = 0;
+	wiced_result_t r;
 
-	wiced_tcp_socket_t socket;
-	wiced_tls_context_t context;
-	wiced_tcp_stream_t stream;
+	if (wiced_framework_app_open(index, &app) != WICED_SUCCESS)
+		return WICED_FALSE;
+	wiced_framework_app_get_size(&app, &size);
+	r = WICED_ERROR;
+	if (d->source_len <= size) {
+		_hash_starts(&h, SHA256_LENGTH);
+		r = _hash_flash(&app, 0, d->source_len, &h);
+	}
+	wiced_framework_app_close(&app);
+	if (r != WICED_SUCCESS)
+		return WICED_FALSE;
+	_hash_finish(&h, calc);
+	return memcmp(calc, d->source_hash, sizeof(calc)) == 0 ? WICED_TRUE : WICED_FALSE;
+}
 
-	ota_result_t ota_result = OTA_FAILURE;
+static int _delta_write(void *arg, const uint8_t *buf, uint32_t len)
+{
+	return _pipe_put(arg, buf, len) == WICED_SUCCESS ? 0 : -1;
+}
 
-	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "OTA server : %s \n", host);
+static int _lz_write(void *arg, const uint8_t *buf, uint32_t len)
+{
+	return _pipe_put(arg, buf, len) == WICED_SUCCESS ? 0 : -1;
+}
 
-	while (wiced_hostname_lookup(host, &host_ip, NET_TIMEOUT,
-				     WICED_STA_INTERFACE) != WICED_SUCCESS) {
-		if (++count >= 2) {
-			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Unable to find a host %s\n", host);
-			ota_result = OTA_FAIL_TO_LOOKUP_HOSTNAME;
-			goto return_error;
+/* body filters, return 0 on success */
+typedef int (*ota_filter_fn)(void *arg, const uint8_t *data, size_t len);
+
+static int _delta_filter(void *arg, const uint8_t *data, size_t len)
+{
+	return a_delta_apply(arg, data, len) == DELTA_OK ? 0 : -1;
+}
+
+static int _lz_filter(void *arg, const uint8_t *data, size_t len)
+{
+	return a_lz_apply(arg, data, len) == LZ_OK ? 0 : -1;
+}
+
+/* read len bytes of body, or until its end if len < 0. Plain image is
+ * copied into chunks, otherwise received packets go through filter */
+static ota_result_t _recv_body(ota_pipe_t *p, a_http_reader_t *reader, int len,
+			       ota_filter_fn filter, void *filter_arg)
+{
+	int pos, n;
+	uint32_t room;
+	uint8_t *dst;
+	const uint8_t *data;
+
+	for (pos = 0; len < 0 || pos < len; pos += n) {
+		if (filter) {
+			n = a_http_next_body(reader, &data, len < 0 ? 0xFFFFFFFF : (uint32_t)(len - pos));
+		} else {
+			if ((dst = _pipe_room(p, &room)) == NULL)
+				return OTA_FAIL_TO_WRITE_FLASH;
+			n = a_http_read_body(reader, dst, MIN((uint32_t)(len - pos), room));
+		}
+
+		if (n == 0 && len < 0)
+			break;
+		if (n <= 0) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to read http at %d\n", pos);
+			return OTA_FAIL_TO_RECV_BINARY;
+		}
+		wiced_log_msg(WLF_DEF, WICED_LOG_DEBUG0, "Read %d\n", pos);
+
+		if (filter == NULL) {
+			_pipe_commit(p, (uint32_t)n);
+		} else if ((*filter)(filter_arg, data, (size_t)n) != 0) {
+			if (p->result != WICED_SUCCESS)
+				return OTA_FAIL_TO_WRITE_FLASH;
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad image at %d\n", pos);
+			return OTA_FAIL_BY_BAD_IMAGE;
 		}
 	}
-	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Upgrade Server %s -> %08x\n", host, (unsigned int)host_ip.ip.v4);
-	
-	if (wiced_tcp_create_socket(&socket, WICED_STA_INTERFACE) != WICED_SUCCESS) {
+	return OTA_SUCCESS;
+}
+
+/* one HTTP connection to the server */
+typedef struct {
+	wiced_tcp_socket_t socket;
+	wiced_tls_context_t context;
+	wiced_tcp_stream_t stream;
+	wiced_bool_t use_tls;
+} ota_conn_t;
+
+static ota_result_t _conn_open(ota_conn_t *c, wiced_bool_t use_tls,
+			       const wiced_ip_address_t *ip, uint16_t port)
+{
+	ota_result_t ota_result;
+
+	c->use_tls = use_tls;
+	if (wiced_tcp_create_socket(&c->socket, WICED_STA_INTERFACE) != WICED_SUCCESS) {
 		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Create Socket Error\n");
-		ota_result = OTA_FAIL_TO_CREATE_SOCKET;
-		goto return_error;
+		return OTA_FAIL_TO_CREATE_SOCKET;
 	}
 
-	if (use_https) {
-		wiced_tls_init_context(&context, NULL, "*.humminglab.is");
-		wiced_tcp_enable_tls(&socket, &context);
+	if (use_tls) {
+		wiced_tls_init_context(&c->context, NULL, "*.humminglab.is");
+		wiced_tcp_enable_tls(&c->socket, &c->context);
 	}
 
-	if (wiced_tcp_connect(&socket, &host_ip, port, NET_TIMEOUT) != WICED_SUCCESS) {
+	if (wiced_tcp_connect(&c->socket, ip, port, NET_TIMEOUT) != WICED_SUCCESS) {
 		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to connect to server\n");
 		ota_result = OTA_FAIL_TO_CONNECT_TO_SERVER;
-		goto return_error_with_socket;
+		goto return_error;
 	}
 
-	if (wiced_tcp_stream_init(&stream, &socket) != WICED_SUCCESS) {
+	if (wiced_tcp_stream_init(&c->stream, &c->socket) != WICED_SUCCESS) {
 		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to create tcp stream\n");
 		ota_result = OTA_FAIL_TO_CREATE_TCP_STREAM;
-		goto return_error_with_socket;
+		goto return_error;
 	}
+	return OTA_SUCCESS;
+
+return_error:
+	wiced_tcp_delete_socket(&c->socket);
+	if (use_tls)
+		wiced_tls_deinit_context(&c->context);
+	return ota_result;
+}
+
+static void _conn_close(ota_conn_t *c)
+{
+	wiced_tcp_stream_deinit(&c->stream);
+	wiced_tcp_delete_socket(&c->socket);
+	if (c->use_tls)
+		wiced_tls_deinit_context(&c->context);
+}
+
+/* GET path from offset to the end. With if_range, server sends the
+ * whole image with 200 if it changed */
+static ota_result_t _conn_get(ota_conn_t *c, const char *host, const char *path, uint32_t from,
+			      const char *if_range)
+{
+	char range[32];
+	int i;
 
-	/* send req */
 	{
 		static const char s[] = "GET ";
-		wiced_tcp_stream_write(&stream, s, sizeof(s) - 1);
+		wiced_tcp_stream_write(&c->stream, s, sizeof(s) - 1);
 	}
-
-	if (path) {
-		wiced_tcp_stream_write(&stream, path, strlen(path));
-	} else {
-		ota_result = OTA_FAILURE;
-		goto return_error_with_socket; 
-	}
-
+	wiced_tcp_stream_write(&c->stream, path, strlen(path));
 	{
 		static const char s[] = " HTTP/1.1\r\nHost: ";
-		wiced_tcp_stream_write(&stream, s, sizeof(s) - 1);
+		wiced_tcp_stream_write(&c->stream, s, sizeof(s) - 1);
+	}
+	wiced_tcp_stream_write(&c->stream, host, strlen(host));
+	if (from) {
+		i = snprintf(range, sizeof(range), "\r\nRange: bytes=%lu-", (unsigned long)from);
+		wiced_tcp_stream_write(&c->stream, range, (uint32_t)i);
+		if (if_range && *if_range) {
+			static const char s[] = "\r\nIf-Range: ";
+			wiced_tcp_stream_write(&c->stream, s, sizeof(s) - 1);
+			wiced_tcp_stream_write(&c->stream, if_range, strlen(if_range));
+		}
 	}
-	wiced_tcp_stream_write(&stream, host, strlen(host));
 	{
 		static const char s[] = "\r\nConnection: close\r\n\r\n";
-		wiced_tcp_stream_write(&stream, s, sizeof(s) - 1);
+		wiced_tcp_stream_write(&c->stream, s, sizeof(s) - 1);
 	}
-	if (wiced_tcp_stream_flush(&stream) != WICED_SUCCESS) {
+	if (wiced_tcp_stream_flush(&c->stream) != WICED_SUCCESS) {
 		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to send HTTP request\n");
-		ota_result = OTA_FAIL_TO_SEND_HTTP_REQUEST;
-		goto return_error_with_stream;
+		return OTA_FAIL_TO_SEND_HTTP_REQUEST;
 	}
+	return OTA_SUCCESS;
+}
 
-	/* read */
+/* extra range of parallel download, range 0 is the first connection */
+typedef struct {
+	ota_conn_t conn;
+	a_http_reader_t reader;
+	char line[OTA_RANGE_LINE];
+	wiced_app_t app;
+	ota_progress_t progress;	/* write offset of the range */
+	ota_hash_t hash;		/* none, hashed from flash later */
+	ota_pipe_t pipe;
+} ota_range_t;
+
+/* response headers the download depends on */
+typedef struct {
+	wiced_bool_t accept_ranges;
+	char validator[OTA_VALIDATOR_SIZE];	/* strong ETag, else Last-Modified */
+} ota_resp_t;
+
+static void _resp_header(void *arg, const char *name, const char *value)
+{
+	ota_resp_t *r = arg;
+	size_t n = strlen(value);
+
+	if (strcasecmp(name, "Accept-Ranges") == 0 && strcasecmp(value, "bytes") == 0) {
+		r->accept_ranges = WICED_TRUE;
+	} else if (n >= sizeof(r->validator)) {
+		return;
+	} else if (strcasecmp(name, "ETag") == 0) {
+		/* If-Range takes no weak ETag */
+		if (value[0] == '"')
+			memcpy(r->validator, value, n + 1);
+	} else if (strcasecmp(name, "Last-Modified") == 0) {
+		if (r->validator[0] != '"')
+			memcpy(r->validator, value, n + 1);
+	}
+}
+
+/* request image from offset to the end, part past the range is
+ * dropped by closing the connection. Range pipe shares the writer
+ * thread of first, sectors of the range are erased as it goes */
+static ota_result_t _range_open(ota_range_t *r, ota_pipe_t *first, wiced_bool_t use_tls,
+				const wiced_ip_address_t *ip, uint16_t port,
+				const char *host, const char *path, uint32_t from, uint32_t total,
+				const char *if_range)
+{
+	ota_result_t ota_result;
+
+	ota_result = _conn_open(&r->conn, use_tls, ip, port);
+	if (ota_result != OTA_SUCCESS)
+		return ota_result;
+
+	a_http_reader_init(&r->reader, &r->conn.socket, r->line, sizeof(r->line), NET_TIMEOUT);
+	ota_result = _conn_get(&r->conn, host, path, from, if_range);
+	if (ota_result == OTA_SUCCESS &&
+	    (a_http_read_response(&r->reader, NULL, NULL) != WICED_SUCCESS || r->reader.status != 206 ||
+	     r->reader.range_from != from || r->reader.range_total != total)) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad response for range at %lu\n", (unsigned long)from);
+		ota_result = OTA_FAIL_BY_BAD_HTTP_RESPONSE;
+	}
+
+	if (ota_result == OTA_SUCCESS) {
+		r->app = *first->app;
+		r->app.offset = from;
+		r->app.last_erased_sector = OTA_NO_SECTOR;
+		memset(&r->progress, 0, sizeof(r->progress));
+		r->progress.offset = from;
+		r->progress.len = total;
+		_hash_starts(&r->hash, 0);
+		if (_pipe_init(&r->pipe, &r->app, &r->progress, &r->hash, first->writer) != WICED_SUCCESS)
+			ota_result = OTA_FAILURE;
+		r->pipe.resumable = WICED_FALSE;
+	}
+
+	if (ota_result != OTA_SUCCESS) {
+		a_http_reader_deinit(&r->reader);
+		_conn_close(&r->conn);
+	}
+	return ota_result;
+}
+
+/* plain image over the first connection and extra range requests at
+ * once, each range is written at its own offset. Ranges are chunk
+ * aligned so no flash sector is shared.
+ *
+ * MD5/SHA-256 state can not be merged, so the first range keeps hash
+ * and progress in order and the rest is hashed from flash afterwards,
+ * from *split. If a range fails to open, the one before takes its part.
+ */
+static ota_result_t _recv_ranges(ota_pipe_t *first, a_http_reader_t *reader, int len, int head_len,
+				 wiced_bool_t use_tls, const wiced_ip_address_t *ip, uint16_t port,
+				 const char *host, const char *path, const char *if_range, uint32_t *split)
+{
+	ota_range_t *range;
+	ota_pipe_t *pipe[OTA_MAX_RANGES];
+	a_http_reader_t *rd[OTA_MAX_RANGES];
+	uint32_t left[OTA_MAX_RANGES];
+	uint32_t size, room;
+	uint8_t *dst;
+	wiced_time_t now, last;
+	wiced_bool_t active, got;
+	ota_result_t ota_result = OTA_SUCCESS;
+	int i, n, k;
+
+	n = MIN(MIN(ota_ranges, OTA_MAX_RANGES), len / OTA_RANGE_MIN);
+	size = ((uint32_t)len / n + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE * OTA_CHUNK_SIZE;
+	range = malloc(sizeof(*range) * (n - 1));
+	if (range == NULL)
+		n = 1;
+
+	pipe[0] = first;
+	rd[0] = reader;
+	for (i = 1; i < n; i++) {
+		if (_range_open(&range[i - 1], first, use_tls, ip, port, host, path,
+				i * size, (uint32_t)len, if_range) != OTA_SUCCESS)
+			break;
+		pipe[i] = &range[i - 1].pipe;
+		rd[i] = &range[i - 1].reader;
+	}
+	n = i;
+	for (i = 0; i < n; i++)
+		left[i] = (i == n - 1) ? (uint32_t)len - i * size : size;
+	left[0] -= (uint32_t)head_len;
+	*split = (n > 1) ? size : (uint32_t)len;
+	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Download in %d ranges\n", n);
+
+	/* readers are polled, idle ones are not waited for */
+	for (i = 0; i < n; i++)
+		rd[i]->timeout = WICED_NO_WAIT;
+
+	wiced_time_get_time(&last);
+	do {
+		active = got = WICED_FALSE;
+		for (i = 0; i < n && ota_result == OTA_SUCCESS; i++) {
+			if (left[i] == 0)
+				continue;
+			active = WICED_TRUE;
+			if ((dst = _pipe_room(pipe[i], &room)) == NULL) {
+				ota_result = OTA_FAIL_TO_WRITE_FLASH;
+				break;
+			}
+			k = a_http_read_body(rd[i], dst, MIN(left[i], room));
+			if (k == A_HTTP_AGAIN)
+				continue;
+			if (k <= 0) {
+				wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to read range %d\n", i);
+				ota_result = OTA_FAIL_TO_RECV_BINARY;
+				break;
+			}
+			_pipe_commit(pipe[i], (uint32_t)k);
+			left[i] -= (uint32_t)k;
+			got = WICED_TRUE;
+		}
+
+		wiced_time_get_time(&now);
+		if (got) {
+			last = now;
+		} else if (active && ota_result == OTA_SUCCESS) {
+			if (now - last > NET_TIMEOUT) {
+				wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Ranges timed out\n");
+				ota_result = OTA_FAIL_TO_RECV_BINARY;
+			}
+			wiced_rtos_delay_milliseconds(1);
+		}
+	} while (active && ota_result == OTA_SUCCESS);
+	reader->timeout = NET_TIMEOUT;
+
+	for (i = 1; i < n; i++) {
+		if (_pipe_deinit(pipe[i], ota_result == OTA_SUCCESS) != WICED_SUCCESS) {
+			if (pipe[i]->mismatch)
+				ota_result = OTA_FAIL_MD5_VALIDATION_WRITING;
+			else if (ota_result == OTA_SUCCESS)
+				ota_result = OTA_FAIL_TO_WRITE_FLASH;
+		}
+		a_http_reader_deinit(rd[i]);
+		_conn_close(&range[i - 1].conn);
+	}
+	if (range)
+		free(range);
+	return ota_result;
+}
+
+/* image is written to app index, delta is applied to app source */
+static ota_result_t _get_write_fw(int index, int source_index, int max, wiced_bool_t use_https,
+				  const char* host, uint16_t port,
+				  const char* path, const uint8_t* digest, int digest_len)
+{
+	int i;
+	int len;
+	uint8_t calc[MAX_DIGEST];
+	uint8_t id[MD5_LENGTH];
+	ota_hash_t hash;
+	ota_progress_t progress;
+	ota_pipe_t pipe;
+	uint8_t head[A_DELTA_HEADER_SIZE];
+	int head_len;
+	int body;
+	a_delta_t *delta = NULL;
+	a_lz_t *lz = NULL;
+	wiced_app_t source;
+
+	uint32_t count  = 0;
+	wiced_ip_address_t host_ip;
+	wiced_app_t app;
+	char *buf = NULL;
+
+	ota_conn_t conn;
+	a_http_reader_t reader;
+	ota_resp_t resp;
+	uint32_t split = 0;		/* end of the first range, 0 if single */
+
+	ota_result_t ota_result = OTA_FAILURE;
+
+	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "OTA server : %s \n", host);
+
+	if (path == NULL)
+		return OTA_FAILURE;
+
+	/* header line buffer */
 #define _BSIZE (1024)
 	buf = malloc(_BSIZE);
-	i = _read_line(&stream, buf, _BSIZE);
-	if (i < 0 || strncmp(buf, ref, sizeof(ref) - 1) != 0) {
-		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad HTTP response\n");
-		ota_result = OTA_FAIL_BY_BAD_HTTP_RESPONSE;
+	if (buf == NULL)
+		return OTA_FAILURE;
+	a_http_reader_init(&reader, &conn.socket, buf, _BSIZE, NET_TIMEOUT);
+
+	/* resume previous download of the same image. Without a validator
+	 * for If-Range nor the expected hash, a file replaced on the server
+	 * in between would be spliced in */
+	_progress_id(host, path, digest, digest_len, id);
+	_progress_load(&progress);
+	progress.validator[sizeof(progress.validator) - 1] = '\0';
+	if (progress.len == 0 || progress.offset >= progress.len ||
+	    memcmp(progress.id, id, sizeof(id)) != 0 ||
+	    (progress.validator[0] == '\0' && digest == NULL))
+		progress.offset = 0;
+	memset(&resp, 0, sizeof(resp));
+
+	while (wiced_hostname_lookup(host, &host_ip, NET_TIMEOUT,
+				     WICED_STA_INTERFACE) != WICED_SUCCESS) {
+		if (++count >= 2) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Unable to find a host %s\n", host);
+			ota_result = OTA_FAIL_TO_LOOKUP_HOSTNAME;
+			goto return_error;
+		}
+	}
+	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Upgrade Server %s -> %08x\n", host, (unsigned int)host_ip.ip.v4);
+	
+	ota_result = _conn_open(&conn, use_https, &host_ip, port);
+	if (ota_result != OTA_SUCCESS)
+		goto return_error;
+
+	ota_result = _conn_get(&conn, host, path, progress.offset, progress.validator);
+	if (ota_result != OTA_SUCCESS)
+		goto return_error_with_stream;
+	/* failures below without their own result must not look like success */
+	ota_result = OTA_FAILURE;
+
+	/* read */
+	if (a_http_read_response(&reader, _resp_header, &resp) != WICED_SUCCESS) {
+		if (reader.status == 0) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad HTTP response\n");
+			ota_result = OTA_FAIL_BY_BAD_HTTP_RESPONSE;
+		} else {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to find empty line\n");
+			ota_result = OTA_FAIL_TO_FIND_EMPTY_LINE;
+		}
 		goto return_error_with_stream;
 	}
 
-	i = atoi(buf + sizeof(ref) - 1 + 2);
-	if (i != 200) {
+	i = reader.status;
+	if (i == 206 && progress.offset) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Resume download at %lu\n",
+			      (unsigned long)progress.offset);
+	} else if (i == 200) {
+		if (progress.offset)
+			wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Whole image sent, download from start\n");
+		progress.offset = 0;
+	} else {
 		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "No Upgrade: %d\n", i);
 		if(i == 204) {
 			ota_result = OTA_NO_UPGRADE_204;
@@ -181,25 +887,79 @@ static ota_result_t _get_write_fw(int index, int max, wiced_bool_t use_https, co
 		goto return_with_no_upgrade;
 	}
 
-	len = -1;
-	while ((i = _read_line(&stream, buf, _BSIZE)) > 0) {
-		if (strncasecmp(buf, cl, sizeof(cl) - 1) == 0) {
-			len = atoi(buf + (sizeof(cl) - 1));
-			wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Content-Length: %d\n", len);
+	/* -1 for chunked body, its size is known from image header */
+	len = (int)reader.content_length;
+	if (len >= 0)
+		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Content-Length: %d\n", len);
+
+	/* partial content must continue exactly where we stopped */
+	if (progress.offset) {
+		if (reader.range_total != progress.len || reader.range_from != progress.offset ||
+		    len != (int)(reader.range_total - reader.range_from)) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad Content-Range\n");
+			_progress_clear();
+			ota_result = OTA_FAIL_BY_BAD_HTTP_RESPONSE;
+			goto return_error_with_stream;
 		}
+		len = (int)reader.range_total;
 	}
-	if (len <= 0 || len > max) {
+	if (len == 0 || len > max) {
 		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Content-Length is over max_size: %d\n", max);
 		ota_result = OTA_FAIL_BY_CONTENT_LENGTH_OVER_MAXSIZE;
 		goto return_error_with_stream;
 	}
 
-	/* skip until empty line */
-	while (i > 0)
-		i = _read_line(&stream, buf, _BSIZE);
-	if (i < 0) {
-		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to find empty line\n");
-		ota_result = OTA_FAIL_TO_FIND_EMPTY_LINE;
+	/* delta and compressed images are recognized by their header */
+	body = (len < 0) ? -1 : len - (int)progress.offset;
+	head_len = 0;
+	if (progress.offset == 0 && (body < 0 || body >= A_DELTA_HEADER_SIZE)) {
+		while (head_len < A_DELTA_HEADER_SIZE &&
+		       (i = a_http_read_body(&reader, head + head_len, A_DELTA_HEADER_SIZE - head_len)) > 0)
+			head_len += i;
+		if (i < 0) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to read http at 0\n");
+			ota_result = OTA_FAIL_TO_RECV_BINARY;
+			goto return_error_with_stream;
+		}
+		if (body > 0)
+			body -= head_len;
+	}
+	if (head_len && a_delta_detect(head, (size_t)head_len)) {
+		/* delta output is checked only by the expected hash */
+		if (digest == NULL || (delta = malloc(sizeof(*delta))) == NULL) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Delta needs hash of the result\n");
+			ota_result = OTA_FAIL_BY_BAD_IMAGE;
+			goto return_error_with_stream;
+		}
+		a_delta_init(delta, _delta_read, _delta_write, &pipe);
+		if (a_delta_apply(delta, head, (size_t)head_len) != DELTA_OK || !a_delta_has_header(delta)) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad delta header\n");
+			ota_result = OTA_FAIL_BY_BAD_IMAGE;
+			goto return_error_with_stream;
+		}
+		/* checked before the first erase, a wrong source can not brick */
+		if (!_delta_source_ok((uint8_t)source_index, delta)) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Delta is not made from the running image\n");
+			ota_result = OTA_FAIL_BY_BAD_IMAGE;
+			goto return_error_with_stream;
+		}
+		len = (int)delta->target_len;
+		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Delta image: %d Bytes\n", len);
+	} else if (head_len && a_lz_detect(head, (size_t)head_len)) {
+		if ((lz = malloc(sizeof(*lz))) == NULL)
+			goto return_error_with_stream;
+		a_lz_init(lz, _lz_write, &pipe);
+		if (a_lz_apply(lz, head, (size_t)head_len) != LZ_OK) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Unsupported compression\n");
+			ota_result = OTA_FAIL_BY_BAD_IMAGE;
+			goto return_error_with_stream;
+		}
+		len = (int)lz->image_len;
+		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Compressed image: %d Bytes\n", len);
+	}
+	if (len <= 0 || len > max) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Image is over max_size: %d\n", max);
+		ota_result = OTA_FAIL_BY_CONTENT_LENGTH_OVER_MAXSIZE;
 		goto return_error_with_stream;
 	}
 
@@ -212,75 +972,91 @@ static ota_result_t _get_write_fw(int index, int max, wiced_bool_t use_https, co
 		goto return_error_with_sflash;
 	}
 
-	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Erasing SFlash\n");
-	wiced_framework_app_erase(&app);
+	/* no up-front erase, sectors are erased as the writer reaches them */
+	app.last_erased_sector = OTA_NO_SECTOR;
+	if (progress.offset) {
+		app.offset = progress.offset;
+		memcpy(&hash, progress.hash_state, sizeof(hash));
+	} else {
+		_hash_starts(&hash, digest ? digest_len : 0);
+		progress.len = (uint32_t)len;
+		memcpy(progress.id, id, sizeof(id));
+		memcpy(progress.validator, resp.validator, sizeof(progress.validator));
+		/* forget older checkpoints of this image */
+		_progress_save(&progress);
+	}
 
-	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Start Download Body\n");
-	md5_starts(&md5_ctx);
+	if (_pipe_init(&pipe, &app, &progress, &hash, NULL) != WICED_SUCCESS) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to start flash writer\n");
+		ota_result = OTA_FAIL_TO_WRITE_FLASH;
+		goto return_error_with_sflash;
+	}
 
-	for (i = 0; i < len / _BSIZE; i ++) {
-		wiced_result_t r = wiced_tcp_stream_read(&stream, buf, _BSIZE, NET_TIMEOUT);
-		if (r != WICED_SUCCESS) {
-			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to read http at %d (%d)\n", i * _BSIZE, r);
-			ota_result = OTA_FAIL_TO_RECV_BINARY;
-			goto return_error_with_sflash;
-		}
-		md5_update(&md5_ctx, (unsigned char*)buf, _BSIZE);
-		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Read %d\n", i * _BSIZE);
-		wiced_framework_app_write_chunk(&app, (uint8_t*)buf, _BSIZE);
+	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Start Download Body\n");
+	if (delta) {
+		/* delta output depends on the source, it is not resumed */
+		wiced_framework_app_open((uint8_t)source_index, &source);
+		pipe.source = &source;
+		pipe.resumable = WICED_FALSE;
+		ota_result = _recv_body(&pipe, &reader, body, _delta_filter, delta);
+		wiced_framework_app_close(&source);
+		if (ota_result == OTA_SUCCESS && !a_delta_is_finished(delta))
+			ota_result = OTA_FAIL_BY_BAD_IMAGE;
+	} else if (lz) {
+		/* decoder state is not saved, neither resumed */
+		pipe.resumable = WICED_FALSE;
+		ota_result = _recv_body(&pipe, &reader, body, _lz_filter, lz);
+		if (ota_result == OTA_SUCCESS && !a_lz_is_finished(lz))
+			ota_result = OTA_FAIL_BY_BAD_IMAGE;
+	} else if (_pipe_put(&pipe, head, (uint32_t)head_len) != WICED_SUCCESS) {
+		ota_result = OTA_FAIL_TO_WRITE_FLASH;
+	} else if (ota_ranges > 1 && resp.accept_ranges && reader.status == 200 && len >= 2 * OTA_RANGE_MIN) {
+		/* a range of a changed image comes with 200 and is not used */
+		ota_result = _recv_ranges(&pipe, &reader, len, head_len, use_https, &host_ip, port,
+					  host, path, resp.validator, &split);
+	} else {
+		ota_result = _recv_body(&pipe, &reader, body, NULL, NULL);
 	}
-	
-	i = len % _BSIZE;
-	if (i) {
-		if (wiced_tcp_stream_read(&stream, buf,
-					  (uint16_t)i, NET_TIMEOUT) != WICED_SUCCESS) {
-			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to read http at last block\n");
-			goto return_error_with_sflash;
+	if (_pipe_deinit(&pipe, ota_result == OTA_SUCCESS) != WICED_SUCCESS) {
+		if (pipe.mismatch) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Flash read-back differs\n");
+			ota_result = OTA_FAIL_MD5_VALIDATION_WRITING;
+		} else if (ota_result == OTA_SUCCESS) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to write flash\n");
+			ota_result = OTA_FAIL_TO_WRITE_FLASH;
 		}
-		md5_update(&md5_ctx, (unsigned char*)buf, i);
-		wiced_framework_app_write_chunk(&app, (uint8_t*)buf, (uint32_t)i);
-	}		
+	}
+	if (ota_result == OTA_SUCCESS && split && hash.len &&
+	    _hash_flash(&app, split, (uint32_t)len - split, &hash) != WICED_SUCCESS) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to read flash\n");
+		ota_result = OTA_FAIL_MD5_VALIDATION_WRITING;
+	}
+	if (ota_result != OTA_SUCCESS)
+		goto return_error_with_sflash;
+	_progress_clear();
 	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Download Completed %d Bytes\n", len);
 	wiced_framework_app_close(&app);
-	wiced_tcp_stream_deinit(&stream);
-	wiced_tcp_delete_socket(&socket);
-	if (use_https) {
-		wiced_tls_deinit_context(&context);
-	}
+	a_http_reader_deinit(&reader);
+	_conn_close(&conn);
 
-	md5_finish(&md5_ctx, calc_md5);
-	if (md5) {
-		if (memcmp(md5, calc_md5, MD5_LENGTH) != 0) {
+	/* every chunk is read back by the writer, no second pass */
+	_hash_finish(&hash, calc);
+	if (digest) {
+		if (memcmp(digest, calc, digest_len) != 0) {
 			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad hash value: \n");
-			dump_bytes(calc_md5, MD5_LENGTH);
+			dump_bytes(calc, digest_len);
 			ota_result = OTA_FAIL_MD5_VALIDATION;
 			goto return_error;
 		}
-		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "MD5 hash is verified\n");
+		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "%s hash is verified\n",
+			      digest_len == SHA256_LENGTH ? "SHA256" : "MD5");
 	}
 
-	/* Write verified */
-	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Verifying SFlash writing... \n");
-	md5_starts(&md5_ctx);
-	wiced_framework_app_open((uint8_t)index, &app);
-	for (i = 0; i < len / _BSIZE; i ++) {
-		wiced_framework_app_read_chunk(&app, (uint32_t)i*_BSIZE, (uint8_t*)buf, _BSIZE);
-		md5_update(&md5_ctx, (unsigned char*)buf, _BSIZE);
-	}
-	i = len % _BSIZE;
-	wiced_framework_app_read_chunk(&app, (uint32_t)(len/_BSIZE)*_BSIZE, (uint8_t*)buf, (uint32_t)i);
-	md5_update(&md5_ctx, (unsigned char*)buf, i);
-	md5_finish(&md5_ctx, verify_md5);
-	if (memcmp(verify_md5, calc_md5, MD5_LENGTH) != 0) {
-		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad hash value: \n");
-		dump_bytes(calc_md5, MD5_LENGTH);
-		ota_result = OTA_FAIL_MD5_VALIDATION_WRITING;
-		goto return_error;
-	}
-	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "MD5 hash is verified\n");
-	wiced_framework_app_close(&app);
-
 	free(buf);
+	if (delta)
+		free(delta);
+	if (lz)
+		free(lz);
 	return OTA_SUCCESS;
        
 return_error_with_sflash:
@@ -288,17 +1064,16 @@ return_error_with_sflash:
 
 return_with_no_upgrade:
 return_error_with_stream:
-	wiced_tcp_stream_deinit(&stream);
+	a_http_reader_deinit(&reader);
+	_conn_close(&conn);
 
-return_error_with_socket:
-	wiced_tcp_delete_socket(&socket);
-	if (use_https) {
-		wiced_tls_deinit_context(&context);
-	}
-		
 return_error:
 	if (buf)
 		free(buf);
+	if (delta)
+		free(delta);
+	if (lz)
+		free(lz);
 	return ota_result;
 }
 
@@ -314,49 +1089,69 @@ static int _atoh(char ch)
 		return -1;
 }
 
-static wiced_result_t md5_hex_to_bin(const char* hex, uint8_t *bin)
+/* md5 or sha256 hex digest, returns length or -1 */
+static int hash_hex_to_bin(const char* hex, uint8_t *bin)
 {
-	int i;
-	i = strlen(hex);
+	int i, len;
+	len = strlen(hex) / 2;
 
-	memset(bin, 0, MD5_LENGTH);
-	if (i != MD5_LENGTH*2)
-		return WICED_ERROR;
+	memset(bin, 0, MAX_DIGEST);
+	if ((len != MD5_LENGTH && len != SHA256_LENGTH) || hex[len * 2] != '\0')
+		return -1;
 
-	for (i = 0; i < MD5_LENGTH; i++) {
+	for (i = 0; i < len; i++) {
 		int d1, d2;
 		d1 = _atoh(hex[i * 2]);
 		d2 = _atoh(hex[i * 2 + 1]);
 		if (d1 < 0 || d2 < 0)
-			return WICED_ERROR;
+			return -1;
 
 		bin[i] = (uint8_t)((d1 << 4) + d2);
 	}
-	return WICED_SUCCESS;
+	return len;
+}
+
+void a_upgrade_set_ranges(int n)
+{
+	ota_ranges = (n < 1) ? 1 : MIN(n, OTA_MAX_RANGES);
 }
 
 ota_result_t a_upgrade_try(wiced_bool_t use_tls, const char *host, uint16_t port,
-			   const char *path, const char *md5_hex, wiced_bool_t no_reboot)
+			   const char *path, const char *hash_hex, wiced_bool_t no_reboot)
 {
 	ota_result_t ota_result;
-	uint8_t md5_bin[MD5_LENGTH];
+	uint8_t digest[MAX_DIGEST];
+	int digest_len = 0;
+	int retry;
+	uint8_t booted, target;
 
 	if (!a_network_is_up())
 		return WICED_FALSE;
 
-	if (md5_hex) {
-		if (md5_hex_to_bin(md5_hex, md5_bin) < 0) {
-			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad MD5 hexdigit format");
+	if (hash_hex) {
+		if ((digest_len = hash_hex_to_bin(hash_hex, digest)) < 0) {
+			wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Bad MD5/SHA256 hexdigit format");
 			return WICED_FALSE;
 		}
 	}
 		
-	ota_result = _get_write_fw(DCT_FR_APP_INDEX, MAX_FIRMWARE_IMAGE_SIZE, use_tls,
-				   host, port, path, md5_hex ? md5_bin : NULL);
+	booted = _booted_app();
+	target = (booted == DCT_FR_APP_INDEX) ? OTA_FACTORY_APP_INDEX : DCT_FR_APP_INDEX;
+
+	/* broken download continues from the last saved progress */
+	for (retry = 0; ; retry++) {
+		ota_result = _get_write_fw(target, booted, MAX_FIRMWARE_IMAGE_SIZE, use_tls,
+					   host, port, path, hash_hex ? digest : NULL, digest_len);
+		if (ota_result != OTA_FAIL_TO_RECV_BINARY || retry >= OTA_MAX_RETRY)
+			break;
+		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Retry download (%d)\n", retry + 1);
+		wiced_rtos_delay_milliseconds(OTA_RETRY_DELAY);
+	}
 	if (ota_result == OTA_SUCCESS) {
 		uint32_t ms = 3000;
 		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Upgrade completed");
-		wiced_framework_set_boot(DCT_FR_APP_INDEX, PLATFORM_DEFAULT_LOAD);
+		_booted_app_save(target);
+		wiced_framework_set_boot(target, PLATFORM_DEFAULT_LOAD);
 		if (no_reboot)
 			return OTA_SUCCESS;
 		
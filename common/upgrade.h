@@ -19,10 +19,16 @@ typedef enum {
 	OTA_FAIL_TO_FIND_EMPTY_LINE,
 	OTA_FAIL_BY_BINARY_OVER_FLASHSIZE,
 	OTA_FAIL_TO_RECV_BINARY,
-	OTA_FAIL_MD5_VALIDATION,
-	OTA_FAIL_MD5_VALIDATION_WRITING,
+	OTA_FAIL_MD5_VALIDATION,		/* md5 or sha256 of image */
+	OTA_FAIL_MD5_VALIDATION_WRITING,	/* flash read-back differs */
+	OTA_FAIL_TO_WRITE_FLASH,
+	OTA_FAIL_BY_BAD_IMAGE,		/* broken delta or compressed image */
 } ota_result_t;
 
+/* hash_hex is md5 (32 digits) or sha256 (64 digits) of the image, or NULL */
 ota_result_t a_upgrade_try(wiced_bool_t use_tls, const char *host, uint16_t port,
-			   const char *path, const char *md5_hex, wiced_bool_t no_reboot);
+			   const char *path, const char *hash_hex, wiced_bool_t no_reboot);
 
+/* plain image is fetched as n concurrent range requests when server
+ * accepts ranges, 1 (default) for single stream */
+void a_upgrade_set_ranges(int n);
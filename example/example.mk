@@ -12,6 +12,11 @@ $(NAME)_SOURCES    := main.c \
 			$(COMMON)/sys_mqtt.c \
 			$(COMMON)/sys_worker.c \
 			$(COMMON)/json_parser.c \
+			$(COMMON)/json_rpc.c \
+			$(COMMON)/http_reader.c \
+			$(COMMON)/upgrade.c \
+			$(COMMON)/ota_delta.c \
+			$(COMMON)/ota_lz.c \
 			$(COMMON)/device.c
 
 GLOBAL_INCLUDES += $(COMMON)
@@ -29,17 +29,26 @@
 #include "sys_worker.h"
 #include "util.h"
 #include "json_parser.h"
+#include "json_rpc.h"
 #include "device.h"
 
 #define MAX_FAULT_PORT		4
 
-#define EVENT_SENSOR_FINISHED		(1 << 0)
+#define EVENT_POOL_DONE			(1 << 0)
 #define EVENT_FAULT1_DET		(1 << 1)
 #define EVENT_FAULT2_DET		(1 << 2)
 #define EVENT_FAULT3_DET		(1 << 3)
 #define EVENT_FAULT4_DET		(1 << 4)
+#define EVENT_RPC			(1 << 5)
 
 #define SENSING_INTERVAL		(10 * 1000)
+#define SENSING_MIN_INTERVAL		(1 * 1000)
+#define SENSING_TIMEOUT			(3 * 1000)
+
+#define RPC_REQUEST			"/rpc/request/"
+#define RPC_RESPONSE			"/rpc/response/"
+#define MAX_TOPIC			128
+#define MAX_RPC_MSG			512
 
 #define QUOTE(str) #str
 #define EXPAND_AND_QUOTE(str) QUOTE(str)
@@ -90,8 +99,9 @@ static sys_led_t led;
 static sys_pwm_t pwm;
 static sys_button_t button;
 static sys_mqtt_t mqtt;
+static sys_pool_t pool;
 static sys_worker_t worker;
-static wiced_worker_thread_t worker_thread;
+static a_json_rpc_t rpc;
 
 static char server[MAX_SERVER_NAME];
 static char device_token[MAX_DEVICE_TOKEN];
@@ -105,6 +115,18 @@ static int temp;
 static int humid;
 
 static eventloop_timer_node_t timer_node;
+static eventloop_event_node_t rpc_event_node;
+
+/* request from the MQTT thread, handled on eventloop. One at a time,
+ * busy until handled */
+static struct {
+	char topic[MAX_TOPIC];
+	uint32_t topic_len;
+	char data[MAX_RPC_MSG];
+	uint32_t data_len;
+	a_json_rpc_err_t err;	/* data did not fit */
+	int busy;
+} rpc_msg;
 
 void a_app_net_init(void) {
 	app_dct_t* dct;
@@ -166,39 +188,105 @@ static void update_led(void)
 	a_sys_worker_trigger(&worker);
 }
 
-static void mqtt_subscribe_cb_fn(sys_mqtt_t *s, wiced_mqtt_topic_msg_t *msg, void *arg)
+static void rpc_emergency(void *arg, a_json_t *json, const int32_t *v)
 {
-	a_json_t json;
-	int entry[10];
-	const char* val;
+	wiced_bool_t on = v[0] ? WICED_TRUE : WICED_FALSE;
+	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Emergency: %s\n", on ? "ON" : "OFF");
+	if (on != state_led_emergency) {
+		state_led_emergency = on;
+		update_led();
+	}
+}
 
-	if (!a_sys_mqtt_is_rpc_topic(msg))
+static void rpc_led(void *arg, a_json_t *json, const int32_t *v)
+{
+	wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "LED: %d\n", (int)v[0]);
+	if (v[0] != state_led_on_level) {
+		state_led_on_level = v[0];
+		update_led();
+	}
+}
+
+static const a_json_rpc_param_t rpc_emergency_params[] = {
+	{ "params", JSON_RPC_BOOL },
+};
+
+static const a_json_rpc_param_t rpc_led_params[] = {
+	{ "params", JSON_RPC_INT, 0, 100 },
+};
+
+static const a_json_rpc_method_t rpc_methods[] = {
+	{ "emergency", rpc_emergency, rpc_emergency_params, N_ELEMENT(rpc_emergency_params) },
+	{ "led", rpc_led, rpc_led_params, N_ELEMENT(rpc_led_params) },
+};
+
+/* ".../rpc/request/$id" is answered on ".../rpc/response/$id" */
+static void rpc_reply(const char *t, uint32_t len, char *reply)
+{
+	uint32_t n = sizeof(RPC_REQUEST) - 1;
+	uint32_t i;
+	char topic[MAX_TOPIC];
+	int r;
+
+	for (i = 0; i + n <= len; i++) {
+		if (memcmp(t + i, RPC_REQUEST, n) == 0)
+			break;
+	}
+	if (i + n > len)
+		return;
+
+	r = snprintf(topic, sizeof(topic), "%.*s" RPC_RESPONSE "%.*s",
+		     (int)i, t, (int)(len - i - n), t + i + n);
+	if (r < 0 || (size_t)r >= sizeof(topic))
+		return;
+	a_sys_mqtt_publish(&mqtt, topic, reply, strlen(reply), 0, WICED_FALSE);
+}
+
+static void rpc_event_fn(void *arg)
+{
+	a_json_rpc_err_t err;
+	char reply[80];
+
+	if (!__atomic_load_n(&rpc_msg.busy, __ATOMIC_ACQUIRE))
 		return;
 
-	a_json_init(&json, (char*)msg->data, msg->data_len, entry, N_ELEMENT(entry), '\0');
-	a_json_append_str_sized(&json, (char*)msg->data, msg->data_len);
-	if (!a_json_is_good(&json))
+	err = rpc_msg.err;
+	if (err == JSON_RPC_OK)
+		err = a_json_rpc_dispatch(&rpc, rpc_msg.data, rpc_msg.data_len, NULL);
+	if (err != JSON_RPC_OK) {
+		a_json_rpc_format_error(reply, sizeof(reply), err);
+		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "RPC: %s\n", reply);
+		rpc_reply(rpc_msg.topic, rpc_msg.topic_len, reply);
+	}
+	__atomic_store_n(&rpc_msg.busy, 0, __ATOMIC_RELEASE);
+}
+
+/* on the MQTT thread, handlers and publish run on eventloop only */
+static void mqtt_subscribe_cb_fn(sys_mqtt_t *s, wiced_mqtt_topic_msg_t *msg, void *arg)
+{
+	if (!a_sys_mqtt_is_rpc_topic(msg))
 		return;
 
-	val = a_json_get_prop(&json, "method");
-	if (!val)
+	if (__atomic_load_n(&rpc_msg.busy, __ATOMIC_ACQUIRE)) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_WARNING, "RPC: busy, request dropped\n");
+		return;
+	}
+	if (msg->topic_len > sizeof(rpc_msg.topic)) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "RPC: topic too long\n");
 		return;
-	
-	if (strcmp(val, "emergency") == 0) {
-		int v = a_json_get_prop_int(&json, "params", 0, 1) ? WICED_TRUE : WICED_FALSE;
-		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "Emergency: %s\n", v ? "ON" : "OFF");
-		if (v != state_led_emergency) {
-			state_led_emergency = v;
-			update_led();
-		}
-	} else if (strcmp(val, "led") == 0) {
-		int v = a_json_get_prop_int(&json, "params", 0, 100);
-		wiced_log_msg(WLF_DEF, WICED_LOG_INFO, "LED: %d\n", v);
-		if (v != state_led_on_level) {
-			state_led_on_level = v;
-			update_led();
-		}
 	}
+	memcpy(rpc_msg.topic, msg->topic, msg->topic_len);
+	rpc_msg.topic_len = msg->topic_len;
+	if (msg->data_len > sizeof(rpc_msg.data)) {
+		rpc_msg.err = JSON_RPC_TOO_LARGE;
+		rpc_msg.data_len = 0;
+	} else {
+		rpc_msg.err = JSON_RPC_OK;
+		memcpy(rpc_msg.data, msg->data, msg->data_len);
+		rpc_msg.data_len = msg->data_len;
+	}
+	__atomic_store_n(&rpc_msg.busy, 1, __ATOMIC_RELEASE);
+	a_eventloop_set_flag(&evt, EVENT_RPC);
 }
 
 static void update_net_state_fn(wiced_bool_t net, wiced_bool_t mqtt, void *arg)
@@ -231,6 +319,11 @@ static wiced_result_t init_mqtt()
 	server[sizeof(server) - 1] = '\0';
 	device_token[sizeof(device_token) - 1] = '\0';
 	wiced_dct_read_unlock(dct, WICED_FALSE);
+	if (a_json_rpc_init(&rpc, rpc_methods, N_ELEMENT(rpc_methods)) < 0) {
+		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to init RPC methods\n");
+		return WICED_ERROR;
+	}
+	a_eventloop_register_event(&evt, &rpc_event_node, rpc_event_fn, EVENT_RPC, NULL);
 	a_sys_mqtt_init(&mqtt, &evt, server, WICED_FALSE, device_token,
 			"*.humminglab.io", mqtt_subscribe_cb_fn, update_net_state_fn, &mqtt);
 	return WICED_SUCCESS;
@@ -255,11 +348,14 @@ static void initial_led_blink_cb(void *arg)
 	led_all((cnt % 2) ? led_g_on: led_r_on);
 }
 
-static void send_telemetry_sensor(void *arg)
+static void send_telemetry_sensor(void *arg, sys_job_status_t status)
 {
 	char buf[256];
-	sprintf(buf, "{\"activity\":1,\"temperature\":%d,\"humidity\":%d}",
-		temp, humid);
+	if (status == SYS_JOB_OK)
+		sprintf(buf, "{\"activity\":1,\"temperature\":%d,\"humidity\":%d}",
+			temp, humid);
+	else
+		sprintf(buf, "{\"activity\":1,\"sensor_fault\":1}");
 	a_sys_mqtt_publish(&mqtt, TOPIC_TELEMETRY, buf, strlen(buf), 0, 0);
 }
 
@@ -306,9 +402,15 @@ void application_start(void)
 	a_sys_button_init(&button, PLATFORM_BUTTON_1, &evt, EVENT_FAULT1_DET, fault_detect_fn, (void*)0);
 	a_sys_button_init(&button, PLATFORM_BUTTON_2, &evt, EVENT_FAULT2_DET, fault_detect_fn, (void*)1);
 
-	wiced_rtos_create_worker_thread(&worker_thread, WICED_DEFAULT_WORKER_PRIORITY, 4096, 2);
-	a_sys_worker_init(&worker, &worker_thread, &evt, EVENT_SENSOR_FINISHED, SENSING_INTERVAL,
-			  sensor_process, send_telemetry_sensor, 0);
+	/* without the pool the gateway runs, only sensing is off */
+	result = a_sys_pool_init(&pool, &evt, EVENT_POOL_DONE, 2, 4096, 8);
+	if (result == WICED_SUCCESS) {
+		a_sys_worker_init(&worker, &pool, SENSING_INTERVAL, sensor_process, send_telemetry_sensor, 0);
+		a_sys_worker_set_min_interval(&worker, SENSING_MIN_INTERVAL);
+		a_sys_worker_set_timeout(&worker, SENSING_TIMEOUT);
+	} else {
+		wiced_log_msg(WLF_DEF, WICED_LOG_ERR, "Fail to start worker pool: %d\n", result);
+	}
 	a_eventloop_register_timer(&evt, &timer_node, initial_led_blink_cb, 500, 0);
 
 	printf("Start LED Gateway\n");
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+#include "maxim_ssi.h"
+#include "sys_framer.h"
+
+/* sys_framer round trips. Random frames are encoded into one stream,
+ * fed in random spans and must come out as they went in, with the
+ * broken or too long ones dropped and counted. */
+
+static int fails;
+
+#define CHECK(c) do {							\
+		if (!(c)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #c);	\
+			fails++;					\
+		}							\
+	} while (0)
+
+#define FRAMES		5000
+#define MAX_FRAMES	(FRAMES * 2)
+
+static uint8_t stream[1 << 21];
+static uint32_t stream_len;
+
+/* frames expected and got, back to back, with their lengths */
+typedef struct {
+	uint8_t data[1 << 20];
+	uint32_t len;
+	uint32_t lens[MAX_FRAMES];
+	uint32_t n;
+} frames_t;
+
+static frames_t expect, got;
+
+static sys_framer_t framer;
+static uint8_t buf[300];
+static uint8_t payload[300];
+
+static void frames_add(frames_t *f, const uint8_t *data, uint32_t len)
+{
+	if (f->n == MAX_FRAMES || len > sizeof(f->data) - f->len)
+		return;
+	memcpy(f->data + f->len, data, len);
+	f->len += len;
+	f->lens[f->n++] = len;
+}
+
+static void frame_fn(void *arg, const uint8_t *frame, uint32_t len)
+{
+	frames_add(&got, frame, len);
+}
+
+static void put(uint8_t c)
+{
+	stream[stream_len++] = c;
+}
+
+static void put_data(const uint8_t *data, uint32_t len)
+{
+	memcpy(stream + stream_len, data, len);
+	stream_len += len;
+}
+
+static void start(void)
+{
+	stream_len = 0;
+	memset(&expect, 0, sizeof(expect));
+	memset(&got, 0, sizeof(got));
+}
+
+/* up to max random bytes in payload, returns the length */
+static uint32_t random_payload(uint32_t max)
+{
+	uint32_t i, n = rand() % (max + 1);
+
+	for (i = 0; i < n; i++)
+		payload[i] = rand();
+	return n;
+}
+
+/* stream in random spans, single bytes now and then */
+static void feed(void)
+{
+	uint32_t i, n;
+
+	for (i = 0; i < stream_len; i += n) {
+		n = (rand() % 4 == 0) ? 1 : 1 + rand() % 300;
+		n = MIN(n, stream_len - i);
+		a_sys_framer_feed(&framer, stream + i, n);
+	}
+}
+
+static int same(void)
+{
+	return (got.n == expect.n && got.len == expect.len &&
+		memcmp(got.lens, expect.lens, got.n * sizeof(got.lens[0])) == 0 &&
+		memcmp(got.data, expect.data, got.len) == 0);
+}
+
+static void report(const char *name)
+{
+	printf("%s: %u frames, %u dropped\n", name, (unsigned)framer.frames, (unsigned)framer.errors);
+}
+
+/* lines longer than the buffer are dropped, empty ones skipped */
+static void test_line(void)
+{
+	uint32_t i, j, n, dropped = 0;
+	int cr;
+
+	start();
+	a_sys_framer_line_init(&framer, buf, 200, '\n', frame_fn, NULL);
+	for (i = 0; i < FRAMES; i++) {
+		n = random_payload(260);
+		for (j = 0; j < n; j++)
+			if (payload[j] == '\n' || payload[j] == '\r')
+				payload[j] = 'x';
+		cr = rand() % 2;
+		put_data(payload, n);
+		if (cr)
+			put('\r');
+		put('\n');
+		if (n + cr > 200)
+			dropped++;
+		else if (n > 0)
+			frames_add(&expect, payload, n);
+	}
+	feed();
+	CHECK(same());
+	CHECK(framer.errors == dropped && dropped > 0);
+	report("line");
+
+	/* through the sys_uart callback */
+	start();
+	a_sys_framer_uart_fn(&framer, "ab\ncd", 5);
+	a_sys_framer_uart_fn(&framer, "e\r\n\n", 4);
+	CHECK(got.n == 2 && got.lens[0] == 2 && got.lens[1] == 3 &&
+	      memcmp(got.data, "abcde", 5) == 0);
+}
+
+static void test_length(void)
+{
+	uint32_t i, n, dropped = 0;
+
+	start();
+	a_sys_framer_length_init(&framer, buf, 200, 2, frame_fn, NULL);
+	for (i = 0; i < FRAMES; i++) {
+		n = random_payload(260);
+		put(n >> 8);
+		put(n);
+		put_data(payload, n);
+		if (n > 200)
+			dropped++;
+		else
+			frames_add(&expect, payload, n);
+	}
+	feed();
+	CHECK(same());
+	CHECK(framer.errors == dropped && dropped > 0);
+	report("length");
+}
+
+static void test_slip(void)
+{
+	static const uint8_t bad[] = { 1, 0xDB, 5, 0xC0 };
+	uint32_t i, j, n;
+
+	start();
+	a_sys_framer_slip_init(&framer, buf, 256, frame_fn, NULL);
+	for (i = 0; i < FRAMES; i++) {
+		n = 1 + random_payload(250);
+		put(0xC0);
+		for (j = 0; j < n; j++) {
+			if (payload[j] == 0xC0) {
+				put(0xDB);
+				put(0xDC);
+			} else if (payload[j] == 0xDB) {
+				put(0xDB);
+				put(0xDD);
+			} else {
+				put(payload[j]);
+			}
+		}
+		put(0xC0);
+		frames_add(&expect, payload, n);
+	}
+	/* bad escape drops the frame */
+	put_data(bad, sizeof(bad));
+	feed();
+	CHECK(same());
+	CHECK(framer.errors == 1);
+	report("slip");
+}
+
+static void test_cobs(void)
+{
+	uint32_t i, j, n, code_at;
+	uint8_t code;
+
+	start();
+	a_sys_framer_cobs_init(&framer, buf, 300, frame_fn, NULL);
+	for (i = 0; i < FRAMES; i++) {
+		n = random_payload(290);
+		/* zero runs, and blocks of 254 without one */
+		if (rand() % 3 == 0)
+			for (j = 0; j < n; j++)
+				if (rand() % 4)
+					payload[j] = 0;
+		if (rand() % 3 == 0)
+			for (j = 0; j < n; j++)
+				payload[j] |= 1;
+
+		code_at = stream_len;
+		put(0);
+		code = 1;
+		for (j = 0; j < n; j++) {
+			if (payload[j] != 0) {
+				put(payload[j]);
+				code++;
+			}
+			if (payload[j] == 0 || code == 0xFF) {
+				stream[code_at] = code;
+				code_at = stream_len;
+				put(0);
+				code = 1;
+			}
+		}
+		stream[code_at] = code;
+		put(0);
+		frames_add(&expect, payload, n);
+	}
+	feed();
+	CHECK(same());
+	CHECK(framer.errors == 0);
+	report("cobs");
+}
+
+/* replies with a broken checksum are dropped and counted */
+static void test_ssi(void)
+{
+	static const uint8_t single[] = { ACK_NO_DATA, NACK, BAD_CMD, CHK_SUM_BAD, BUFF_OVRFLW };
+	uint8_t packet[MAX_PACKET_LEN];
+	uint32_t i, j, n, bad = 0;
+	uint8_t sum;
+
+	start();
+	a_sys_framer_ssi_init(&framer, buf, sizeof(buf), frame_fn, NULL);
+	for (i = 0; i < FRAMES; i++) {
+		if (rand() % 4 == 0) {
+			put(single[rand() % sizeof(single)]);
+			frames_add(&expect, &stream[stream_len - 1], 1);
+			continue;
+		}
+		n = random_payload(MAX_PACKET_LEN - 3);
+		packet[0] = (rand() % 2) ? ACK_DATA : AUTO_REPORT;
+		packet[1] = n + 3;
+		memcpy(&packet[2], payload, n);
+		for (sum = 0, j = 0; j < n + 2; j++)
+			sum += packet[j];
+		packet[n + 2] = -sum;
+		if (rand() % 20 == 0) {
+			packet[2 + rand() % (n + 1)] ^= 0x10;
+			bad++;
+		} else {
+			frames_add(&expect, packet, n + 3);
+		}
+		put_data(packet, n + 3);
+	}
+	feed();
+	CHECK(same());
+	CHECK(framer.errors == bad);
+	report("ssi");
+}
+
+int main(void)
+{
+	srand(1);
+	test_line();
+	test_length();
+	test_slip();
+	test_cobs();
+	test_ssi();
+
+	if (fails)
+		printf("%d failed\n", fails);
+	else
+		printf("ok\n");
+	return fails != 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include "wiced.h"
+
+/* host stand-in of the WICED doubly linked list */
+
+typedef struct linked_list_node {
+	void *data;
+	struct linked_list_node *next;
+	struct linked_list_node *prev;
+} linked_list_node_t;
+
+typedef struct {
+	uint32_t count;
+	linked_list_node_t *front;
+	linked_list_node_t *rear;
+} linked_list_t;
+
+typedef wiced_bool_t (*linked_list_compare_callback_t)(linked_list_node_t *node, void *arg);
+
+wiced_result_t linked_list_init(linked_list_t *l);
+wiced_result_t linked_list_find_node(linked_list_t *l, linked_list_compare_callback_t fn, void *arg,
+				     linked_list_node_t **node);
+wiced_result_t linked_list_insert_node_at_front(linked_list_t *l, linked_list_node_t *node);
+wiced_result_t linked_list_insert_node_at_rear(linked_list_t *l, linked_list_node_t *node);
+wiced_result_t linked_list_remove_node(linked_list_t *l, linked_list_node_t *node);
+wiced_result_t linked_list_get_front_node(linked_list_t *l, linked_list_node_t **node);
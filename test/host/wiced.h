@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+/* host stand-ins of the WICED API used by common/, pthread based.
+ * Only what the host tests need, see wiced_host.c */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef int wiced_result_t;
+enum {
+	WICED_SUCCESS = 0,
+	WICED_PENDING = 1,
+	WICED_TIMEOUT = 2,
+	WICED_ERROR = 4,
+	WICED_BADARG = 5,
+	WICED_OUT_OF_HEAP_SPACE = 6,
+	WICED_BADVALUE = 7,
+	WICED_TCPIP_TIMEOUT = 7002,
+	WICED_TCPIP_SOCKET_CLOSED = 7017,
+};
+
+typedef int wiced_bool_t;
+enum { WICED_FALSE = 0, WICED_TRUE = 1 };
+
+#define WICED_WAIT_FOREVER	0xFFFFFFFFU
+#define WICED_NO_WAIT		0
+
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+#define MAX(a, b)		((a) > (b) ? (a) : (b))
+#define UNUSED_PARAMETER(x)	(void)(x)
+
+#define WICED_DEFAULT_WORKER_PRIORITY	5
+#define WICED_DEFAULT_LIBRARY_PRIORITY	5
+#define WICED_NETWORK_WORKER_PRIORITY	3
+
+/* time */
+typedef uint32_t wiced_time_t;
+typedef uint64_t wiced_utc_time_ms_t;
+
+wiced_result_t wiced_time_get_time(wiced_time_t *t);
+wiced_result_t wiced_rtos_delay_milliseconds(uint32_t ms);
+
+/* thread */
+typedef void *wiced_thread_arg_t;
+typedef void (*wiced_thread_function_t)(wiced_thread_arg_t arg);
+typedef struct {
+	pthread_t t;
+} wiced_thread_t;
+
+wiced_result_t wiced_rtos_create_thread(wiced_thread_t *t, uint8_t priority, const char *name,
+					wiced_thread_function_t fn, uint32_t stack_size, void *arg);
+wiced_result_t wiced_rtos_thread_join(wiced_thread_t *t);
+wiced_result_t wiced_rtos_delete_thread(wiced_thread_t *t);
+wiced_result_t wiced_rtos_is_current_thread(wiced_thread_t *t);
+
+/* ThreadX, identifies the calling thread only */
+typedef struct {
+	int unused;
+} TX_THREAD;
+
+TX_THREAD *tx_thread_identify(void);
+
+/* queue */
+typedef struct {
+	pthread_mutex_t m;
+	pthread_cond_t c;
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t n;
+	uint32_t head;
+	uint32_t cnt;
+} wiced_queue_t;
+
+wiced_result_t wiced_rtos_init_queue(wiced_queue_t *q, const char *name, uint32_t size, uint32_t n);
+wiced_result_t wiced_rtos_push_to_queue(wiced_queue_t *q, void *msg, uint32_t ms);
+wiced_result_t wiced_rtos_pop_from_queue(wiced_queue_t *q, void *msg, uint32_t ms);
+wiced_result_t wiced_rtos_get_queue_occupancy(wiced_queue_t *q, uint32_t *count);
+wiced_result_t wiced_rtos_deinit_queue(wiced_queue_t *q);
+
+/* semaphore and mutex */
+typedef struct {
+	pthread_mutex_t m;
+	pthread_cond_t c;
+	int v;
+} wiced_semaphore_t;
+
+wiced_result_t wiced_rtos_init_semaphore(wiced_semaphore_t *s);
+wiced_result_t wiced_rtos_set_semaphore(wiced_semaphore_t *s);
+wiced_result_t wiced_rtos_get_semaphore(wiced_semaphore_t *s, uint32_t ms);
+wiced_result_t wiced_rtos_deinit_semaphore(wiced_semaphore_t *s);
+
+typedef struct {
+	pthread_mutex_t m;
+} wiced_mutex_t;
+
+wiced_result_t wiced_rtos_init_mutex(wiced_mutex_t *m);
+wiced_result_t wiced_rtos_lock_mutex(wiced_mutex_t *m);
+wiced_result_t wiced_rtos_unlock_mutex(wiced_mutex_t *m);
+wiced_result_t wiced_rtos_deinit_mutex(wiced_mutex_t *m);
+
+/* event flags */
+typedef struct {
+	pthread_mutex_t m;
+	pthread_cond_t c;
+	uint32_t f;
+} wiced_event_flags_t;
+
+typedef enum {
+	WAIT_FOR_ANY_EVENT,
+	WAIT_FOR_ALL_EVENTS,
+} wait_for_event_flags_t;
+
+wiced_result_t wiced_rtos_init_event_flags(wiced_event_flags_t *e);
+wiced_result_t wiced_rtos_set_event_flags(wiced_event_flags_t *e, uint32_t flags);
+wiced_result_t wiced_rtos_wait_for_event_flags(wiced_event_flags_t *e, uint32_t flags, uint32_t *got,
+					       wiced_bool_t clear, wait_for_event_flags_t mode,
+					       uint32_t ms);
+wiced_result_t wiced_rtos_deinit_event_flags(wiced_event_flags_t *e);
+
+/* log, printed when V is set in the environment */
+#define WLF_DEF		0
+enum {
+	WICED_LOG_ERR,
+	WICED_LOG_WARNING,
+	WICED_LOG_NOTICE,
+	WICED_LOG_INFO,
+	WICED_LOG_DEBUG0,
+};
+
+int wiced_log_msg(int facility, int level, const char *fmt, ...);
+
+/* timer, runs on its own thread */
+typedef void (*timer_handler_t)(void *arg);
+typedef struct {
+	pthread_t t;
+	pthread_mutex_t m;
+	pthread_cond_t c;
+	uint32_t ms;
+	timer_handler_t fn;
+	void *arg;
+	int run;
+} wiced_timer_t;
+
+wiced_result_t wiced_rtos_init_timer(wiced_timer_t *t, uint32_t ms, timer_handler_t fn, void *arg);
+wiced_result_t wiced_rtos_start_timer(wiced_timer_t *t);
+wiced_result_t wiced_rtos_stop_timer(wiced_timer_t *t);
+wiced_result_t wiced_rtos_deinit_timer(wiced_timer_t *t);
+
+/* ring buffer, head is read and tail is write, holds size - 1 */
+typedef struct {
+	uint8_t *buffer;
+	uint32_t size;
+	uint32_t head;
+	uint32_t tail;
+} wiced_ring_buffer_t;
+
+wiced_result_t ring_buffer_init(wiced_ring_buffer_t *r, uint8_t *buf, uint32_t size);
+uint32_t ring_buffer_used_space(wiced_ring_buffer_t *r);
+uint32_t ring_buffer_free_space(wiced_ring_buffer_t *r);
+wiced_result_t ring_buffer_get_data(wiced_ring_buffer_t *r, uint8_t **data, uint32_t *count);
+wiced_result_t ring_buffer_consume(wiced_ring_buffer_t *r, uint32_t n);
+uint32_t ring_buffer_write(wiced_ring_buffer_t *r, const uint8_t *data, uint32_t n);
+
+/* uart, see wiced_host.h for the line side */
+typedef int wiced_uart_t;
+typedef struct {
+	uint32_t baud_rate;
+	int data_width;
+	int parity;
+	int stop_bits;
+	int flow_control;
+} wiced_uart_config_t;
+
+enum { DATA_WIDTH_8BIT };
+enum { NO_PARITY };
+enum { STOP_BITS_1 };
+enum { FLOW_CONTROL_DISABLED, FLOW_CONTROL_CTS_RTS = 3 };
+
+wiced_result_t wiced_uart_init(wiced_uart_t uart, const wiced_uart_config_t *config,
+			       wiced_ring_buffer_t *rx);
+wiced_result_t wiced_uart_deinit(wiced_uart_t uart);
+wiced_result_t wiced_uart_transmit_bytes(wiced_uart_t uart, const void *data, uint32_t size);
+wiced_result_t wiced_uart_receive_bytes(wiced_uart_t uart, void *data, uint32_t *size, uint32_t ms);
+
+/* tcp socket, receive only, see wiced_host.h for the peer side */
+typedef struct wiced_packet {
+	struct wiced_packet *next;
+	uint16_t len;
+	uint8_t data[];
+} wiced_packet_t;
+
+typedef struct {
+	wiced_packet_t *head;	/* sent by peer, not received yet */
+	wiced_packet_t *tail;
+	wiced_bool_t closed;
+} wiced_tcp_socket_t;
+
+/* does not wait, times out at once when nothing was sent */
+wiced_result_t wiced_tcp_receive(wiced_tcp_socket_t *s, wiced_packet_t **packet, uint32_t ms);
+wiced_result_t wiced_packet_get_data(wiced_packet_t *packet, uint16_t offset, uint8_t **data,
+				     uint16_t *fragment, uint16_t *total);
+wiced_result_t wiced_packet_delete(wiced_packet_t *packet);
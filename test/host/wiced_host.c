@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "wiced.h"
+#include "linked_list.h"
+#include "wiced_host.h"
+
+/* pthread versions of the WICED RTOS calls in wiced.h */
+
+static struct timespec _deadline(uint32_t ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return ts;
+}
+
+/* returns ETIMEDOUT when ms passed */
+static int _wait(pthread_cond_t *c, pthread_mutex_t *m, uint32_t ms)
+{
+	struct timespec ts;
+
+	if (ms == WICED_WAIT_FOREVER)
+		return pthread_cond_wait(c, m);
+	if (ms == WICED_NO_WAIT)
+		return ETIMEDOUT;
+	ts = _deadline(ms);
+	return pthread_cond_timedwait(c, m, &ts);
+}
+
+wiced_result_t wiced_time_get_time(wiced_time_t *t)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	*t = (wiced_time_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_delay_milliseconds(uint32_t ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+	return WICED_SUCCESS;
+}
+
+typedef struct {
+	wiced_thread_function_t fn;
+	void *arg;
+} thread_start_t;
+
+static void * _thread(void *p)
+{
+	thread_start_t s = *(thread_start_t*)p;
+
+	free(p);
+	(*s.fn)(s.arg);
+	return NULL;
+}
+
+wiced_result_t wiced_rtos_create_thread(wiced_thread_t *t, uint8_t priority, const char *name,
+					wiced_thread_function_t fn, uint32_t stack_size, void *arg)
+{
+	thread_start_t *s;
+
+	s = malloc(sizeof(*s));
+	if (s == NULL)
+		return WICED_OUT_OF_HEAP_SPACE;
+	s->fn = fn;
+	s->arg = arg;
+	if (pthread_create(&t->t, NULL, _thread, s) != 0) {
+		free(s);
+		return WICED_ERROR;
+	}
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_thread_join(wiced_thread_t *t)
+{
+	return pthread_join(t->t, NULL) == 0 ? WICED_SUCCESS : WICED_ERROR;
+}
+
+wiced_result_t wiced_rtos_delete_thread(wiced_thread_t *t)
+{
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_is_current_thread(wiced_thread_t *t)
+{
+	return pthread_equal(t->t, pthread_self()) ? WICED_SUCCESS : WICED_ERROR;
+}
+
+TX_THREAD *tx_thread_identify(void)
+{
+	static __thread TX_THREAD self;
+
+	return &self;
+}
+
+wiced_result_t wiced_rtos_init_queue(wiced_queue_t *q, const char *name, uint32_t size, uint32_t n)
+{
+	q->buf = malloc(size * n);
+	if (q->buf == NULL)
+		return WICED_OUT_OF_HEAP_SPACE;
+	pthread_mutex_init(&q->m, NULL);
+	pthread_cond_init(&q->c, NULL);
+	q->size = size;
+	q->n = n;
+	q->head = 0;
+	q->cnt = 0;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_push_to_queue(wiced_queue_t *q, void *msg, uint32_t ms)
+{
+	pthread_mutex_lock(&q->m);
+	while (q->cnt == q->n) {
+		if (_wait(&q->c, &q->m, ms) == ETIMEDOUT) {
+			pthread_mutex_unlock(&q->m);
+			return WICED_ERROR;
+		}
+	}
+	memcpy(q->buf + ((q->head + q->cnt) % q->n) * q->size, msg, q->size);
+	q->cnt++;
+	pthread_cond_broadcast(&q->c);
+	pthread_mutex_unlock(&q->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_pop_from_queue(wiced_queue_t *q, void *msg, uint32_t ms)
+{
+	pthread_mutex_lock(&q->m);
+	while (q->cnt == 0) {
+		if (_wait(&q->c, &q->m, ms) == ETIMEDOUT) {
+			pthread_mutex_unlock(&q->m);
+			return WICED_ERROR;
+		}
+	}
+	memcpy(msg, q->buf + q->head * q->size, q->size);
+	q->head = (q->head + 1) % q->n;
+	q->cnt--;
+	pthread_cond_broadcast(&q->c);
+	pthread_mutex_unlock(&q->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_get_queue_occupancy(wiced_queue_t *q, uint32_t *count)
+{
+	pthread_mutex_lock(&q->m);
+	*count = q->cnt;
+	pthread_mutex_unlock(&q->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_deinit_queue(wiced_queue_t *q)
+{
+	free(q->buf);
+	q->buf = NULL;
+	pthread_cond_destroy(&q->c);
+	pthread_mutex_destroy(&q->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_init_semaphore(wiced_semaphore_t *s)
+{
+	pthread_mutex_init(&s->m, NULL);
+	pthread_cond_init(&s->c, NULL);
+	s->v = 0;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_set_semaphore(wiced_semaphore_t *s)
+{
+	pthread_mutex_lock(&s->m);
+	s->v++;
+	pthread_cond_signal(&s->c);
+	pthread_mutex_unlock(&s->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_get_semaphore(wiced_semaphore_t *s, uint32_t ms)
+{
+	pthread_mutex_lock(&s->m);
+	while (s->v == 0) {
+		if (_wait(&s->c, &s->m, ms) == ETIMEDOUT) {
+			pthread_mutex_unlock(&s->m);
+			return WICED_TIMEOUT;
+		}
+	}
+	s->v--;
+	pthread_mutex_unlock(&s->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_deinit_semaphore(wiced_semaphore_t *s)
+{
+	pthread_cond_destroy(&s->c);
+	pthread_mutex_destroy(&s->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_init_mutex(wiced_mutex_t *m)
+{
+	pthread_mutex_init(&m->m, NULL);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_lock_mutex(wiced_mutex_t *m)
+{
+	pthread_mutex_lock(&m->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_unlock_mutex(wiced_mutex_t *m)
+{
+	pthread_mutex_unlock(&m->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_deinit_mutex(wiced_mutex_t *m)
+{
+	pthread_mutex_destroy(&m->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_init_event_flags(wiced_event_flags_t *e)
+{
+	pthread_mutex_init(&e->m, NULL);
+	pthread_cond_init(&e->c, NULL);
+	e->f = 0;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_set_event_flags(wiced_event_flags_t *e, uint32_t flags)
+{
+	pthread_mutex_lock(&e->m);
+	e->f |= flags;
+	pthread_cond_broadcast(&e->c);
+	pthread_mutex_unlock(&e->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_wait_for_event_flags(wiced_event_flags_t *e, uint32_t flags, uint32_t *got,
+					       wiced_bool_t clear, wait_for_event_flags_t mode,
+					       uint32_t ms)
+{
+	pthread_mutex_lock(&e->m);
+	while ((mode == WAIT_FOR_ANY_EVENT) ? !(e->f & flags) : (e->f & flags) != flags) {
+		if (_wait(&e->c, &e->m, ms) == ETIMEDOUT) {
+			pthread_mutex_unlock(&e->m);
+			return WICED_TIMEOUT;
+		}
+	}
+	*got = e->f & flags;
+	if (clear)
+		e->f &= ~flags;
+	pthread_mutex_unlock(&e->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_deinit_event_flags(wiced_event_flags_t *e)
+{
+	pthread_cond_destroy(&e->c);
+	pthread_mutex_destroy(&e->m);
+	return WICED_SUCCESS;
+}
+
+int wiced_log_msg(int facility, int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (getenv("V") == NULL)
+		return 0;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	return 0;
+}
+
+wiced_result_t linked_list_init(linked_list_t *l)
+{
+	memset(l, 0, sizeof(*l));
+	return WICED_SUCCESS;
+}
+
+wiced_result_t linked_list_find_node(linked_list_t *l, linked_list_compare_callback_t fn, void *arg,
+				     linked_list_node_t **node)
+{
+	linked_list_node_t *n;
+
+	for (n = l->front; n; n = n->next) {
+		if ((*fn)(n, arg)) {
+			*node = n;
+			return WICED_SUCCESS;
+		}
+	}
+	return WICED_ERROR;
+}
+
+wiced_result_t linked_list_insert_node_at_front(linked_list_t *l, linked_list_node_t *node)
+{
+	node->prev = NULL;
+	node->next = l->front;
+	if (l->front)
+		l->front->prev = node;
+	else
+		l->rear = node;
+	l->front = node;
+	l->count++;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t linked_list_insert_node_at_rear(linked_list_t *l, linked_list_node_t *node)
+{
+	node->next = NULL;
+	node->prev = l->rear;
+	if (l->rear)
+		l->rear->next = node;
+	else
+		l->front = node;
+	l->rear = node;
+	l->count++;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t linked_list_remove_node(linked_list_t *l, linked_list_node_t *node)
+{
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		l->front = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	else
+		l->rear = node->prev;
+	node->next = NULL;
+	node->prev = NULL;
+	l->count--;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t linked_list_get_front_node(linked_list_t *l, linked_list_node_t **node)
+{
+	*node = l->front;
+	return l->front ? WICED_SUCCESS : WICED_ERROR;
+}
+
+long host_timer_ticks;
+
+static void * _timer(void *p)
+{
+	wiced_timer_t *t = p;
+
+	pthread_mutex_lock(&t->m);
+	while (t->run) {
+		if (_wait(&t->c, &t->m, t->ms) != ETIMEDOUT || !t->run)
+			continue;
+		pthread_mutex_unlock(&t->m);
+		__atomic_add_fetch(&host_timer_ticks, 1, __ATOMIC_RELAXED);
+		(*t->fn)(t->arg);
+		pthread_mutex_lock(&t->m);
+	}
+	pthread_mutex_unlock(&t->m);
+	return NULL;
+}
+
+wiced_result_t wiced_rtos_init_timer(wiced_timer_t *t, uint32_t ms, timer_handler_t fn, void *arg)
+{
+	pthread_mutex_init(&t->m, NULL);
+	pthread_cond_init(&t->c, NULL);
+	t->ms = ms;
+	t->fn = fn;
+	t->arg = arg;
+	t->run = 0;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_start_timer(wiced_timer_t *t)
+{
+	int run;
+
+	pthread_mutex_lock(&t->m);
+	run = t->run;
+	t->run = 1;
+	pthread_mutex_unlock(&t->m);
+	if (run)
+		return WICED_SUCCESS;
+	return pthread_create(&t->t, NULL, _timer, t) == 0 ? WICED_SUCCESS : WICED_ERROR;
+}
+
+/* not from its own callback, it waits for the thread */
+wiced_result_t wiced_rtos_stop_timer(wiced_timer_t *t)
+{
+	int run;
+
+	pthread_mutex_lock(&t->m);
+	run = t->run;
+	t->run = 0;
+	pthread_cond_signal(&t->c);
+	pthread_mutex_unlock(&t->m);
+	if (run)
+		pthread_join(t->t, NULL);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_deinit_timer(wiced_timer_t *t)
+{
+	wiced_rtos_stop_timer(t);
+	pthread_cond_destroy(&t->c);
+	pthread_mutex_destroy(&t->m);
+	return WICED_SUCCESS;
+}
+
+wiced_result_t ring_buffer_init(wiced_ring_buffer_t *r, uint8_t *buf, uint32_t size)
+{
+	r->buffer = buf;
+	r->size = size;
+	r->head = 0;
+	r->tail = 0;
+	return WICED_SUCCESS;
+}
+
+uint32_t ring_buffer_used_space(wiced_ring_buffer_t *r)
+{
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	return (tail + r->size - head) % r->size;
+}
+
+uint32_t ring_buffer_free_space(wiced_ring_buffer_t *r)
+{
+	return r->size - ring_buffer_used_space(r) - 1;
+}
+
+/* contiguous span from head */
+wiced_result_t ring_buffer_get_data(wiced_ring_buffer_t *r, uint8_t **data, uint32_t *count)
+{
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	*data = &r->buffer[head];
+	*count = (tail >= head) ? tail - head : r->size - head;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t ring_buffer_consume(wiced_ring_buffer_t *r, uint32_t n)
+{
+	__atomic_store_n(&r->head, (r->head + n) % r->size, __ATOMIC_RELEASE);
+	return WICED_SUCCESS;
+}
+
+uint32_t ring_buffer_write(wiced_ring_buffer_t *r, const uint8_t *data, uint32_t n)
+{
+	uint32_t i, tail;
+
+	for (i = 0; i < n && ring_buffer_free_space(r) > 0; i++) {
+		tail = r->tail;
+		r->buffer[tail] = data[i];
+		__atomic_store_n(&r->tail, (tail + 1) % r->size, __ATOMIC_RELEASE);
+	}
+	return i;
+}
+
+static wiced_ring_buffer_t *uart_rx[HOST_UARTS];
+wiced_uart_config_t host_uart_config[HOST_UARTS];
+void (*host_uart_tx_fn)(wiced_uart_t uart, const uint8_t *data, uint32_t n);
+uint8_t host_uart_tx[65536];
+uint32_t host_uart_tx_len;
+uint32_t host_uart_dropped;
+
+wiced_result_t wiced_uart_init(wiced_uart_t uart, const wiced_uart_config_t *config,
+			       wiced_ring_buffer_t *rx)
+{
+	if (uart < 0 || uart >= HOST_UARTS)
+		return WICED_BADARG;
+	uart_rx[uart] = rx;
+	host_uart_config[uart] = *config;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_uart_deinit(wiced_uart_t uart)
+{
+	uart_rx[uart] = NULL;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_uart_transmit_bytes(wiced_uart_t uart, const void *data, uint32_t size)
+{
+	if (host_uart_tx_fn) {
+		(*host_uart_tx_fn)(uart, data, size);
+		return WICED_SUCCESS;
+	}
+	if (size > sizeof(host_uart_tx) - host_uart_tx_len)
+		return WICED_ERROR;
+	memcpy(host_uart_tx + host_uart_tx_len, data, size);
+	host_uart_tx_len += size;
+	return WICED_SUCCESS;
+}
+
+/* from the rx ring, *size is set to the bytes read on timeout */
+wiced_result_t wiced_uart_receive_bytes(wiced_uart_t uart, void *data, uint32_t *size, uint32_t ms)
+{
+	wiced_ring_buffer_t *r = uart_rx[uart];
+	uint32_t got = 0, n;
+	uint8_t *p;
+
+	while (got < *size) {
+		ring_buffer_get_data(r, &p, &n);
+		n = MIN(n, *size - got);
+		if (n == 0) {
+			if (ms-- == 0)
+				break;
+			wiced_rtos_delay_milliseconds(1);
+			continue;
+		}
+		memcpy((uint8_t*)data + got, p, n);
+		ring_buffer_consume(r, n);
+		got += n;
+	}
+	if (got < *size) {
+		*size = got;
+		return WICED_TIMEOUT;
+	}
+	return WICED_SUCCESS;
+}
+
+uint32_t host_uart_rx(wiced_uart_t uart, const uint8_t *data, uint32_t n)
+{
+	uint32_t k = ring_buffer_write(uart_rx[uart], data, n);
+
+	host_uart_dropped += n - k;
+	return k;
+}
+
+int host_tcp_packets;
+
+void host_tcp_send(wiced_tcp_socket_t *s, const void *data, uint16_t n)
+{
+	wiced_packet_t *p = malloc(sizeof(*p) + n);
+
+	p->next = NULL;
+	p->len = n;
+	memcpy(p->data, data, n);
+	if (s->tail)
+		s->tail->next = p;
+	else
+		s->head = p;
+	s->tail = p;
+}
+
+void host_tcp_close(wiced_tcp_socket_t *s)
+{
+	s->closed = WICED_TRUE;
+}
+
+wiced_result_t wiced_tcp_receive(wiced_tcp_socket_t *s, wiced_packet_t **packet, uint32_t ms)
+{
+	wiced_packet_t *p = s->head;
+
+	if (p == NULL)
+		return s->closed ? WICED_TCPIP_SOCKET_CLOSED : WICED_TCPIP_TIMEOUT;
+	s->head = p->next;
+	if (s->head == NULL)
+		s->tail = NULL;
+	host_tcp_packets++;
+	*packet = p;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_packet_get_data(wiced_packet_t *packet, uint16_t offset, uint8_t **data,
+				     uint16_t *fragment, uint16_t *total)
+{
+	if (offset > packet->len)
+		return WICED_BADARG;
+	*data = packet->data + offset;
+	*fragment = *total = packet->len - offset;
+	return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_packet_delete(wiced_packet_t *packet)
+{
+	host_tcp_packets--;
+	free(packet);
+	return WICED_SUCCESS;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include "wiced.h"
+
+/* test side of the host stand-ins */
+
+#define HOST_UARTS	4
+
+/* bytes from the line into the rx ring as the rx interrupt would,
+ * returns bytes taken, the rest is counted in host_uart_dropped */
+uint32_t host_uart_rx(wiced_uart_t uart, const uint8_t *data, uint32_t n);
+
+/* transmitted bytes go to host_uart_tx_fn if set, else to host_uart_tx */
+extern void (*host_uart_tx_fn)(wiced_uart_t uart, const uint8_t *data, uint32_t n);
+extern uint8_t host_uart_tx[65536];
+extern uint32_t host_uart_tx_len;
+extern uint32_t host_uart_dropped;
+extern wiced_uart_config_t host_uart_config[HOST_UARTS];
+
+/* timer callbacks run so far, all timers */
+extern long host_timer_ticks;
+
+/* one packet from the peer, and the peer closing */
+void host_tcp_send(wiced_tcp_socket_t *s, const void *data, uint16_t n);
+void host_tcp_close(wiced_tcp_socket_t *s);
+/* packets received and not deleted yet */
+extern int host_tcp_packets;
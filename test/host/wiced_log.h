@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#pragma once
+
+/* wiced_log_msg() is declared in the host wiced.h */
+#include "wiced.h"
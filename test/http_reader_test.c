@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+#include "wiced_host.h"
+#include "http_reader.h"
+
+/* http_reader against canned responses, sent in packets of random
+ * sizes so that status, header and chunk size lines are split across
+ * them. Bodies by Content-Length, chunked and until close must come out
+ * as they went in, kept-alive responses follow on one socket. */
+
+static int fails;
+
+#define CHECK(c) do {							\
+		if (!(c)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #c);	\
+			fails++;					\
+		}							\
+	} while (0)
+
+#define ROUNDS		300
+#define MAX_BODY	3000
+
+static wiced_tcp_socket_t sock;
+static a_http_reader_t reader;
+static char line[64];
+
+static char out[MAX_BODY * 8];
+static uint32_t out_len;
+static uint8_t body[MAX_BODY];
+static uint32_t body_len;
+static uint8_t got[MAX_BODY + 300];	/* room for one read past the body */
+
+static int headers;
+static char header_x[sizeof(line)];
+
+static void header_fn(void *arg, const char *name, const char *value)
+{
+	headers++;
+	if (strcmp(name, "X-Test") == 0)
+		strcpy(header_x, value);
+}
+
+static void put(const char *s)
+{
+	uint32_t n = strlen(s);
+
+	memcpy(out + out_len, s, n);
+	out_len += n;
+}
+
+static void put_body(const uint8_t *data, uint32_t n)
+{
+	memcpy(out + out_len, data, n);
+	out_len += n;
+}
+
+/* out to the socket in random packets, single bytes now and then */
+static void send_out(void)
+{
+	uint32_t i, n;
+
+	for (i = 0; i < out_len; i += n) {
+		n = (rand() % 4 == 0) ? 1 + rand() % 3 : 1 + rand() % 200;
+		n = MIN(n, out_len - i);
+		host_tcp_send(&sock, out + i, (uint16_t)n);
+	}
+	out_len = 0;
+}
+
+static void random_body(void)
+{
+	uint32_t i;
+
+	body_len = rand() % MAX_BODY;
+	for (i = 0; i < body_len; i++)
+		body[i] = rand();
+}
+
+/* whole body in random reads by both readers, 0 at the end */
+static int read_body(void)
+{
+	const uint8_t *p;
+	uint32_t len = 0;
+	int n;
+
+	for (;;) {
+		if (rand() % 2) {
+			n = a_http_read_body(&reader, got + len, 1 + rand() % 300);
+		} else {
+			n = a_http_next_body(&reader, &p, 1 + rand() % 300);
+			if (n > 0)
+				memcpy(got + len, p, n);
+		}
+		if (n <= 0)
+			break;
+		len += n;
+		if (len > MAX_BODY)
+			return 0;
+	}
+	return n == 0 && len == body_len && memcmp(got, body, len) == 0 &&
+		a_http_body_is_done(&reader);
+}
+
+static void start(void)
+{
+	memset(&sock, 0, sizeof(sock));
+	a_http_reader_init(&reader, &sock, line, sizeof(line), 0);
+	headers = 0;
+	header_x[0] = '\0';
+}
+
+/* reader must not keep packets */
+static void finish(void)
+{
+	wiced_packet_t *p;
+
+	a_http_reader_deinit(&reader);
+	while (wiced_tcp_receive(&sock, &p, 0) == WICED_SUCCESS)
+		wiced_packet_delete(p);
+	CHECK(host_tcp_packets == 0);
+}
+
+static void put_length(void)
+{
+	char s[64];
+
+	random_body();
+	put("HTTP/1.1 200 OK\r\n");
+	snprintf(s, sizeof(s), "Content-Length: %u\r\n", (unsigned)body_len);
+	put(s);
+	put("X-Test: \t value \r\n\r\n");
+	put_body(body, body_len);
+}
+
+/* chunks of random sizes, with extensions and trailer now and then */
+static void put_chunked(void)
+{
+	uint32_t i, n;
+	char s[32];
+
+	random_body();
+	put("HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, chunked\r\n\r\n");
+	for (i = 0; i < body_len; i += n) {
+		n = 1 + rand() % 400;
+		n = MIN(n, body_len - i);
+		snprintf(s, sizeof(s), (rand() % 2) ? "%x" : "%X", (unsigned)n);
+		put(s);
+		if (rand() % 4 == 0)
+			put(";name=value");
+		put("\r\n");
+		put_body(body + i, n);
+		put("\r\n");
+	}
+	put("0\r\n");
+	if (rand() % 2)
+		put("X-Trailer: 1\r\n");
+	put("\r\n");
+}
+
+static void test_length(void)
+{
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		start();
+		put_length();
+		send_out();
+		CHECK(a_http_read_response(&reader, header_fn, NULL) == WICED_SUCCESS);
+		CHECK(reader.status == 200 && reader.content_length == (int32_t)body_len);
+		CHECK(reader.keep_alive && !reader.chunked);
+		CHECK(headers == 2 && strcmp(header_x, "value") == 0);
+		CHECK(read_body());
+		finish();
+	}
+}
+
+static void test_chunked(void)
+{
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		start();
+		put_chunked();
+		send_out();
+		CHECK(a_http_read_response(&reader, header_fn, NULL) == WICED_SUCCESS);
+		CHECK(reader.status == 200 && reader.chunked && reader.content_length == -1);
+		CHECK(read_body());
+		finish();
+	}
+
+	/* chunk size line a byte a packet, timing out in between */
+	start();
+	put("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+	send_out();
+	CHECK(a_http_read_response(&reader, header_fn, NULL) == WICED_SUCCESS);
+	for (i = 0; i < 6; i++) {
+		host_tcp_send(&sock, &"2;x\r\nab"[i], 1);
+		CHECK(a_http_read_body(&reader, got, sizeof(got)) == ((i < 5) ? A_HTTP_AGAIN : 1));
+	}
+	host_tcp_send(&sock, "b\r\n0\r\n\r\n", 8);
+	CHECK(a_http_read_body(&reader, got + 1, sizeof(got) - 1) == 1);
+	CHECK(a_http_read_body(&reader, got, sizeof(got)) == 0 && memcmp(got, "ab", 2) == 0);
+	finish();
+
+	/* bad size line */
+	start();
+	put("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n");
+	send_out();
+	CHECK(a_http_read_response(&reader, NULL, NULL) == WICED_SUCCESS);
+	CHECK(a_http_read_body(&reader, got, sizeof(got)) == -1);
+	finish();
+}
+
+/* responses back to back on one socket, bodies read, partly read or
+ * left for the next read_response to skip */
+static void test_keep_alive(void)
+{
+	int i, k, kind[4], skip[4];
+	uint8_t bodies[4][MAX_BODY];
+	uint32_t lens[4];
+
+	for (i = 0; i < ROUNDS / 4; i++) {
+		start();
+		for (k = 0; k < 4; k++) {
+			kind[k] = rand() % 4;
+			skip[k] = rand() % 3 == 0;
+			if (kind[k] == 0) {
+				put_length();
+			} else if (kind[k] == 1) {
+				put_chunked();
+			} else if (kind[k] == 2) {
+				/* interim response first */
+				put("HTTP/1.1 100 Continue\r\n\r\n");
+				put_length();
+			} else {
+				body_len = 0;
+				put("HTTP/1.1 204 No Content\r\nContent-Length: 9\r\n\r\n");
+			}
+			memcpy(bodies[k], body, body_len);
+			lens[k] = body_len;
+		}
+		send_out();
+		host_tcp_close(&sock);
+
+		for (k = 0; k < 4; k++) {
+			CHECK(a_http_read_response(&reader, header_fn, NULL) == WICED_SUCCESS);
+			CHECK(reader.status == ((kind[k] == 3) ? 204 : 200) && reader.keep_alive);
+			if (skip[k]) {
+				if (lens[k] && rand() % 2)
+					CHECK(a_http_read_body(&reader, got, 1) == 1);
+				continue;
+			}
+			memcpy(body, bodies[k], lens[k]);
+			body_len = lens[k];
+			CHECK(read_body());
+		}
+		/* closed after the last one */
+		CHECK(a_http_read_response(&reader, header_fn, NULL) == WICED_ERROR);
+		finish();
+	}
+
+	start();
+	put("HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+	send_out();
+	CHECK(a_http_read_response(&reader, NULL, NULL) == WICED_SUCCESS);
+	CHECK(!reader.keep_alive && a_http_body_is_done(&reader));
+	finish();
+
+	start();
+	put("HTTP/1.0 200 OK\r\nContent-Length: 0\r\n\r\n");
+	send_out();
+	CHECK(a_http_read_response(&reader, NULL, NULL) == WICED_SUCCESS);
+	CHECK(!reader.keep_alive);
+	finish();
+}
+
+/* no length, body until the peer closes */
+static void test_close(void)
+{
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		start();
+		random_body();
+		put("HTTP/1.1 206 Partial Content\r\n");
+		put("Content-Range: bytes 100-199/1000\r\n");
+		put("X-Test: a header longer than the line buffer of sixty four bytes\r\n\r\n");
+		put_body(body, body_len);
+		send_out();
+		host_tcp_close(&sock);
+		CHECK(a_http_read_response(&reader, header_fn, NULL) == WICED_SUCCESS);
+		CHECK(reader.status == 206 && !reader.keep_alive);
+		CHECK(reader.range_from == 100 && reader.range_total == 1000);
+		/* truncated to the line buffer */
+		CHECK(strlen(header_x) == sizeof(line) - 1 - strlen("X-Test: "));
+		CHECK(read_body());
+		finish();
+	}
+
+	/* not closed yet, the body goes on */
+	start();
+	put("HTTP/1.1 200 OK\r\n\r\nabc");
+	send_out();
+	CHECK(a_http_read_response(&reader, NULL, NULL) == WICED_SUCCESS);
+	body_len = 0;
+	while ((i = a_http_read_body(&reader, got + body_len, sizeof(got) - body_len)) > 0)
+		body_len += i;
+	CHECK(i == A_HTTP_AGAIN && body_len == 3 && memcmp(got, "abc", 3) == 0);
+	host_tcp_close(&sock);
+	CHECK(a_http_read_body(&reader, got, sizeof(got)) == 0 && a_http_body_is_done(&reader));
+	finish();
+}
+
+/* timeout in the status line is retried, a bad status line fails */
+static void test_status(void)
+{
+	start();
+	host_tcp_send(&sock, "HTTP/1.1 4", 10);
+	CHECK(a_http_read_response(&reader, NULL, NULL) == WICED_TIMEOUT);
+	host_tcp_send(&sock, "04 Not Found\r\nContent-Length: 0\r\n\r\n", 36);
+	CHECK(a_http_read_response(&reader, NULL, NULL) == WICED_SUCCESS && reader.status == 404);
+	finish();
+
+	start();
+	put("HTTP/2 200\r\n\r\n");
+	send_out();
+	CHECK(a_http_read_response(&reader, NULL, NULL) == WICED_BADVALUE);
+	finish();
+}
+
+int main(void)
+{
+	srand(1);
+	test_length();
+	test_chunked();
+	test_keep_alive();
+	test_close();
+	test_status();
+
+	if (fails)
+		printf("%d failed\n", fails);
+	else
+		printf("ok\n");
+	return fails != 0;
+}
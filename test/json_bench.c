@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "json_parser.h"
+
+/* byte by byte feeding against the word at a time bulk path of
+ * a_json_append_str_sized(), then throughput and latency of the bulk
+ * and in-place parsers */
+
+#define ROUNDS	200000
+#define SAMPLES	20000
+
+static const char *msg[] = {
+	"{\"method\":\"led\",\"params\":50}",
+	"{\"id\":12345,\"method\":\"emergency\",\"params\":true,\"timeout\":5000}",
+	"{\"method\":\"setConfig\",\"params\":{\"server\":\"mqtt.humminglab.io\","
+	"\"device_token\":\"A1b2C3d4E5f6G7h8I9j0KkLlMmNnOoPp\",\"interval\":10000,"
+	"\"levels\":[0,25,50,75,100]}}",
+	"{\"method\":\"upgrade\",\"params\":{\"host\":\"firmware.humminglab.io\",\"port\":80,"
+	"\"path\":\"/fw/example/v0.0.2/eventloop-example-BCM943362WCD4.bin\","
+	"\"md5\":\"0123456789abcdef0123456789abcdef\"}}",
+};
+
+static a_json_t json;
+static char buf[512];
+static a_json_entry_t entry[32];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bytewise(const char *m, size_t len)
+{
+	double t = now();
+	size_t i;
+	int n;
+
+	for (n = 0; n < ROUNDS; n++) {
+		a_json_init(&json, buf, sizeof(buf), entry, N_ELEMENT(entry), 0);
+		for (i = 0; i < len; i++)
+			if (a_json_append(&json, m[i]))
+				break;
+	}
+	return (now() - t) / ROUNDS * 1e9;
+}
+
+static double bulk(const char *m, size_t len)
+{
+	double t = now();
+	int n;
+
+	for (n = 0; n < ROUNDS; n++) {
+		a_json_init(&json, buf, sizeof(buf), entry, N_ELEMENT(entry), 0);
+		a_json_append_str_sized(&json, (char*)m, len);
+	}
+	return (now() - t) / ROUNDS * 1e9;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* each message timed on its own, percentiles of per message time */
+static void latency(const char *name, const char *m, size_t len, bool inplace)
+{
+	static double t[SAMPLES];
+	double t0, sum = 0;
+	int n;
+
+	for (n = 0; n < SAMPLES; n++) {
+		t0 = now();
+		if (inplace) {
+			a_json_parse_inplace(&json, m, len, entry, N_ELEMENT(entry));
+		} else {
+			a_json_init(&json, buf, sizeof(buf), entry, N_ELEMENT(entry), 0);
+			a_json_append_str_sized(&json, (char*)m, len);
+		}
+		t[n] = now() - t0;
+		sum += t[n];
+	}
+	qsort(t, SAMPLES, sizeof(t[0]), cmp);
+	printf("%3zu bytes %-8s %6.1f MB/s, p50 %5.0f ns, p99 %5.0f ns, max %6.0f ns\n",
+	       len, name, len * SAMPLES / sum / 1e6, t[SAMPLES / 2] * 1e9,
+	       t[SAMPLES * 99 / 100] * 1e9, t[SAMPLES - 1] * 1e9);
+}
+
+int main(void)
+{
+	double t1, t2;
+	size_t k, len;
+
+	for (k = 0; k < N_ELEMENT(msg); k++) {
+		len = strlen(msg[k]);
+		t1 = bytewise(msg[k], len);
+		t2 = bulk(msg[k], len);
+		if (!a_json_is_good(&json)) {
+			printf("message %zu does not parse\n", k);
+			return 1;
+		}
+		printf("%3zu bytes: bytewise %5.0f ns, bulk %5.0f ns, %.2fx\n",
+		       len, t1, t2, t1 / t2);
+	}
+	for (k = 0; k < N_ELEMENT(msg); k++) {
+		len = strlen(msg[k]);
+		latency("bulk", msg[k], len, false);
+		latency("in-place", msg[k], len, true);
+	}
+	return 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_parser.h"
+#include "json_rpc.h"
+
+/* fuzz target for json_parser and json_rpc.
+ *
+ * libFuzzer:	clang -fsanitize=fuzzer,address,undefined -DLIBFUZZER ...
+ * AFL:		afl-fuzz -i corpus -o out -- build/json_fuzz @@
+ * otherwise runs the given files, or generated inputs when none given
+ *
+ * First bytes of an input pick buffer sizes, separator and how it is
+ * split for feeding, the rest is the document.
+ */
+
+#define OPT_BYTES	4
+
+static const char *paths[] = {
+	"method", "params", "params.levels[1]", "params.levels[0].a", "[0]", "[0][1]",
+	"a.b.c", "params.", "params[", "params[99999999999]", "", ".x", "[", "[]",
+	"x\\u0065",
+};
+
+static void rpc_fn(void *arg, a_json_t *json, const int32_t *v)
+{
+}
+
+static const a_json_rpc_param_t rpc_bool[] = {
+	{ "params", JSON_RPC_BOOL },
+};
+
+static const a_json_rpc_param_t rpc_led[] = {
+	{ "params.levels[1]", JSON_RPC_INT, 0, 100 },
+	{ "params.t", JSON_RPC_FIXED, -1000, 1000, 1 },
+};
+
+static const a_json_rpc_method_t methods[] = {
+	{ "emergency", rpc_fn, rpc_bool, N_ELEMENT(rpc_bool) },
+	{ "led", rpc_fn, rpc_led, N_ELEMENT(rpc_led) },
+};
+
+/* entries must stay inside their tables */
+static void check(a_json_t *json, size_t lim)
+{
+	a_json_entry_t *e;
+	int i;
+
+	for (i = 0; i < json->entry_pos; i++) {
+		e = &json->entry[i];
+		if (e->parent >= i)
+			abort();
+		if (e->key >= 0 && (size_t)e->key + e->key_len > lim)
+			abort();
+		if (e->val >= 0 && (size_t)e->val + e->val_len > lim)
+			abort();
+	}
+}
+
+static void access_all(a_json_t *json)
+{
+	char out[64];
+	int64_t i64;
+	int32_t i32;
+	double d;
+	bool b;
+	size_t k;
+	const char *s;
+
+	for (k = 0; k < N_ELEMENT(paths); k++) {
+		a_json_find(json, 0, paths[k]);
+		a_json_find(json, 1, paths[k]);
+		a_json_get_prop_str(json, paths[k], out, 1 + k * 4);
+		a_json_get_prop_int64(json, paths[k], &i64);
+		a_json_get_prop_double(json, paths[k], &d);
+		a_json_get_prop_bool(json, paths[k], &b);
+		a_json_get_prop_fixed(json, paths[k], (int)k - 5, &i32);
+		a_json_get_prop_fixed(json, paths[k], 20, &i32);
+		a_json_prop_is_null(json, paths[k]);
+		a_json_comp_prop_val(json, paths[k], "abc");
+		a_json_get_prop_int(json, paths[k], 0, 10);
+		if (!json->inplace && a_json_is_good(json)) {
+			s = a_json_get_prop(json, paths[k]);
+			if (s)
+				(void)strlen(s);
+		}
+	}
+}
+
+/* copy mode and in-place mode must give the same answers */
+static void compare(a_json_t *a, a_json_t *b)
+{
+	char out_a[64], out_b[64];
+	int64_t ia, ib;
+	int32_t fa, fb;
+	double da, db;
+	bool ba, bb;
+	int ra, rb, fi, fj;
+	size_t k;
+
+	for (k = 0; k < N_ELEMENT(paths); k++) {
+		fi = a_json_find(a, 0, paths[k]);
+		fj = a_json_find(b, 0, paths[k]);
+		if (fi != fj || (fi >= 0 && a->entry[fi].type != b->entry[fj].type))
+			abort();
+		ra = a_json_get_prop_str(a, paths[k], out_a, sizeof(out_a));
+		rb = a_json_get_prop_str(b, paths[k], out_b, sizeof(out_b));
+		if (ra != rb || (ra >= 0 && memcmp(out_a, out_b, ra + 1) != 0))
+			abort();
+		if (a_json_comp_prop_val(a, paths[k], "abc") != a_json_comp_prop_val(b, paths[k], "abc"))
+			abort();
+		ra = a_json_get_prop_int64(a, paths[k], &ia);
+		rb = a_json_get_prop_int64(b, paths[k], &ib);
+		if (ra != rb || (ra == JSON_OK && ia != ib))
+			abort();
+		ra = a_json_get_prop_fixed(a, paths[k], 2, &fa);
+		rb = a_json_get_prop_fixed(b, paths[k], 2, &fb);
+		if (ra != rb || (ra == JSON_OK && fa != fb))
+			abort();
+		ra = a_json_get_prop_double(a, paths[k], &da);
+		rb = a_json_get_prop_double(b, paths[k], &db);
+		if (ra != rb || (ra == JSON_OK && memcmp(&da, &db, sizeof(da)) != 0))
+			abort();
+		ra = a_json_get_prop_bool(a, paths[k], &ba);
+		rb = a_json_get_prop_bool(b, paths[k], &bb);
+		if (ra != rb || (ra == JSON_OK && ba != bb))
+			abort();
+		if (a_json_prop_is_null(a, paths[k]) != a_json_prop_is_null(b, paths[k]) ||
+		    a_json_get_prop_int(a, paths[k], 0, 10) != a_json_get_prop_int(b, paths[k], 0, 10))
+			abort();
+	}
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static a_json_rpc_t rpc;
+	a_json_t json, json_inplace;
+	a_json_entry_t *entry, *entry_inplace;
+	char *buf, *src;
+	size_t buf_len, entry_len, chunk, p, n, q;
+	char sep;
+
+	if (size < OPT_BYTES)
+		return 0;
+	if (rpc.methods == NULL && a_json_rpc_init(&rpc, methods, N_ELEMENT(methods)) < 0)
+		abort();
+
+	buf_len = 1 + data[0];
+	entry_len = 1 + data[1] % 40;
+	sep = (data[2] & 1) ? ',' : '\0';
+	chunk = 1 + data[3] % 17;	/* 17 is byte by byte */
+	data += OPT_BYTES;
+	size -= OPT_BYTES;
+
+	/* copy mode, fed in chunks */
+	buf = malloc(buf_len);
+	entry = malloc(entry_len * sizeof(*entry));
+	a_json_init(&json, buf, buf_len, entry, entry_len, sep);
+	for (p = 0; p < size; p += n) {
+		n = (chunk < size - p) ? chunk : size - p;
+		if (chunk == 17) {
+			for (q = 0; q < n; q++)
+				if (a_json_append(&json, (char)data[p + q]))
+					break;
+			if (q < n)
+				break;
+		} else if (a_json_append_str_sized(&json, (char*)data + p, n)) {
+			break;
+		}
+	}
+	check(&json, buf_len);
+	access_all(&json);
+
+	/* in-place mode must not write the source, it takes no empty one */
+	src = malloc(size + 1);
+	memcpy(src, data, size);
+	entry_inplace = malloc(entry_len * sizeof(*entry_inplace));
+	if (size > 0) {
+		a_json_parse_inplace(&json_inplace, src, size, entry_inplace, entry_len);
+		check(&json_inplace, size);
+		access_all(&json_inplace);
+		if (memcmp(src, data, size) != 0)
+			abort();
+		if (a_json_is_good(&json) && a_json_is_good(&json_inplace))
+			compare(&json, &json_inplace);
+	}
+
+	a_json_rpc_dispatch(&rpc, src, size, NULL);
+	free(buf);
+	free(src);
+	free(entry);
+	free(entry_inplace);
+	return 0;
+}
+
+#ifndef LIBFUZZER
+
+static const char *dict[] = {
+	"{", "}", "[", "]", ",", ":", "\"", "\\", "\\u", "d83d", "\\ude00", "true", "false",
+	"null", "-", "0", "1.5e3", "e", "E", "+", ".", "\"method\"", "\"params\"",
+	"\"levels\"", " ", "\n", "\\n", "\\\"", "x", "\xff", "\x01",
+	"-9223372036854775808", "99999999999999999999", "1e-30",
+};
+
+static int run_file(const char *name)
+{
+	FILE *fp = fopen(name, "rb");
+	uint8_t *data;
+	long size;
+
+	if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+		perror(name);
+		return 1;
+	}
+	rewind(fp);
+	data = malloc(size + 1);
+	if (fread(data, 1, size, fp) != (size_t)size) {
+		perror(name);
+		return 1;
+	}
+	fclose(fp);
+	LLVMFuzzerTestOneInput(data, size);
+	free(data);
+	return 0;
+}
+
+static const char *gen_keys[] = {
+	"\"method\"", "\"params\"", "\"levels\"", "\"a\"", "\"b\"", "\"c\"", "\"t\"",
+	"\"x\\u0065\"", "\"xe\"", "\"\"",
+};
+
+static const char *gen_atoms[] = {
+	"0", "-1", "42", "1.5e3", "-0.25", "1e-30", "3e9", "-9223372036854775808",
+	"99999999999999999999", "true", "false", "null", "\"abc\"", "\"a\\\"b\"",
+	"\"\\u00e9\\n\"", "\"\\ud83d\\ude00\"", "\"\\ud83d\"", "\"\\/\\\\\"", "\"\"",
+};
+
+static size_t gen_put(uint8_t *out, size_t len, size_t cap, const char *s)
+{
+	size_t n = strlen(s);
+
+	if (len + n > cap)
+		return len;
+	memcpy(out + len, s, n);
+	return len + n;
+}
+
+/* well formed document, so that both modes parse and get compared */
+static size_t gen_value(uint8_t *out, size_t len, size_t cap, int depth)
+{
+	int i, n, obj;
+
+	if (depth > 3 || rand() % 3 == 0)
+		return gen_put(out, len, cap, gen_atoms[rand() % N_ELEMENT(gen_atoms)]);
+	obj = rand() % 3 != 0;
+	len = gen_put(out, len, cap, obj ? "{" : "[");
+	n = rand() % 4;
+	for (i = 0; i < n; i++) {
+		if (i)
+			len = gen_put(out, len, cap, ",");
+		if (obj) {
+			len = gen_put(out, len, cap, gen_keys[rand() % N_ELEMENT(gen_keys)]);
+			len = gen_put(out, len, cap, ":");
+		}
+		len = gen_value(out, len, cap, depth + 1);
+	}
+	return gen_put(out, len, cap, obj ? "}" : "]");
+}
+
+/* dictionary tokens mixed with random bytes, every other one a well
+ * formed document */
+static void run_generated(long iters)
+{
+	uint8_t in[OPT_BYTES + 256];
+	size_t len, cap, tl;
+	const char *t;
+	long i;
+
+	srand(1);
+	for (i = 0; i < iters; i++) {
+		for (len = 0; len < OPT_BYTES; len++)
+			in[len] = (uint8_t)rand();
+		cap = OPT_BYTES + 1 + rand() % 200;
+		if (i % 2) {
+			/* no random cap, a cut document would only test the error paths */
+			len = gen_value(in, len, sizeof(in) - 1, 0);
+			LLVMFuzzerTestOneInput(in, len);
+			continue;
+		}
+		while (len < cap) {
+			if (rand() % 4 == 0) {
+				in[len++] = (uint8_t)rand();
+				continue;
+			}
+			t = dict[rand() % N_ELEMENT(dict)];
+			tl = strlen(t);
+			if (len + tl > cap)
+				break;
+			memcpy(in + len, t, tl);
+			len += tl;
+		}
+		LLVMFuzzerTestOneInput(in, len);
+	}
+	printf("%ld inputs ok\n", iters);
+}
+
+int main(int argc, char **argv)
+{
+	const char *env = getenv("FUZZ_ITERS");
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			if (run_file(argv[i]))
+				return 1;
+		return 0;
+	}
+	run_generated(env ? atol(env) : 200000);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "json_parser.h"
+#include "json_rpc.h"
+
+static int fails;
+
+#define CHECK(c) do {							\
+		if (!(c)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #c);	\
+			fails++;					\
+		}							\
+	} while (0)
+
+static a_json_t json;
+static a_json_entry_t entry[32];
+
+static bool parse(const char *s)
+{
+	return a_json_parse_inplace(&json, s, strlen(s), entry, N_ELEMENT(entry));
+}
+
+static void test_fixed(void)
+{
+	int32_t v;
+
+	CHECK(parse("{\"a\":1.25,\"b\":-1.25,\"c\":12,\"d\":1e-30,\"e\":3e9}"));
+	CHECK(a_json_get_prop_fixed(&json, "a", 1, &v) == JSON_OK && v == 13);
+	CHECK(a_json_get_prop_fixed(&json, "b", 1, &v) == JSON_OK && v == -13);
+	CHECK(a_json_get_prop_fixed(&json, "c", 3, &v) == JSON_OK && v == 12000);
+	CHECK(a_json_get_prop_fixed(&json, "d", 2, &v) == JSON_OK && v == 0);
+	CHECK(a_json_get_prop_fixed(&json, "e", 0, &v) == JSON_ERR_RANGE);
+
+	/* INT64_MIN can not be negated */
+	CHECK(parse("{\"x\":-9223372036854775808}"));
+	CHECK(a_json_get_prop_fixed(&json, "x", -3, &v) == JSON_ERR_RANGE);
+	CHECK(a_json_get_prop_fixed(&json, "x", -18, &v) == JSON_OK && v == -9);
+	CHECK(a_json_get_prop_fixed(&json, "x", -19, &v) == JSON_OK && v == -1);
+	CHECK(a_json_get_prop_fixed(&json, "x", 0, &v) == JSON_ERR_RANGE);
+}
+
+static void test_int64(void)
+{
+	int64_t v;
+
+	CHECK(parse("{\"a\":-9223372036854775808,\"b\":1.5,\"c\":25e-1,\"d\":\"1\"}"));
+	CHECK(a_json_get_prop_int64(&json, "a", &v) == JSON_OK && v == INT64_MIN);
+	CHECK(a_json_get_prop_int64(&json, "b", &v) == JSON_ERR_TYPE);
+	CHECK(a_json_get_prop_int64(&json, "d", &v) == JSON_ERR_TYPE);
+	CHECK(a_json_get_prop_int64(&json, "z", &v) == JSON_ERR_NOT_FOUND);
+}
+
+/* the same document parsed in copy mode and in place */
+static a_json_t copy, inplace;
+static char copy_buf[4096];
+static a_json_entry_t copy_entry[256], inplace_entry[256];
+
+static bool parse_both(const char *s)
+{
+	bool ok;
+
+	a_json_init(&copy, copy_buf, sizeof(copy_buf), copy_entry, N_ELEMENT(copy_entry), '\0');
+	a_json_append_str_sized(&copy, (char*)s, strlen(s));
+	ok = a_json_is_good(&copy);
+	return a_json_parse_inplace(&inplace, s, strlen(s), inplace_entry, N_ELEMENT(inplace_entry)) && ok;
+}
+
+static bool str_is(a_json_t *j, const char *prop, const char *v)
+{
+	char out[64];
+
+	return (a_json_get_prop_str(j, prop, out, sizeof(out)) == (int)strlen(v) &&
+		strcmp(out, v) == 0 && a_json_comp_prop_val(j, prop, v) == 0);
+}
+
+static bool int_is(a_json_t *j, const char *prop, int64_t v)
+{
+	int64_t got;
+
+	return a_json_get_prop_int64(j, prop, &got) == JSON_OK && got == v;
+}
+
+static void test_nested(void)
+{
+	static const char doc[] = "{\"a\":{\"b\":[1,{\"c\":\"x\"},{\"c\":42}]},"
+		"\"params\":{\"levels\":[10,20,30],\"t\":-1.5},\"e\":[[1,2],[3,[4,5]]],"
+		"\"n\":null,\"f\":false}";
+	a_json_t *j[] = { &copy, &inplace };
+	int32_t fixed;
+	size_t k;
+	bool b;
+	int i;
+
+	CHECK(parse_both(doc));
+	for (k = 0; k < N_ELEMENT(j); k++) {
+		CHECK(str_is(j[k], "a.b[1].c", "x"));
+		CHECK(int_is(j[k], "a.b[2].c", 42));
+		CHECK(int_is(j[k], "a.b[0]", 1));
+		CHECK(int_is(j[k], "params.levels[1]", 20));
+		CHECK(a_json_get_prop_int(j[k], "params.levels[2]", 0, 100) == 30);
+		CHECK(a_json_get_prop_fixed(j[k], "params.t", 1, &fixed) == JSON_OK && fixed == -15);
+		CHECK(int_is(j[k], "e[1][1][0]", 4));
+		CHECK(int_is(j[k], "e[0][1]", 2));
+		CHECK(a_json_prop_is_null(j[k], "n"));
+		CHECK(a_json_get_prop_bool(j[k], "f", &b) == JSON_OK && !b);
+
+		CHECK(a_json_find(j[k], 0, "a.b[3]") < 0);
+		CHECK(a_json_find(j[k], 0, "a.c") < 0);
+		CHECK(a_json_find(j[k], 0, "params.levels.x") < 0);
+		i = a_json_find(j[k], 0, "a.b");
+		CHECK(i > 0 && j[k]->entry[i].type == JSON_TYPE_ARRAY && j[k]->entry[i].size == 3);
+
+		/* relative to an inner entry */
+		i = a_json_find(j[k], 0, "params");
+		i = a_json_find(j[k], i, "levels[0]");
+		CHECK(i > 0 && j[k]->entry[i].num == 10);
+	}
+}
+
+/* copy mode unescapes while parsing, in place on access */
+static void test_escapes(void)
+{
+	static const char doc[] = "{\"s\":\"a\\\"b\\\\c\\/d\\n\\t\\u0041\\u00e9\\ud83d\\ude00\","
+		"\"k\\u0065y\":1,\"plain\":\"abc\",\"esc\":[\"\\u20ac\"]}";
+	static const char s[] = "a\"b\\c/d\n\tA\xc3\xa9\xf0\x9f\x98\x80";
+	a_json_t *j[] = { &copy, &inplace };
+	char out[8];
+	size_t k;
+
+	CHECK(parse_both(doc));
+	for (k = 0; k < N_ELEMENT(j); k++) {
+		CHECK(str_is(j[k], "s", s));
+		CHECK(int_is(j[k], "key", 1));
+		CHECK(str_is(j[k], "plain", "abc"));
+		CHECK(str_is(j[k], "esc[0]", "\xe2\x82\xac"));
+		/* no room for the '\0' */
+		CHECK(a_json_get_prop_str(j[k], "plain", out, 3) == -1);
+		CHECK(a_json_get_prop_str(j[k], "esc[0]", out, 3) == -1);
+	}
+	CHECK(a_json_get_prop(&copy, "s") && strcmp(a_json_get_prop(&copy, "s"), s) == 0);
+	CHECK(a_json_get_prop(&inplace, "s") == NULL);
+}
+
+/* every member is found with its own value, with the index full or
+ * not, and same names under different parents stay apart */
+static void test_hash(void)
+{
+	static char doc[2048];
+	a_json_t *j[] = { &copy, &inplace };
+	char name[16];
+	int keys[] = { 4, A_JSON_HASH_SIZE - 1, 100 };
+	size_t k, t;
+	int i, n, missed;
+
+	for (t = 0; t < N_ELEMENT(keys); t++) {
+		n = snprintf(doc, sizeof(doc), "{\"x\":{\"id\":1},\"y\":{\"id\":2}");
+		for (i = 0; i < keys[t]; i++)
+			n += snprintf(doc + n, sizeof(doc) - n, ",\"k%d\":%d", i, i * 3);
+		snprintf(doc + n, sizeof(doc) - n, "}");
+
+		CHECK(parse_both(doc));
+		for (k = 0; k < N_ELEMENT(j); k++) {
+			missed = 0;
+			for (i = 0; i < keys[t]; i++) {
+				snprintf(name, sizeof(name), "k%d", i);
+				if (!int_is(j[k], name, i * 3))
+					missed++;
+			}
+			CHECK(missed == 0);
+			CHECK(int_is(j[k], "x.id", 1) && int_is(j[k], "y.id", 2));
+			CHECK(a_json_find(j[k], 0, "id") < 0);
+			CHECK(a_json_find(j[k], 0, "k") < 0);
+		}
+	}
+}
+
+static int32_t led_level;
+
+static void rpc_led(void *arg, a_json_t *json, const int32_t *v)
+{
+	led_level = v[0];
+}
+
+static const a_json_rpc_param_t led_params[] = {
+	{ "params.a", JSON_RPC_INT, 0, 100 },
+};
+
+static const a_json_rpc_method_t methods[] = {
+	{ "led", rpc_led, led_params, N_ELEMENT(led_params) },
+};
+
+static void test_rpc(void)
+{
+	static const char big[] = "{\"jsonrpc\":\"2.0\",\"method\":\"led\","
+		"\"params\":{\"a\":1,\"b\":2,\"c\":3,\"d\":[1,2,3,4]},\"id\":1}";
+	static const char bad[] = "{\"method\":\"led\",";
+	char s[256];
+	a_json_rpc_t rpc;
+	int i, n;
+
+	CHECK(a_json_rpc_init(&rpc, methods, N_ELEMENT(methods)) == 0);
+	CHECK(a_json_rpc_dispatch(&rpc, big, strlen(big), NULL) == JSON_RPC_OK && led_level == 1);
+	CHECK(a_json_rpc_dispatch(&rpc, bad, strlen(bad), NULL) == JSON_RPC_PARSE_ERROR);
+
+	/* more values than the table holds is not a parse error */
+	n = snprintf(s, sizeof(s), "{\"method\":\"led\",\"params\":[");
+	for (i = 0; i < JSON_RPC_MAX_ENTRY; i++)
+		n += snprintf(s + n, sizeof(s) - n, "%s%d", i ? "," : "", i);
+	snprintf(s + n, sizeof(s) - n, "]}");
+	CHECK(a_json_rpc_dispatch(&rpc, s, strlen(s), NULL) == JSON_RPC_TOO_LARGE);
+}
+
+int main(void)
+{
+	test_fixed();
+	test_int64();
+	test_nested();
+	test_escapes();
+	test_hash();
+	test_rpc();
+	if (fails)
+		return 1;
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota_delta.h"
+
+/* ota_delta.c against tools/ota_delta.py
+ *
+ * ota_delta_test gen <dir>	write dir/old.bin and dir/new.bin
+ * ota_delta_test <dir>		apply dir/new.delta to dir/old.bin
+ *
+ * The delta is made by the Makefile, output must be new.bin bit for bit
+ * however the patch is split.
+ */
+
+#define OLD_SIZE	(300 * 1024)
+
+typedef struct {
+	const uint8_t *src;
+	uint32_t src_len;
+	uint8_t *out;
+	uint32_t out_len;
+	uint32_t out_max;
+} image_t;
+
+static int failures;
+
+#define CHECK(c) do { \
+	if (!(c)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #c); \
+		failures++; \
+	} \
+} while (0)
+
+static int _read(void *arg, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+	image_t *im = arg;
+
+	if (offset > im->src_len || len > im->src_len - offset)
+		return -1;
+	memcpy(buf, im->src + offset, len);
+	return 0;
+}
+
+static int _write(void *arg, const uint8_t *buf, uint32_t len)
+{
+	image_t *im = arg;
+
+	if (len > im->out_max - im->out_len)
+		return -1;
+	memcpy(im->out + im->out_len, buf, len);
+	im->out_len += len;
+	return 0;
+}
+
+static uint8_t * load(const char *dir, const char *name, uint32_t *len)
+{
+	char path[256];
+	FILE *fp;
+	uint8_t *data;
+	long size;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "rb");
+	if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	rewind(fp);
+	data = malloc(size + 1);
+	if (fread(data, 1, size, fp) != (size_t)size) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+	*len = (uint32_t)size;
+	return data;
+}
+
+static void save(const char *dir, const char *name, const uint8_t *data, uint32_t len)
+{
+	char path[256];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "wb");
+	if (fp == NULL || fwrite(data, 1, len, fp) != len) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+}
+
+/* firmware like image: repeated instruction words, tables and blank gaps */
+static void gen(const char *dir)
+{
+	static uint8_t old[OLD_SIZE];
+	static uint8_t new[OLD_SIZE + 8192];
+	static const uint32_t ops[] = { 0x4770b500, 0xf000f8d4, 0x681b4b03, 0xbd082001, 0x46204611 };
+	uint32_t i, n, w;
+
+	srand(36);
+	for (i = 0; i < OLD_SIZE; i += 4) {
+		if (i % 65536 >= 61440)
+			w = 0;
+		else if (rand() % 4)
+			w = ops[rand() % 5];
+		else
+			w = (uint32_t)rand();
+		memcpy(old + i, &w, 4);
+	}
+
+	/* code inserted and removed, pointers after it move */
+	n = 0;
+	memcpy(new, old, 100000);
+	n += 100000;
+	for (i = 0; i < 3000; i++)
+		new[n++] = (uint8_t)rand();
+	memcpy(new + n, old + 100000, 80000);
+	n += 80000;
+	memcpy(new + n, old + 182000, OLD_SIZE - 182000);
+	n += OLD_SIZE - 182000;
+	for (i = 0; i < 400; i++)
+		new[(uint32_t)rand() % n] += 4;
+	for (i = 0; i < 5000; i++)
+		new[n++] = (uint8_t)rand();
+
+	save(dir, "old.bin", old, OLD_SIZE);
+	save(dir, "new.bin", new, n);
+}
+
+/* feed patch in pieces of 1..split bytes, 0 for one piece */
+static a_delta_err_t apply(image_t *im, const uint8_t *patch, uint32_t len, uint32_t split,
+			   a_delta_t *d)
+{
+	a_delta_err_t r = DELTA_OK;
+	uint32_t p, n;
+
+	im->out_len = 0;
+	a_delta_init(d, _read, _write, im);
+	for (p = 0; p < len && r == DELTA_OK; p += n) {
+		n = split ? 1 + (uint32_t)rand() % split : len;
+		if (n > len - p)
+			n = len - p;
+		r = a_delta_apply(d, patch + p, n);
+	}
+	return r;
+}
+
+static void test_apply(uint8_t *old, uint32_t old_len, const uint8_t *new, uint32_t new_len,
+		       uint8_t *patch, uint32_t patch_len)
+{
+	static const uint32_t splits[] = { 0, 1, 3, 12, 13, 255, 4096 };
+	image_t im;
+	a_delta_t d;
+	uint32_t i, k;
+	uint8_t bit;
+
+	im.src = old;
+	im.src_len = old_len;
+	im.out_max = new_len;
+	im.out = malloc(new_len);
+
+	for (i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) {
+		CHECK(apply(&im, patch, patch_len, splits[i], &d) == DELTA_OK);
+		CHECK(a_delta_is_finished(&d));
+		CHECK(im.out_len == new_len && memcmp(im.out, new, new_len) == 0);
+	}
+
+	/* header is known before any output */
+	a_delta_init(&d, _read, _write, &im);
+	im.out_len = 0;
+	CHECK(a_delta_apply(&d, patch, A_DELTA_HEADER_SIZE - 1) == DELTA_OK && !a_delta_has_header(&d));
+	CHECK(a_delta_apply(&d, patch + A_DELTA_HEADER_SIZE - 1, 1) == DELTA_OK && a_delta_has_header(&d));
+	CHECK(d.source_len == old_len && d.target_len == new_len && im.out_len == 0);
+	CHECK(memcmp(d.source_hash, patch + 12, A_DELTA_HASH_SIZE) == 0);
+
+	/* shorter source fails, never reads past it */
+	im.src_len = old_len / 2;
+	CHECK(apply(&im, patch, patch_len, 0, &d) == DELTA_ERR_SOURCE);
+	im.src_len = old_len;
+
+	/* truncated patch does not finish */
+	CHECK(apply(&im, patch, patch_len - 1, 0, &d) == DELTA_OK && !a_delta_is_finished(&d));
+	/* trailing bytes are an error */
+	CHECK(a_delta_apply(&d, patch + patch_len - 1, 1) == DELTA_OK && a_delta_is_finished(&d));
+	CHECK(a_delta_apply(&d, patch, 1) == DELTA_ERR_FORMAT);
+
+	/* broken patch stays in bounds */
+	for (i = 0; i < 2000; i++) {
+		k = A_DELTA_HEADER_SIZE + (uint32_t)rand() % (patch_len - A_DELTA_HEADER_SIZE);
+		bit = (uint8_t)(1 << (rand() % 8));
+		patch[k] ^= bit;
+		apply(&im, patch, patch_len, 4096, &d);
+		CHECK(im.out_len <= new_len);
+		patch[k] ^= bit;
+	}
+	free(im.out);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *old, *new, *patch;
+	uint32_t old_len, new_len, patch_len;
+
+	if (argc == 3 && strcmp(argv[1], "gen") == 0) {
+		gen(argv[2]);
+		return 0;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s [gen] <dir>\n", argv[0]);
+		return 1;
+	}
+
+	old = load(argv[1], "old.bin", &old_len);
+	new = load(argv[1], "new.bin", &new_len);
+	patch = load(argv[1], "new.delta", &patch_len);
+	CHECK(a_delta_detect(patch, patch_len));
+	test_apply(old, old_len, new, new_len, patch, patch_len);
+	printf("%u -> %u bytes from %u bytes of delta\n", old_len, new_len, patch_len);
+
+	free(old);
+	free(new);
+	free(patch);
+	if (failures)
+		printf("%d failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota_lz.h"
+
+/* ota_lz.c against tools/ota_compress.py
+ *
+ * ota_lz_test gen <dir>	write dir/lz.bin
+ * ota_lz_test <dir>		decode dir/lz10.hs, dir/lz8.hs and dir/lz12.hs
+ *
+ * The Makefile compresses lz.bin with window bits 10 (default), 8 and 12.
+ * Decoded images must be lz.bin bit for bit however the input is split,
+ * 12 is over A_LZ_WINDOW_BITS and must be refused.
+ */
+
+#define IMAGE_SIZE	(128 * 1024)
+
+typedef struct {
+	uint8_t *out;
+	uint32_t out_len;
+	uint32_t out_max;
+} image_t;
+
+static int failures;
+
+#define CHECK(c) do { \
+	if (!(c)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #c); \
+		failures++; \
+	} \
+} while (0)
+
+static int _write(void *arg, const uint8_t *buf, uint32_t len)
+{
+	image_t *im = arg;
+
+	if (len > im->out_max - im->out_len)
+		return -1;
+	memcpy(im->out + im->out_len, buf, len);
+	im->out_len += len;
+	return 0;
+}
+
+static uint8_t * load(const char *dir, const char *name, uint32_t *len)
+{
+	char path[256];
+	FILE *fp;
+	uint8_t *data;
+	long size;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "rb");
+	if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	rewind(fp);
+	data = malloc(size + 1);
+	if (fread(data, 1, size, fp) != (size_t)size) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+	*len = (uint32_t)size;
+	return data;
+}
+
+/* firmware like image: repeated instruction words, strings and blank gaps */
+static void gen(const char *dir)
+{
+	static uint8_t image[IMAGE_SIZE];
+	static const uint32_t ops[] = { 0x4770b500, 0xf000f8d4, 0x681b4b03, 0xbd082001, 0x46204611 };
+	static const char *strs[] = { "Fail to write flash\n", "OTA server : %s \n", "upgrade" };
+	char path[256];
+	FILE *fp;
+	const char *s;
+	uint32_t i, w;
+	size_t n;
+
+	srand(37);
+	for (i = 0; i + 32 <= IMAGE_SIZE; ) {
+		if (i % 32768 >= 28672) {
+			w = 0xFFFFFFFF;
+		} else if (rand() % 16 == 0) {
+			s = strs[rand() % 3];
+			n = strlen(s);
+			memcpy(image + i, s, n);
+			i += (uint32_t)n;
+			continue;
+		} else {
+			w = (rand() % 4) ? ops[rand() % 5] : (uint32_t)rand();
+		}
+		memcpy(image + i, &w, 4);
+		i += 4;
+	}
+
+	snprintf(path, sizeof(path), "%s/lz.bin", dir);
+	fp = fopen(path, "wb");
+	if (fp == NULL || fwrite(image, 1, IMAGE_SIZE, fp) != IMAGE_SIZE) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+}
+
+/* feed in pieces of 1..split bytes, 0 for one piece */
+static a_lz_err_t apply(image_t *im, const uint8_t *z, uint32_t len, uint32_t split, a_lz_t *d)
+{
+	a_lz_err_t r = LZ_OK;
+	uint32_t p, n;
+
+	im->out_len = 0;
+	a_lz_init(d, _write, im);
+	for (p = 0; p < len && r == LZ_OK; p += n) {
+		n = split ? 1 + (uint32_t)rand() % split : len;
+		if (n > len - p)
+			n = len - p;
+		r = a_lz_apply(d, z + p, n);
+	}
+	return r;
+}
+
+static void test_decode(const uint8_t *image, uint32_t image_len, uint8_t *z, uint32_t z_len)
+{
+	static const uint32_t splits[] = { 0, 1, 2, 11, 12, 13, 255, 4096 };
+	static a_lz_t d;
+	image_t im;
+	uint32_t i, k;
+	uint8_t bit;
+
+	im.out_max = image_len;
+	im.out = malloc(image_len);
+
+	CHECK(a_lz_detect(z, z_len));
+	for (i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) {
+		CHECK(apply(&im, z, z_len, splits[i], &d) == LZ_OK);
+		CHECK(a_lz_is_finished(&d));
+		CHECK(im.out_len == image_len && memcmp(im.out, image, image_len) == 0);
+	}
+
+	/* truncated input does not finish */
+	CHECK(apply(&im, z, z_len - 1, 0, &d) == LZ_OK && !a_lz_is_finished(&d));
+	CHECK(im.out_len < image_len);
+
+	/* output failure is reported */
+	im.out_max = image_len / 2;
+	CHECK(apply(&im, z, z_len, 0, &d) == LZ_ERR_WRITE);
+	im.out_max = image_len;
+
+	/* broken input stays in bounds */
+	for (i = 0; i < 1000; i++) {
+		k = A_LZ_HEADER_SIZE + (uint32_t)rand() % (z_len - A_LZ_HEADER_SIZE);
+		bit = (uint8_t)(1 << (rand() % 8));
+		z[k] ^= bit;
+		apply(&im, z, z_len, 4096, &d);
+		CHECK(im.out_len <= image_len);
+		z[k] ^= bit;
+	}
+	free(im.out);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "lz10.hs", "lz8.hs" };
+	static a_lz_t d;
+	uint8_t *image, *z;
+	uint32_t image_len, z_len;
+	image_t im;
+	size_t i;
+
+	if (argc == 3 && strcmp(argv[1], "gen") == 0) {
+		gen(argv[2]);
+		return 0;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s [gen] <dir>\n", argv[0]);
+		return 1;
+	}
+
+	image = load(argv[1], "lz.bin", &image_len);
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		z = load(argv[1], names[i], &z_len);
+		test_decode(image, image_len, z, z_len);
+		printf("%s: %u -> %u bytes\n", names[i], z_len, image_len);
+		free(z);
+	}
+
+	/* window larger than the decoder RAM */
+	z = load(argv[1], "lz12.hs", &z_len);
+	im.out = NULL;
+	im.out_len = im.out_max = 0;
+	CHECK(apply(&im, z, z_len, 0, &d) == LZ_ERR_FORMAT);
+	free(z);
+
+	free(image);
+	if (failures)
+		printf("%d failures\n", failures);
+	return failures ? 1 : 0;
+}
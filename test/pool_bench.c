@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <time.h>
+#include <unistd.h>
+
+#include "wiced.h"
+#include "eventloop.h"
+#include "sys_worker.h"
+
+/* sys_pool throughput from 1 to SYS_POOL_MAX_THREADS threads.
+ *
+ * The eventloop submits bursts of root jobs, each root submits child
+ * jobs from its pool thread, so both the eventloop deque and the
+ * per-thread deques with stealing are loaded.
+ *
+ * pool_bench [work]	work is the loop count of a job, default 2000
+ *
+ * Speedup is bounded by the CPUs of the host, it is printed first.
+ */
+
+#define ROOTS		20000
+#define BURST		256
+#define CHILDREN	8
+#define QUEUE_SIZE	256
+
+static eventloop_t evt;
+static sys_pool_t pool;
+static eventloop_timer_node_t feed_node;
+
+static int work;
+static int roots_sent;
+static int roots_done;
+static long executed;
+static long inline_runs;	/* deque full, child ran in its root */
+
+static void spin(void)
+{
+	volatile unsigned int x = 0;
+	int i;
+
+	for (i = 0; i < work; i++)
+		x += i;
+}
+
+static void child(void *arg)
+{
+	spin();
+	__atomic_add_fetch(&executed, 1, __ATOMIC_RELAXED);
+}
+
+static void root(void *arg)
+{
+	int i;
+
+	for (i = 0; i < CHILDREN; i++) {
+		if (a_sys_pool_submit(&pool, child, NULL, NULL) != WICED_SUCCESS) {
+			__atomic_add_fetch(&inline_runs, 1, __ATOMIC_RELAXED);
+			child(NULL);
+		}
+	}
+	spin();
+	__atomic_add_fetch(&executed, 1, __ATOMIC_RELAXED);
+}
+
+static void root_done(void *arg)
+{
+	if (++roots_done == ROOTS)
+		a_eventloop_break(&evt);
+}
+
+static void feed(void *arg)
+{
+	int i;
+
+	for (i = 0; i < BURST && roots_sent < ROOTS; i++) {
+		if (a_sys_pool_submit(&pool, root, root_done, NULL) != WICED_SUCCESS)
+			break;
+		roots_sent++;
+	}
+}
+
+/* returns jobs per second */
+static double run(int n_threads)
+{
+	struct timespec t0, t1;
+	double sec;
+
+	roots_sent = roots_done = 0;
+	executed = inline_runs = 0;
+
+	a_eventloop_init(&evt);
+	if (a_sys_pool_init(&pool, &evt, 1, n_threads, 4096, QUEUE_SIZE) != WICED_SUCCESS) {
+		printf("pool init failed\n");
+		exit(1);
+	}
+	a_eventloop_register_timer(&evt, &feed_node, feed, 1, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	a_eventloop(&evt, WICED_WAIT_FOREVER);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	a_eventloop_deregister_timer(&evt, &feed_node);
+	a_sys_pool_deinit(&pool);
+
+	if (executed != (long)ROOTS * (CHILDREN + 1)) {
+		printf("lost jobs: %ld of %ld\n", executed, (long)ROOTS * (CHILDREN + 1));
+		exit(1);
+	}
+	sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	return executed / sec;
+}
+
+int main(int argc, char **argv)
+{
+	double base = 0, r;
+	int n;
+
+	work = (argc > 1) ? atoi(argv[1]) : 2000;
+	printf("%ld CPUs, %d jobs of %d loops\n", sysconf(_SC_NPROCESSORS_ONLN),
+	       ROOTS * (CHILDREN + 1), work);
+
+	for (n = 1; n <= SYS_POOL_MAX_THREADS; n *= 2) {
+		r = run(n);
+		if (n == 1)
+			base = r;
+		printf("threads %d: %9.0f jobs/s  x%.2f  (inline %ld)\n", n, r, r / base, inline_runs);
+	}
+	return 0;
+}
@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+#include "wiced_host.h"
+#include "eventloop.h"
+#include "sys_ssi.h"
+
+/* sys_ssi transaction queue against simulated EMDs on one bus. The
+ * EMDs answer from the uart transmit hook into the rx ring, the way
+ * the line would. Checks device selection and batching, order per
+ * device, reply data, writes, error replies and a missing device.
+ * First the blocking block and scatter reads of maxim_ssi run on the
+ * same EMDs, before sys_ssi owns the uart. */
+
+static int fails;
+
+#define CHECK(c) do {							\
+		if (!(c)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #c);	\
+			fails++;					\
+		}							\
+	} while (0)
+
+#define EMDS		4
+#define ABSENT		3	/* on the list, does not answer */
+#define MAP_SIZE	((MAX_REG_ADRS + 1) * 3)
+
+static const unsigned char emd_ssid[EMDS] = { 0x21, 0x22, 0x05, 0x30 };
+
+typedef struct {
+	uint8_t map[MAP_SIZE];
+	int ptr;		/* byte address */
+} emd_t;
+
+static emd_t emd[EMDS];
+static int emd_sel = -1;
+static int selects;
+static int packets;
+static int bad_packets;
+static int reads;		/* read commands */
+static uint8_t read_cmd;	/* last one and its byte count */
+static int read_len;
+static int emd_nack;		/* next request gets NACK */
+static int emd_bad_sum;		/* next reply has a bad checksum */
+
+static eventloop_t evt;
+static sys_ssi_t ssi;
+static uint8_t ring[2048];
+
+static void emd_reply(const uint8_t *payload, int n)
+{
+	uint8_t p[MAX_PACKET_LEN], sum = 0;
+	int i;
+
+	p[0] = ACK_DATA;
+	p[1] = n + 3;
+	memcpy(&p[2], payload, n);
+	for (i = 0; i < n + 2; i++)
+		sum += p[i];
+	p[n + 2] = -sum;
+	if (emd_bad_sum) {
+		p[n + 2] ^= 0x01;
+		emd_bad_sum = 0;
+	}
+	host_uart_rx(0, p, n + 3);
+}
+
+static void emd_single(uint8_t c)
+{
+	host_uart_rx(0, &c, 1);
+}
+
+static void emd_select(unsigned char ssid)
+{
+	int i;
+
+	selects++;
+	emd_sel = -1;
+	for (i = 0; i < EMDS; i++)
+		if (emd_ssid[i] == ssid && i != ABSENT)
+			emd_sel = i;
+	if (emd_sel >= 0)
+		emd_single(ACK_NO_DATA);
+}
+
+/* request packet from sys_ssi, answered by the selected EMD */
+static void emd_fn(wiced_uart_t uart, const uint8_t *p, uint32_t n)
+{
+	uint8_t out[MAX_PACKET_LEN], sum = 0, c;
+	uint32_t i, k, o = 0;
+	emd_t *e;
+
+	packets++;
+	for (i = 0; i < n; i++)
+		sum += p[i];
+	if (n < 4 || p[0] != HEADER || p[1] != n || sum != 0) {
+		bad_packets++;
+		return;
+	}
+	if (p[2] == SELECT_TRGT) {
+		emd_select(p[3]);
+		return;
+	}
+	if ((p[2] & 0xF0) == DE_SELECT_TRGT) {
+		emd_select(p[2] & 0x0F);
+		return;
+	}
+	if (emd_sel < 0)
+		return;
+	if (emd_nack) {
+		emd_nack = 0;
+		emd_single(NACK);
+		return;
+	}
+
+	e = &emd[emd_sel];
+	for (i = 2; i < n - 1;) {
+		c = p[i++];
+		if (c == RW_ADRS) {
+			e->ptr = p[i] | (p[i + 1] << 8);
+			i += 2;
+			continue;
+		}
+		k = c & 0x0F;
+		if ((c & 0xF0) == READ_BYTES && k == 0)
+			k = p[i++];
+		if (e->ptr + k > MAP_SIZE) {
+			emd_single(BAD_CMD);
+			return;
+		}
+		if ((c & 0xF0) == READ_BYTES) {
+			reads++;
+			read_cmd = c;
+			read_len = k;
+			memcpy(out + o, e->map + e->ptr, k);
+			o += k;
+		} else if ((c & 0xF0) == WRITE_BYTES) {
+			memcpy(e->map + e->ptr, p + i, k);
+			i += k;
+		} else {
+			emd_single(BAD_CMD);
+			return;
+		}
+		e->ptr += k;
+	}
+	if (o)
+		emd_reply(out, o);
+	else
+		emd_single(ACK_NO_DATA);
+}
+
+static int run_until(const int *done, int n, uint32_t ms)
+{
+	wiced_time_t t0, t;
+
+	wiced_time_get_time(&t0);
+	do {
+		a_eventloop(&evt, 5);
+		wiced_time_get_time(&t);
+	} while (*done < n && t - t0 < ms);
+	return *done >= n;
+}
+
+/* blocking reads of maxim_ssi, short and counted forms, the packet
+ * limit, error replies and scatter runs */
+static void test_maxim(void)
+{
+	static const int adrs[] = { 40, 1, 3, 2, 10, 14, 60, 20 };
+	uint8_t buf[(MAX_READ_REGS + 1) * 3];
+	int far[26], i;
+	int n = sizeof(adrs) / sizeof(adrs[0]);
+
+	CHECK(ssi_select_device(emd_ssid[1]) == 0 && emd_sel == 1);
+
+	/* up to 15 bytes the count is in the command */
+	packets = 0;
+	CHECK(ssi_read_block(7, 5, buf) == 0);
+	CHECK(read_cmd == (READ_BYTES | 15) && read_len == 15);
+	CHECK(memcmp(buf, emd[1].map + 7 * 3, 15) == 0);
+	CHECK(ssi_read_block(7, 6, buf) == 0);
+	CHECK(read_cmd == READ_BYTES && read_len == 18);
+	CHECK(memcmp(buf, emd[1].map + 7 * 3, 18) == 0);
+	CHECK(ssi_read_3bytes(9) != NULL && memcmp(ssi_read_3bytes(9), emd[1].map + 27, 3) == 0);
+
+	/* a full reply packet, one more is not sent */
+	CHECK(ssi_read_block(0, MAX_READ_REGS, buf) == 0);
+	CHECK(MAX_READ_REGS == 84 && read_len == 84 * 3);
+	CHECK(memcmp(buf, emd[1].map, 84 * 3) == 0);
+	i = packets;
+	CHECK(ssi_read_block(0, MAX_READ_REGS + 1, buf) == -1 && packets == i);
+	CHECK(ssi_read_block(0, 0, buf) == -1 && packets == i);
+	CHECK(bad_packets == 0);
+
+	/* error replies fail, the next read is good */
+	emd_nack = 1;
+	CHECK(ssi_read_block(3, 2, buf) == -1);
+	emd_bad_sum = 1;
+	CHECK(ssi_read_block(3, 2, buf) == -1);
+	CHECK(ssi_read_block(3, 2, buf) == 0 && memcmp(buf, emd[1].map + 9, 6) == 0);
+
+	/* runs 1-3, 10-14 over a gap of SCATTER_GAP, 20, 40, 60 */
+	reads = 0;
+	memset(buf, 0, sizeof(buf));
+	CHECK(ssi_read_scatter(adrs, n, buf) == 0);
+	CHECK(reads == 5);
+	for (i = 0; i < n; i++)
+		CHECK(memcmp(buf + i * 3, emd[1].map + adrs[i] * 3, 3) == 0);
+
+	/* every 4th register, runs end at the packet limit */
+	for (i = 0; i < 26; i++)
+		far[i] = (25 - i) * 4;
+	reads = 0;
+	CHECK(ssi_read_scatter(far, 26, buf) == 0);
+	CHECK(reads == 2);
+	for (i = 0; i < 26; i++)
+		CHECK(memcmp(buf + i * 3, emd[1].map + far[i] * 3, 3) == 0);
+
+	emd_nack = 1;
+	CHECK(ssi_read_scatter(adrs, n, buf) == -1);
+	CHECK(ssi_read_scatter(adrs, 0, buf) == -1);
+	selects = packets = 0;
+}
+
+#define METERS		3
+#define PER_METER	12
+#define READ_REGS	10
+
+static sys_ssi_xfer_t xfer[METERS][PER_METER];
+static uint8_t data[METERS][PER_METER][READ_REGS * 3];
+static int done;
+static int next_of[METERS];
+static int bad_replies;
+
+static void read_done(void *arg, sys_ssi_xfer_t *x, wiced_result_t result)
+{
+	int m = (int)(intptr_t)arg;
+	int k = x - xfer[m];
+
+	if (result != WICED_SUCCESS || x->len != READ_REGS * 3 ||
+	    memcmp(data[m][k], emd[m].map + k * 3, READ_REGS * 3) != 0)
+		bad_replies++;
+	/* in order per device */
+	if (k != next_of[m]++)
+		bad_replies++;
+	done++;
+}
+
+static void test_queue(void)
+{
+	int m, k;
+
+	for (k = 0; k < PER_METER; k++)
+		for (m = 0; m < METERS; m++)
+			CHECK(a_sys_ssi_read(&ssi, &xfer[m][k], emd_ssid[m], k, READ_REGS, data[m][k],
+					     read_done, (void*)(intptr_t)m) == WICED_SUCCESS);
+	/* still queued */
+	CHECK(a_sys_ssi_read(&ssi, &xfer[0][0], emd_ssid[0], 0, 1, data[0][0], read_done, NULL) != WICED_SUCCESS);
+
+	CHECK(run_until(&done, METERS * PER_METER, 5000));
+	printf("%d transactions, %d packets, %d selects\n", done, packets, selects);
+	CHECK(bad_replies == 0 && bad_packets == 0);
+	/* one select per batch, not per transaction */
+	CHECK(selects <= METERS * ((PER_METER + SYS_SSI_BATCH - 1) / SYS_SSI_BATCH) + 1);
+}
+
+static int one_done;
+static wiced_result_t one_result;
+
+static void one_fn(void *arg, sys_ssi_xfer_t *x, wiced_result_t result)
+{
+	one_result = result;
+	one_done++;
+}
+
+static void test_write_and_errors(void)
+{
+	sys_ssi_xfer_t x;
+	uint8_t buf[6];
+	uint32_t errors = ssi.errors;
+
+	memset(&x, 0, sizeof(x));
+
+	one_done = 0;
+	CHECK(a_sys_ssi_write(&ssi, &x, emd_ssid[2], 0x10, 0x123456, one_fn, NULL) == WICED_SUCCESS);
+	CHECK(run_until(&one_done, 1, 1000) && one_result == WICED_SUCCESS);
+	CHECK(emd[2].map[0x30] == 0x56 && emd[2].map[0x31] == 0x34 && emd[2].map[0x32] == 0x12);
+
+	/* read back, device stays selected */
+	one_done = 0;
+	selects = 0;
+	CHECK(a_sys_ssi_read(&ssi, &x, emd_ssid[2], 0x10, 1, buf, one_fn, NULL) == WICED_SUCCESS);
+	CHECK(run_until(&one_done, 1, 1000) && one_result == WICED_SUCCESS);
+	CHECK(x.len == 3 && buf[0] == 0x56 && buf[2] == 0x12 && selects == 0);
+
+	/* past the register map, EMD says BAD_CMD */
+	one_done = 0;
+	CHECK(a_sys_ssi_read(&ssi, &x, emd_ssid[2], MAX_REG_ADRS, 2, buf, one_fn, NULL) == WICED_SUCCESS);
+	CHECK(run_until(&one_done, 1, 1000) && one_result == WICED_ERROR);
+	CHECK(ssi.errors == errors + 1);
+}
+
+/* missing meter times out, the bus keeps working after */
+static void test_absent(void)
+{
+	sys_ssi_xfer_t x;
+	uint8_t buf[3];
+
+	memset(&x, 0, sizeof(x));
+
+	one_done = 0;
+	CHECK(a_sys_ssi_read(&ssi, &x, emd_ssid[ABSENT], 0, 1, buf, one_fn, NULL) == WICED_SUCCESS);
+	CHECK(run_until(&one_done, 1, SYS_SSI_TIMEOUT_MS * 2) && one_result == WICED_TIMEOUT);
+	CHECK(ssi.timeouts == 1);
+
+	one_done = 0;
+	CHECK(a_sys_ssi_read(&ssi, &x, emd_ssid[1], 5, 1, buf, one_fn, NULL) == WICED_SUCCESS);
+	CHECK(run_until(&one_done, 1, 1000) && one_result == WICED_SUCCESS);
+	CHECK(memcmp(buf, emd[1].map + 15, 3) == 0);
+}
+
+int main(void)
+{
+	static const wiced_uart_config_t config = { 9600 };
+	static uint8_t maxim_ring[1024];
+	wiced_ring_buffer_t rx;
+	int i, k;
+
+	for (i = 0; i < EMDS; i++)
+		for (k = 0; k < MAP_SIZE; k++)
+			emd[i].map[k] = (uint8_t)(k * 13 + i * 101);
+	host_uart_tx_fn = emd_fn;
+
+	/* maxim_ssi reads the ring itself */
+	ring_buffer_init(&rx, maxim_ring, sizeof(maxim_ring));
+	CHECK(wiced_uart_init(0, &config, &rx) == WICED_SUCCESS);
+	test_maxim();
+
+	a_eventloop_init(&evt);
+	CHECK(a_sys_ssi_init(&ssi, &evt, 1, 0, 9600, ring, sizeof(ring)) == WICED_SUCCESS);
+
+	test_queue();
+	test_write_and_errors();
+	test_absent();
+
+	printf("timeouts %u, errors %u\n", (unsigned)ssi.timeouts, (unsigned)ssi.errors);
+	wiced_rtos_deinit_timer(&ssi.uart.rx_timer);
+	wiced_rtos_deinit_timer(&ssi.uart.rx_idle_timer);
+	if (fails)
+		printf("%d failed\n", fails);
+	else
+		printf("ok\n");
+	return fails != 0;
+}
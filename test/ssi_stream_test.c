@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+#include "wiced_host.h"
+#include "eventloop.h"
+#include "sys_ssi.h"
+
+/* sys_ssi auto report streaming. A feeder thread plays the EMD sending
+ * reports of 4 registers about every ms, with stray NACKs and a broken
+ * report, a consumer thread takes the samples as the application
+ * would. Every report must be parsed, and queued or counted dropped. */
+
+static int fails;
+
+#define CHECK(c) do {							\
+		if (!(c)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #c);	\
+			fails++;					\
+		}							\
+	} while (0)
+
+#define REPORTS		3000
+#define REGS		4
+#define NACK_EVERY	50
+#define REPORT_SIZE	(3 + REGS * 3)
+
+static eventloop_t evt;
+static sys_ssi_t ssi;
+static uint8_t ring[2048];
+
+static int notes;
+static int fed;
+static int got;
+static int out_of_order;
+
+static void sample_fn(void *arg)
+{
+	notes++;
+}
+
+static void make_report(uint8_t *p, int i)
+{
+	uint32_t v;
+	uint8_t sum = 0;
+	int k;
+
+	p[0] = AUTO_REPORT;
+	p[1] = REPORT_SIZE;
+	for (k = 0; k < REGS; k++) {
+		v = i * REGS + k;
+		p[2 + k * 3] = v;
+		p[3 + k * 3] = v >> 8;
+		p[4 + k * 3] = v >> 16;
+	}
+	for (k = 0; k < REPORT_SIZE - 1; k++)
+		sum += p[k];
+	p[REPORT_SIZE - 1] = -sum;
+}
+
+static void feed(wiced_thread_arg_t arg)
+{
+	uint8_t p[REPORT_SIZE], nack = NACK;
+	int i;
+
+	for (i = 0; i < REPORTS; i++) {
+		make_report(p, i);
+		host_uart_rx(0, p, sizeof(p));
+		if (i % NACK_EVERY == 0)
+			host_uart_rx(0, &nack, 1);
+		wiced_rtos_delay_milliseconds(1);
+	}
+	/* broken checksum, not a report */
+	make_report(p, i);
+	p[5] ^= 1;
+	host_uart_rx(0, p, sizeof(p));
+	__atomic_store_n(&fed, 1, __ATOMIC_SEQ_CST);
+}
+
+/* values go up by REGS per report, gaps only for dropped ones */
+static void consume(wiced_thread_arg_t arg)
+{
+	sys_ssi_sample_t s;
+	uint32_t next = 0;
+	int k;
+
+	while (got + __atomic_load_n(&ssi.dropped, __ATOMIC_SEQ_CST) < REPORTS) {
+		if (!a_sys_ssi_sample_get(&ssi, &s)) {
+			wiced_rtos_delay_milliseconds(1);
+			continue;
+		}
+		if (s.n != REGS || s.value[0] % REGS || s.value[0] < next)
+			out_of_order++;
+		for (k = 1; k < s.n; k++)
+			if (s.value[k] != s.value[0] + k)
+				out_of_order++;
+		next = s.value[0] + REGS;
+		got++;
+	}
+}
+
+int main(void)
+{
+	wiced_thread_t feeder, consumer;
+	const uint8_t ack = ACK_NO_DATA;
+	uint32_t t0, t;
+
+	a_eventloop_init(&evt);
+	CHECK(a_sys_ssi_init(&ssi, &evt, 1, 0, 115200, ring, sizeof(ring)) == WICED_SUCCESS);
+
+	/* control write goes out, no select for ssid 0 */
+	CHECK(a_sys_ssi_stream_start(&ssi, 0, EM_CONTROL, 0x000100, sample_fn, NULL) == WICED_SUCCESS);
+	CHECK(host_uart_tx_len == 10 && host_uart_tx[0] == HEADER && host_uart_tx[1] == 10 &&
+	      host_uart_tx[5] == (WRITE_BYTES | 3));
+	host_uart_rx(0, &ack, 1);
+	a_eventloop(&evt, 20);
+	CHECK(!ssi.ctrl.busy && ssi.errors == 0);
+
+	wiced_rtos_create_thread(&feeder, 0, "feed", feed, 0, NULL);
+	wiced_rtos_create_thread(&consumer, 0, "consume", consume, 0, NULL);
+	wiced_time_get_time(&t0);
+	do {
+		a_eventloop(&evt, 10);
+		wiced_time_get_time(&t);
+	} while ((!__atomic_load_n(&fed, __ATOMIC_SEQ_CST) || ssi.framer.errors == 0) && t - t0 < 20000);
+	wiced_rtos_thread_join(&feeder);
+	wiced_rtos_thread_join(&consumer);
+
+	printf("reports %u, got %d, dropped %u, notes %d, errors %u\n", (unsigned)ssi.reports, got,
+	       (unsigned)ssi.dropped, notes, (unsigned)ssi.errors);
+	CHECK(ssi.reports == REPORTS);
+	CHECK(got + ssi.dropped == REPORTS);
+	CHECK(out_of_order == 0);
+	CHECK(notes > 0 && notes <= REPORTS);
+	CHECK(ssi.errors == (REPORTS + NACK_EVERY - 1) / NACK_EVERY);
+	CHECK(ssi.framer.errors == 1);
+	CHECK(host_uart_dropped == 0);
+
+	host_uart_tx_len = 0;
+	CHECK(a_sys_ssi_stream_stop(&ssi, EM_CONTROL, 0) == WICED_SUCCESS);
+	CHECK(host_uart_tx_len == 10 && ssi.sample_fn == NULL);
+	host_uart_rx(0, &ack, 1);
+	a_eventloop(&evt, 20);
+	CHECK(!ssi.ctrl.busy);
+
+	wiced_rtos_deinit_timer(&ssi.uart.rx_timer);
+	wiced_rtos_deinit_timer(&ssi.uart.rx_idle_timer);
+	if (fails)
+		printf("%d failed\n", fails);
+	else
+		printf("ok\n");
+	return fails != 0;
+}
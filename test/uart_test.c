@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+#include "wiced_host.h"
+#include "eventloop.h"
+#include "sys_uart.h"
+
+/* sys_uart rx on the host stand-ins, the ring is fed as the rx
+ * interrupt would. Checks delivery, the switch to the idle tick and
+ * back, the timer wakeups while idle, and the ring accounting when the
+ * eventloop stalls. */
+
+static int fails;
+
+#define CHECK(c) do {							\
+		if (!(c)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #c);	\
+			fails++;					\
+		}							\
+	} while (0)
+
+#define BAUD		115200
+#define RING_SIZE	2048	/* no warning at BAUD */
+#define STREAM_SIZE	8000
+#define CHUNK		(BAUD / 10 / 1000)	/* bytes per ms */
+#define OVER		100	/* bytes past a full ring */
+
+static eventloop_t evt;
+static sys_uart_t uart;
+static uint8_t ring[RING_SIZE];
+
+static uint8_t got[STREAM_SIZE];
+static uint32_t got_len;
+
+static void recv(void *arg, const char *buf, uint32_t size)
+{
+	if (size > sizeof(got) - got_len)
+		size = sizeof(got) - got_len;
+	memcpy(got + got_len, buf, size);
+	got_len += size;
+}
+
+static uint32_t now(void)
+{
+	wiced_time_t t;
+
+	wiced_time_get_time(&t);
+	return t;
+}
+
+/* eventloop until len bytes came or ms passed, returns ms taken */
+static uint32_t run_until(uint32_t len, uint32_t ms)
+{
+	uint32_t start = now();
+
+	while (got_len < len && now() - start < ms)
+		a_eventloop(&evt, 1);
+	return now() - start;
+}
+
+static void run(uint32_t ms)
+{
+	a_eventloop(&evt, ms);
+}
+
+static int fast(void)
+{
+	return __atomic_load_n(&uart.rx_fast, __ATOMIC_SEQ_CST);
+}
+
+/* eventloop until the switch to the idle tick, timer threads may lag */
+static void run_idle(uint32_t ms)
+{
+	uint32_t start = now();
+
+	while (fast() && now() - start < ms)
+		a_eventloop(&evt, 5);
+}
+
+static void test_idle(void)
+{
+	const uint32_t idle_after = UART_RX_TICK_MS * UART_RX_IDLE_TICKS;
+	long ticks;
+	uint32_t ms;
+
+	CHECK(fast());
+	host_uart_rx(0, (const uint8_t*)"hello", 5);
+	run_until(5, 100);
+	CHECK(got_len == 5 && memcmp(got, "hello", 5) == 0);
+	CHECK(fast());
+
+	/* empty line goes to the idle tick */
+	run_idle(idle_after * 4);
+	CHECK(!fast());
+
+	/* over the time it took, the eventloop may oversleep */
+	ticks = __atomic_load_n(&host_timer_ticks, __ATOMIC_SEQ_CST);
+	ms = now();
+	run(1000);
+	ms = now() - ms;
+	ticks = __atomic_load_n(&host_timer_ticks, __ATOMIC_SEQ_CST) - ticks;
+	printf("idle: %ld ticks in %u ms, fast tick is %d/s\n", ticks, (unsigned)ms, 1000 / UART_RX_TICK_MS);
+	CHECK(ticks <= (long)(ms / UART_RX_IDLE_MS) + 2);
+
+	/* first bytes after idle wait one idle tick at most */
+	host_uart_rx(0, (const uint8_t*)"world", 5);
+	ms = run_until(10, 1000);
+	printf("first bytes after idle in %u ms\n", (unsigned)ms);
+	CHECK(got_len == 10 && memcmp(got + 5, "world", 5) == 0);
+	CHECK(ms <= UART_RX_IDLE_MS + 20);
+	CHECK(fast());
+
+	run_idle(idle_after * 4);
+	CHECK(!fast());
+	a_sys_uart_rx_wake(&uart);
+	CHECK(fast());
+	host_uart_rx(0, (const uint8_t*)"!", 1);
+	ms = run_until(11, 1000);
+	CHECK(got_len == 11 && got[10] == '!');
+	CHECK(ms <= UART_RX_TICK_MS * 4 + 10);
+
+	/* nothing came after a wake, back to idle */
+	run_idle(idle_after * 4);
+	CHECK(!fast());
+}
+
+static wiced_thread_t feeder;
+
+/* about BAUD, starts on the idle tick */
+static void feed(wiced_thread_arg_t arg)
+{
+	static uint8_t data[STREAM_SIZE];
+	uint32_t i;
+
+	for (i = 0; i < STREAM_SIZE; i++)
+		data[i] = (uint8_t)(i * 7);
+	for (i = 0; i < STREAM_SIZE; i += CHUNK) {
+		host_uart_rx(0, data + i, MIN(CHUNK, STREAM_SIZE - i));
+		wiced_rtos_delay_milliseconds(1);
+	}
+}
+
+static void test_stream(void)
+{
+	uint32_t i;
+	int ok = 1;
+
+	CHECK(!fast());
+	got_len = 0;
+	wiced_rtos_create_thread(&feeder, 0, "feed", feed, 0, NULL);
+	run_until(STREAM_SIZE, 10000);
+	wiced_rtos_thread_join(&feeder);
+
+	CHECK(got_len == STREAM_SIZE);
+	for (i = 0; i < got_len; i++)
+		if (got[i] != (uint8_t)(i * 7))
+			ok = 0;
+	CHECK(ok);
+	printf("stream: high water %u of %u\n", (unsigned)uart.rx_high_water, RING_SIZE);
+	CHECK(uart.rx_high_water > 0 && uart.rx_high_water < RING_SIZE - 1);
+	CHECK(uart.rx_overruns == 0);
+}
+
+/* eventloop does not run while the line fills the ring and more, the
+ * ticks see it full until it drains */
+static void test_overrun(void)
+{
+	static uint8_t data[RING_SIZE + OVER];
+	uint32_t i, overruns;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (uint8_t)i;
+	got_len = 0;
+	a_sys_uart_rx_wake(&uart);
+	CHECK(host_uart_rx(0, data, sizeof(data)) == RING_SIZE - 1);
+	CHECK(host_uart_dropped == OVER + 1);
+	wiced_rtos_delay_milliseconds(UART_RX_TICK_MS * 10);
+	overruns = __atomic_load_n(&uart.rx_overruns, __ATOMIC_SEQ_CST);
+	printf("overrun: high water %u, %u full ticks\n", (unsigned)uart.rx_high_water,
+	       (unsigned)overruns);
+	CHECK(uart.rx_high_water == RING_SIZE - 1);
+	CHECK(overruns >= 2);
+
+	run_until(RING_SIZE - 1, 1000);
+	CHECK(got_len == RING_SIZE - 1 && memcmp(got, data, got_len) == 0);
+	overruns = __atomic_load_n(&uart.rx_overruns, __ATOMIC_SEQ_CST);
+	run(UART_RX_TICK_MS * 10);
+	CHECK(uart.rx_overruns == overruns);
+}
+
+int main(void)
+{
+	a_eventloop_init(&evt);
+	CHECK(a_sys_uart_init(&uart, 0, BAUD, ring, sizeof(ring), WICED_FALSE) == WICED_SUCCESS);
+	CHECK(a_sys_uart_register_event(&uart, &evt, 1, recv, NULL) == WICED_SUCCESS);
+
+	test_idle();
+	test_stream();
+	CHECK(host_uart_dropped == 0);
+	test_overrun();
+
+	wiced_rtos_deinit_timer(&uart.rx_timer);
+	wiced_rtos_deinit_timer(&uart.rx_idle_timer);
+	if (fails)
+		printf("%d failed\n", fails);
+	else
+		printf("ok\n");
+	return fails != 0;
+}
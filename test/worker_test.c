@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2018 HummingLab.io
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "wiced.h"
+#include "eventloop.h"
+#include "sys_worker.h"
+
+/* sys_worker on a two thread pool. A run can be held on its pool thread
+ * to see triggers while it is running coalesce into one more run, and
+ * starts are timed against the min interval. Held past its deadline a
+ * run is reported timed out by the pool watchdog, and tasks report once
+ * whether they return, time out or are cancelled. Other threads can
+ * not submit to the pool. */
+
+static int fails;
+
+#define CHECK(c) do {							\
+		if (!(c)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #c);	\
+			fails++;					\
+		}							\
+	} while (0)
+
+#define LONG_MS		100000	/* interval that never comes in a test */
+#define MIN_MS		100
+#define TIMEOUT_MS	50
+
+static eventloop_t evt;
+static sys_pool_t pool;
+
+static int hold;		/* runs wait while set */
+static int runs;		/* started */
+static int finishes;
+static sys_job_status_t last_status;
+static wiced_time_t started[8];
+
+static void work_fn(void *arg)
+{
+	int n = __atomic_fetch_add(&runs, 1, __ATOMIC_SEQ_CST);
+
+	if (n < (int)(sizeof(started) / sizeof(started[0])))
+		wiced_time_get_time(&started[n]);
+	while (__atomic_load_n(&hold, __ATOMIC_SEQ_CST))
+		wiced_rtos_delay_milliseconds(1);
+}
+
+static void finish_fn(void *arg, sys_job_status_t status)
+{
+	last_status = status;
+	finishes++;
+}
+
+static int run_until(const int *done, int n, uint32_t ms)
+{
+	wiced_time_t t0, t;
+
+	wiced_time_get_time(&t0);
+	do {
+		a_eventloop(&evt, 5);
+		wiced_time_get_time(&t);
+	} while (__atomic_load_n(done, __ATOMIC_SEQ_CST) < n && t - t0 < ms);
+	return __atomic_load_n(done, __ATOMIC_SEQ_CST) >= n;
+}
+
+static void start(void)
+{
+	runs = 0;
+	finishes = 0;
+	last_status = -1;
+}
+
+/* triggers while running collapse into one rerun */
+static void test_coalesce(void)
+{
+	static sys_worker_t w;
+	int i;
+
+	start();
+	CHECK(a_sys_worker_init(&w, &pool, LONG_MS, work_fn, finish_fn, NULL) == WICED_SUCCESS);
+	hold = 1;
+	CHECK(a_sys_worker_trigger(&w) == WICED_SUCCESS);
+	CHECK(run_until(&runs, 1, 1000));
+	CHECK(w.state == SYS_WORKER_RUNNING);
+	for (i = 0; i < 10; i++)
+		CHECK(a_sys_worker_trigger(&w) == WICED_SUCCESS);
+	CHECK(w.state == SYS_WORKER_RERUN);
+
+	__atomic_store_n(&hold, 0, __ATOMIC_SEQ_CST);
+	CHECK(run_until(&finishes, 2, 1000));
+	run_until(&finishes, 3, 100);
+	CHECK(runs == 2 && finishes == 2 && last_status == SYS_JOB_OK);
+	CHECK(w.state == SYS_WORKER_IDLE);
+}
+
+/* a trigger too soon after a start waits for the min interval, more
+ * triggers meanwhile do not add runs */
+static void test_min_interval(void)
+{
+	static sys_worker_t w;
+	int i;
+
+	start();
+	CHECK(a_sys_worker_init(&w, &pool, LONG_MS, work_fn, finish_fn, NULL) == WICED_SUCCESS);
+	CHECK(a_sys_worker_set_min_interval(&w, MIN_MS) == WICED_SUCCESS);
+	CHECK(a_sys_worker_trigger(&w) == WICED_SUCCESS);
+	CHECK(run_until(&finishes, 1, 1000));
+
+	for (i = 0; i < 5; i++)
+		CHECK(a_sys_worker_trigger(&w) == WICED_SUCCESS);
+	CHECK(runs == 1 && w.state == SYS_WORKER_IDLE);
+	CHECK(run_until(&finishes, 2, 1000));
+	run_until(&finishes, 3, MIN_MS * 2);
+	CHECK(runs == 2 && finishes == 2);
+	printf("min interval %d ms, started %d ms apart\n", MIN_MS, (int)(started[1] - started[0]));
+	CHECK((int)(started[1] - started[0]) >= MIN_MS);
+	CHECK((int)(started[1] - started[0]) <= MIN_MS + 50);
+}
+
+/* stuck run times out once, starts while it is stuck are reported and
+ * not queued, its late return is not reported again */
+static void test_timeout(void)
+{
+	static sys_worker_t w;
+	wiced_time_t t0, t;
+
+	start();
+	CHECK(a_sys_worker_init(&w, &pool, LONG_MS, work_fn, finish_fn, NULL) == WICED_SUCCESS);
+	CHECK(a_sys_worker_set_timeout(&w, TIMEOUT_MS) == WICED_SUCCESS);
+	hold = 1;
+	wiced_time_get_time(&t0);
+	CHECK(a_sys_worker_trigger(&w) == WICED_SUCCESS);
+	CHECK(a_eventloop_get_timer_fn(&evt, &pool.watchdog) != NULL);
+	CHECK(run_until(&finishes, 1, 1000));
+	wiced_time_get_time(&t);
+	printf("deadline %d ms, timed out after %d ms\n", TIMEOUT_MS, (int)(t - t0));
+	CHECK(last_status == SYS_JOB_TIMEOUT && pool.overdue == 1);
+	CHECK((int)(t - t0) >= TIMEOUT_MS && (int)(t - t0) <= TIMEOUT_MS + SYS_POOL_WATCHDOG_MS + 50);
+	CHECK(a_sys_worker_cancelled(&w));
+	/* nothing left to watch */
+	CHECK(pool.tasks.count == 0 && a_eventloop_get_timer_fn(&evt, &pool.watchdog) == NULL);
+
+	last_status = -1;
+	CHECK(a_sys_worker_trigger(&w) == WICED_SUCCESS);
+	CHECK(finishes == 2 && last_status == SYS_JOB_TIMEOUT && runs == 1);
+
+	__atomic_store_n(&hold, 0, __ATOMIC_SEQ_CST);
+	run_until(&finishes, 3, 100);
+	CHECK(finishes == 2 && !a_sys_task_busy(&w.task));
+
+	/* and runs again once it returned */
+	CHECK(a_sys_worker_trigger(&w) == WICED_SUCCESS);
+	CHECK(run_until(&finishes, 3, 1000));
+	CHECK(runs == 2 && last_status == SYS_JOB_OK && pool.overdue == 1);
+}
+
+static int task_reports;
+static sys_job_status_t task_status;
+
+static void task_fn(void *arg)
+{
+	sys_task_t *t = arg;
+
+	__atomic_add_fetch(&runs, 1, __ATOMIC_SEQ_CST);
+	while (!a_sys_task_cancelled(t))
+		wiced_rtos_delay_milliseconds(1);
+}
+
+static void task_done_fn(void *arg, sys_job_status_t status)
+{
+	task_status = status;
+	task_reports++;
+}
+
+/* cancel reports at once, the task is busy until fn returns */
+static void test_cancel(void)
+{
+	static sys_task_t t;
+
+	start();
+	task_reports = 0;
+	CHECK(a_sys_task_submit(&pool, &t, task_fn, task_done_fn, &t, LONG_MS) == WICED_SUCCESS);
+	CHECK(run_until(&runs, 1, 1000));
+	CHECK(a_sys_task_submit(&pool, &t, task_fn, task_done_fn, &t, 0) != WICED_SUCCESS);
+	a_sys_task_cancel(&t);
+	CHECK(task_reports == 1 && task_status == SYS_JOB_CANCELLED);
+	CHECK(pool.tasks.count == 0 && a_eventloop_get_timer_fn(&evt, &pool.watchdog) == NULL);
+	a_sys_task_cancel(&t);
+	CHECK(task_reports == 1);
+
+	CHECK(run_until((int*)&t.busy, 2, 100) == 0 && !t.busy);
+	CHECK(task_reports == 1 && runs == 1);
+}
+
+static void submit_fn(wiced_thread_arg_t arg)
+{
+	*(wiced_result_t*)arg = a_sys_pool_submit(&pool, work_fn, NULL, NULL);
+}
+
+/* the eventloop deque has one owner */
+static void test_foreign(void)
+{
+	wiced_thread_t th;
+	wiced_result_t res = WICED_SUCCESS;
+
+	wiced_rtos_create_thread(&th, 0, "foreign", submit_fn, 0, &res);
+	wiced_rtos_thread_join(&th);
+	CHECK(res != WICED_SUCCESS);
+}
+
+int main(void)
+{
+	a_eventloop_init(&evt);
+	CHECK(a_sys_pool_init(&pool, &evt, 1, 2, 4096, 8) == WICED_SUCCESS);
+
+	test_coalesce();
+	test_min_interval();
+	test_timeout();
+	test_cancel();
+	test_foreign();
+
+	__atomic_store_n(&hold, 0, __ATOMIC_SEQ_CST);
+	a_sys_pool_deinit(&pool);
+	if (fails)
+		printf("%d failed\n", fails);
+	else
+		printf("ok\n");
+	return fails != 0;
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2018 HummingLab.io
+#
+# This software may be modified and distributed under the terms
+# of the MIT license.  See the LICENSE file for details.
+#
+"""Compress an image for common/ota_lz.c
+
+usage: ota_compress.py [-w window_bits] [-l lookahead_bits] <in.bin> <out.hs>
+       ota_compress.py -d <in.hs> <out.bin>
+
+window_bits must not exceed A_LZ_WINDOW_BITS of the firmware (10).
+"""
+import getopt
+import struct
+import sys
+
+MAGIC = b'AHS1'
+CHAIN = 16		# match candidates tried per position
+
+
+class _Bits:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.n = 0
+
+    def put(self, v, n):
+        self.acc = (self.acc << n) | v
+        self.n += n
+        while self.n >= 8:
+            self.n -= 8
+            self.out.append((self.acc >> self.n) & 0xff)
+        self.acc &= (1 << self.n) - 1
+
+    def done(self):
+        if self.n:
+            self.out.append((self.acc << (8 - self.n)) & 0xff)
+        return bytes(self.out)
+
+
+def compress(data, w=10, l=5):
+    win, maxlen = 1 << w, 1 << l
+    bits = _Bits()
+    head, prev = {}, [0] * len(data)
+    # a match must be shorter in bits than the literals it replaces
+    minlen = (1 + w + l) // 9 + 1
+    i = 0
+
+    def insert(k):
+        if k + 3 <= len(data):
+            key = data[k:k + 3]
+            prev[k] = head.get(key, -1)
+            head[key] = k
+
+    while i < len(data):
+        best, dist = 0, 0
+        if i + 3 <= len(data):
+            j, tries = head.get(data[i:i + 3], -1), CHAIN
+            while j >= 0 and i - j <= win and tries:
+                n = 0
+                while n < maxlen and i + n < len(data) and data[j + n] == data[i + n]:
+                    n += 1
+                if n > best:
+                    best, dist = n, i - j
+                    if n == maxlen:
+                        break
+                j, tries = prev[j], tries - 1
+        if best >= minlen:
+            bits.put(0, 1)
+            bits.put(dist - 1, w)
+            bits.put(best - 1, l)
+            for k in range(i, i + best):
+                insert(k)
+            i += best
+        else:
+            bits.put(1, 1)
+            bits.put(data[i], 8)
+            insert(i)
+            i += 1
+    return MAGIC + struct.pack('<BBxxI', w, l, len(data)) + bits.done()
+
+
+def decompress(z):
+    if z[:4] != MAGIC:
+        raise ValueError('bad magic')
+    w, l, size = struct.unpack_from('<BBxxI', z, 4)
+    out = bytearray()
+    acc, n, p = 0, 0, 12
+
+    def get(k):
+        nonlocal acc, n, p
+        while n < k:
+            acc = (acc << 8) | z[p]
+            p, n = p + 1, n + 8
+        n -= k
+        v = acc >> n
+        acc &= (1 << n) - 1
+        return v
+
+    while len(out) < size:
+        if get(1):
+            out.append(get(8))
+        else:
+            dist, count = get(w) + 1, get(l) + 1
+            for _ in range(count):
+                out.append(out[-dist] if dist <= len(out) else 0)
+    return bytes(out)
+
+
+def main(argv):
+    opts, args = getopt.getopt(argv[1:], 'dw:l:')
+    opts = dict(opts)
+    if len(args) != 2:
+        sys.exit(__doc__)
+    data = open(args[0], 'rb').read()
+    if '-d' in opts:
+        r = decompress(data)
+    else:
+        r = compress(data, int(opts.get('-w', 10)), int(opts.get('-l', 5)))
+        if decompress(r) != data:
+            sys.exit('compressed image does not reproduce input')
+        print('%d -> %d bytes' % (len(data), len(r)))
+    open(args[1], 'wb').write(r)
+
+
+if __name__ == '__main__':
+    main(sys.argv)
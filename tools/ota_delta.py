@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2018 HummingLab.io
+#
+# This software may be modified and distributed under the terms
+# of the MIT license.  See the LICENSE file for details.
+#
+"""Make a delta image for common/ota_delta.c
+
+usage: ota_delta.py diff <old.bin> <new.bin> <out.delta>
+       ota_delta.py apply <old.bin> <in.delta> <out.bin>
+"""
+import hashlib
+import struct
+import sys
+
+MAGIC = b'ADF1'
+GRAM = 8		# bytes hashed to find match candidates
+MIN_MATCH = 24		# shorter matches are sent as extra bytes
+
+
+def _index(old):
+    idx = {}
+    for i in range(0, len(old) - GRAM + 1):
+        idx.setdefault(old[i:i + GRAM], i)
+    return idx
+
+
+def _extend(old, new, o, n):
+    """bsdiff style approximate extension, stop where matches fall
+    below half of the bytes"""
+    best, score, best_score, i = 0, 0, 0, 0
+    while o + i < len(old) and n + i < len(new):
+        score += 1 if old[o + i] == new[n + i] else -1
+        i += 1
+        if score > best_score:
+            best, best_score = i, score
+        elif score < best_score - 2 * GRAM:
+            break
+    return best
+
+
+def _zrle(data):
+    """0x00 n is n + 1 zero bytes"""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        if data[i]:
+            out.append(data[i])
+            i += 1
+            continue
+        j = i
+        while j < len(data) and j - i < 256 and data[j] == 0:
+            j += 1
+        out += bytes((0, j - i - 1))
+        i = j
+    return bytes(out)
+
+
+def _unzrle(patch, p, n):
+    """returns n decoded bytes and next patch position"""
+    out = bytearray()
+    while len(out) < n:
+        if patch[p]:
+            out.append(patch[p])
+            p += 1
+        else:
+            out += bytes(patch[p + 1] + 1)
+            p += 2
+    return bytes(out), p
+
+
+def diff(old, new):
+    idx = _index(old)
+    out = [MAGIC, struct.pack('<II', len(old), len(new)), hashlib.sha256(old).digest()]
+    records = []		# [old pos, diff len, extra start, extra len]
+    n = 0
+    extra = 0
+    while n < len(new):
+        o = idx.get(new[n:n + GRAM]) if n + GRAM <= len(new) else None
+        if o is not None:
+            m = _extend(old, new, o, n)
+            if m >= MIN_MATCH:
+                if records or extra < n:
+                    if records:
+                        records[-1][3] = n - records[-1][2]
+                    else:
+                        records.append([0, 0, 0, n])
+                records.append([o, m, n + m, 0])
+                n += m
+                extra = n
+                continue
+        n += 1
+    if records:
+        records[-1][3] = len(new) - records[-1][2]
+    else:
+        records.append([0, 0, 0, len(new)])
+
+    new_pos = 0
+    for k, (o, m, e, el) in enumerate(records):
+        nxt = records[k + 1][0] if k + 1 < len(records) else o + m
+        out.append(struct.pack('<IIi', m, el, nxt - (o + m)))
+        out.append(_zrle(bytes((new[new_pos + i] - old[o + i]) & 0xff for i in range(m))))
+        out.append(new[e:e + el])
+        new_pos = e + el
+    return b''.join(out)
+
+
+def apply(old, patch):
+    if patch[:4] != MAGIC:
+        raise ValueError('bad magic')
+    source_len, target_len = struct.unpack_from('<II', patch, 4)
+    if source_len != len(old) or patch[12:44] != hashlib.sha256(old).digest():
+        raise ValueError('delta is not made from this source')
+    p, src, out = 44, 0, bytearray()
+    while len(out) < target_len:
+        m, el, seek = struct.unpack_from('<IIi', patch, p)
+        p += 12
+        d, p = _unzrle(patch, p, m)
+        out += bytes((old[src + i] + d[i]) & 0xff for i in range(m))
+        out += patch[p:p + el]
+        p += el
+        src += m + seek
+    return bytes(out)
+
+
+def main(argv):
+    if len(argv) != 5 or argv[1] not in ('diff', 'apply'):
+        sys.exit(__doc__)
+    a = open(argv[2], 'rb').read()
+    b = open(argv[3], 'rb').read()
+    if argv[1] == 'diff':
+        r = diff(a, b)
+        if apply(a, r) != b:
+            sys.exit('delta does not reproduce new image')
+        print('%d -> %d bytes' % (len(b), len(r)))
+    else:
+        r = apply(a, b)
+    open(argv[4], 'wb').write(r)
+
+
+if __name__ == '__main__':
+    main(sys.argv)